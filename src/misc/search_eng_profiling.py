@@ -4,6 +4,8 @@ Copyright (C) Guanyuming He 2025
 The file is licensed under the GNU GPL v3.
 
 The file profiles the search engine response time.
+It times the searcher program, so starting it and opening the db are counted.
+For the latency of the matcher alone, see the search_bench tool.
 """
 
 import sys
@@ -13,6 +13,13 @@ import subprocess
 
 from config import Config, SearchConf
 
+# Let the matcher prefer fresh articles among relevant ones, so that they are
+# in the few results returned. The weight halves every this many days.
+SEARCH_HALF_LIFE = 7
+# Drop the matches less than this percent as relevant as the best one. Besides
+# trimming the tail, it lets the matcher skip documents early on broad queries.
+SEARCH_PERCENT_CUTOFF = 20
+
 def custom_search(
 	search_prompt: str,
 	start_date : datetime.date, end_date : datetime.date
@@ -30,7 +37,15 @@ def custom_search(
 	print(search_prompt)
 
 	try:
-		cmd = ["./bin/searcher", "./db", search_prompt]
+		cmd = [
+			"./bin/searcher", "./db",
+			"--order=blended", f"--half-life={SEARCH_HALF_LIFE}",
+			f"--percent-cutoff={SEARCH_PERCENT_CUTOFF}",
+			# One result per story, so that the slots are not taken by
+			# copies of the same syndicated piece.
+			"--collapse",
+			search_prompt
+		]
 		result = subprocess.run(
 			cmd,
 			capture_output=True,
@@ -50,7 +65,16 @@ def custom_search(
 		lines = result.stdout.splitlines()
 		return '\n'.join(lines[2:])
 		
-	except subprocess.TimeoutExpired:
+	except subprocess.TimeoutExpired as e:
+		# The searcher flushes each complete result, so those printed before
+		# the timeout are still usable. The output is bytes here even with
+		# text=True.
+		out = e.stdout or b""
+		if isinstance(out, bytes):
+			out = out.decode(errors="replace")
+		lines = out.splitlines()
+		if len(lines) > 2:
+			return '\n'.join(lines[2:])
 		raise RuntimeError(f"Search timeout for prompt: {search_prompt}")
 	except Exception as e:
 		raise RuntimeError(f"Search error for '{search_prompt}': {e}")
@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines bounded_queue, a blocking queue with a capacity, for
+ * passing work between threads.
+ *
+ * @author Guanyuming He
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * push() blocks while the queue is full, so that a fast producer cannot use
+ * up the memory; pop() blocks while it is empty.
+ *
+ * After close(), push() discards its item, and pop() returns the items left
+ * and then nothing, so that the consumers know to stop.
+ */
+template <typename T>
+class bounded_queue final
+{
+public:
+	explicit bounded_queue(size_t capacity):
+		capacity(capacity)
+	{}
+
+	bounded_queue(const bounded_queue&) = delete;
+	bounded_queue& operator=(const bounded_queue&) = delete;
+
+public:
+	// @returns false if the queue is closed, and item is discarded.
+	bool push(T&& item)
+	{
+		std::unique_lock lock(m);
+		not_full.wait(lock, [this] {
+			return closed || items.size() < capacity;
+		});
+		if (closed)
+			return false;
+
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	// @returns nothing iff the queue is closed and empty.
+	std::optional<T> pop()
+	{
+		std::unique_lock lock(m);
+		not_empty.wait(lock, [this] { return closed || !items.empty(); });
+		if (items.empty())
+			return std::nullopt;
+
+		std::optional<T> ret(std::move(items.front()));
+		items.pop_front();
+		not_full.notify_one();
+		return ret;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard lock(m);
+			closed = true;
+		}
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard lock(m);
+		return items.size();
+	}
+
+private:
+	const size_t capacity;
+	std::deque<T> items;
+	bool closed = false;
+
+	mutable std::mutex m;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+};
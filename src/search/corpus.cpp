@@ -0,0 +1,402 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the page corpus.
+ *
+ * @author Guanyuming He
+ */
+
+#include "corpus.h"
+
+#include "utility.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include <zstd.h>
+
+namespace
+{
+	struct record_header
+	{
+		std::uint32_t magic;
+		std::uint32_t status;
+		std::uint32_t url_size;
+		std::uint32_t headers_size;
+		std::uint64_t body_size;
+	};
+
+	std::string encode_headers(const std::map<std::string, std::string>& h)
+	{
+		std::string ret;
+		for (const auto& [k, v] : h)
+		{
+			ret.append(k);
+			ret.append(": ");
+			ret.append(v);
+			ret.push_back('\n');
+		}
+		return ret;
+	}
+
+	std::map<std::string, std::string> decode_headers(const std::string& s)
+	{
+		std::map<std::string, std::string> ret;
+		size_t pos = 0;
+		while (pos < s.size())
+		{
+			auto end = s.find('\n', pos);
+			if (end == std::string::npos)
+				end = s.size();
+
+			auto sep = s.find(": ", pos);
+			if (sep != std::string::npos && sep < end)
+				ret.emplace(
+					s.substr(pos, sep - pos),
+					s.substr(sep + 2, end - sep - 2)
+				);
+			pos = end + 1;
+		}
+		return ret;
+	}
+}
+
+fs::path corpus::segment_path(const fs::path& dir, unsigned num)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "seg-%06u%s", num, SEGMENT_EXT);
+	return dir / name;
+}
+
+std::vector<fs::path> corpus::segments(const fs::path& dir)
+{
+	std::vector<fs::path> ret;
+	if (!fs::is_directory(dir))
+		return ret;
+
+	for (const auto& e : fs::directory_iterator(dir))
+	{
+		const auto name = e.path().filename().string();
+		if (
+			e.is_regular_file() && name.starts_with("seg-") &&
+			e.path().extension() == SEGMENT_EXT
+		)
+			ret.push_back(e.path());
+	}
+	// The numbers have a fixed width, so they sort as strings.
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+std::uint64_t corpus::url_hash(std::string_view url)
+{
+	std::uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : url)
+	{
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::optional<stored_page> corpus::find(
+	const fs::path& dir, std::string_view url
+) {
+	return corpus_lookup(dir).find(url);
+}
+
+corpus_lookup::corpus_lookup(const fs::path& dir):
+	segs(corpus::segments(dir))
+{
+	// In order, so that later records replace earlier ones.
+	for (size_t i = 0; i < segs.size(); ++i)
+	{
+		auto idx_path = segs[i];
+		idx_path.replace_extension(corpus::INDEX_EXT);
+		std::ifstream idx(idx_path, std::ios::binary);
+
+		std::uint64_t entry[2];
+		while (idx.read(reinterpret_cast<char*>(entry), sizeof(entry)))
+			entries[entry[0]] = {i, entry[1]};
+	}
+}
+
+std::optional<stored_page> corpus_lookup::find(std::string_view url) const
+{
+	auto it = entries.find(corpus::url_hash(url));
+	if (it == entries.end())
+		return std::nullopt;
+
+	const auto [seg, offset] = it->second;
+	std::ifstream ifs(segs[seg], std::ios::binary);
+	ifs.seekg(static_cast<std::streamoff>(offset));
+
+	ZSTD_DCtx* dctx = ZSTD_createDCtx();
+	stored_page p;
+	// A hash may collide.
+	bool found = corpus_reader::read_record(ifs, p, dctx) && p.url == url;
+	ZSTD_freeDCtx(dctx);
+
+	if (!found)
+		return std::nullopt;
+	return p;
+}
+
+corpus_writer::corpus_writer(
+	const fs::path& dir, const corpus_options& opts
+):
+	dir(dir), opts(opts)
+{
+	fs::create_directories(dir);
+
+	auto segs = corpus::segments(dir);
+	unsigned num = 0;
+	if (!segs.empty())
+		num = static_cast<unsigned>(std::stoul(
+			segs.back().stem().string().substr(4)
+		)) + 1;
+	open_segment(num);
+
+	if (opts.compress)
+		cctx = ZSTD_createCCtx();
+}
+
+corpus_writer::~corpus_writer()
+{
+	ZSTD_freeCCtx(cctx);
+}
+
+void corpus_writer::open_segment(unsigned num)
+{
+	seg_num = num;
+	path = corpus::segment_path(dir, num);
+	auto idx_path = path;
+	idx_path.replace_extension(corpus::INDEX_EXT);
+
+	ofs.close();
+	idx.close();
+	ofs.clear();
+	idx.clear();
+	ofs.open(path, std::ios::binary | std::ios::app);
+	idx.open(idx_path, std::ios::binary | std::ios::app);
+	if (!ofs || !idx)
+		throw std::runtime_error(
+			"Cannot create corpus segment: " + path.string()
+		);
+	seg_size = fs::file_size(path);
+}
+
+void corpus_writer::write(const stored_page& p)
+{
+	std::string_view body(p.body);
+	if (cctx)
+	{
+		zbuf.resize(ZSTD_compressBound(p.body.size()));
+		auto n = ZSTD_compressCCtx(
+			cctx, zbuf.data(), zbuf.size(),
+			p.body.data(), p.body.size(), opts.compression_level
+		);
+		if (ZSTD_isError(n))
+			throw std::runtime_error(
+				std::string("Cannot compress page: ") + ZSTD_getErrorName(n)
+			);
+		body = std::string_view(zbuf.data(), n);
+	}
+
+	const auto headers = encode_headers(p.headers);
+	record_header h {
+		cctx ? corpus::ZMAGIC : corpus::MAGIC, p.status,
+		static_cast<std::uint32_t>(p.url.size()),
+		static_cast<std::uint32_t>(headers.size()),
+		body.size()
+	};
+
+	ofs.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	ofs.write(p.url.data(), p.url.size());
+	ofs.write(headers.data(), headers.size());
+	ofs.write(body.data(), body.size());
+
+	std::uint64_t entry[2] { corpus::url_hash(p.url), seg_size };
+	idx.write(reinterpret_cast<const char*>(entry), sizeof(entry));
+	if (!ofs || !idx)
+		throw std::runtime_error("Cannot write to " + path.string());
+
+	seg_size += sizeof(h) + p.url.size() + headers.size() + body.size();
+	if (opts.segment_size != 0 && seg_size >= opts.segment_size)
+		open_segment(seg_num + 1);
+}
+
+void corpus_writer::flush()
+{
+	ofs.flush();
+	idx.flush();
+}
+
+corpus_reader::corpus_reader(const fs::path& dir):
+	segs(corpus::segments(dir)), dctx(ZSTD_createDCtx())
+{
+	if (!fs::is_directory(dir))
+	{
+		ZSTD_freeDCtx(dctx);
+		throw std::runtime_error("Not a corpus dir: " + dir.string());
+	}
+}
+
+corpus_reader::~corpus_reader()
+{
+	ZSTD_freeDCtx(dctx);
+}
+
+bool corpus_reader::open_next()
+{
+	if (cur_seg >= segs.size())
+		return false;
+
+	ifs.close();
+	ifs.clear();
+	ifs.open(segs[cur_seg++], std::ios::binary);
+	return true;
+}
+
+bool corpus_reader::read_record(
+	std::istream& is, stored_page& p, ZSTD_DCtx* dctx
+) {
+	record_header h;
+	if (
+		!is.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+		(h.magic != corpus::MAGIC && h.magic != corpus::ZMAGIC) ||
+		h.url_size > corpus::MAX_URL_SIZE ||
+		h.headers_size > corpus::MAX_HEADERS_SIZE ||
+		h.body_size > corpus::MAX_BODY_SIZE
+	)
+		return false;
+
+	std::string headers(h.headers_size, '\0');
+	std::string body(h.body_size, '\0');
+	p.url.resize(h.url_size);
+	is.read(p.url.data(), h.url_size);
+	is.read(headers.data(), h.headers_size);
+	is.read(body.data(), h.body_size);
+	if (!is)
+		return false;
+
+	if (h.magic == corpus::ZMAGIC)
+	{
+		auto size = ZSTD_getFrameContentSize(body.data(), body.size());
+		if (
+			size == ZSTD_CONTENTSIZE_ERROR ||
+			size == ZSTD_CONTENTSIZE_UNKNOWN ||
+			size > corpus::MAX_BODY_SIZE
+		)
+			return false;
+
+		p.body.resize(size);
+		auto n = ZSTD_decompressDCtx(
+			dctx, p.body.data(), p.body.size(), body.data(), body.size()
+		);
+		if (ZSTD_isError(n))
+			return false;
+		p.body.resize(n);
+	}
+	else
+		p.body = std::move(body);
+
+	p.status = h.status;
+	p.headers = decode_headers(headers);
+	return true;
+}
+
+bool corpus_reader::next(stored_page& p)
+{
+	while (true)
+	{
+		if (!ifs.is_open() && !open_next())
+			return false;
+
+		if (read_record(ifs, p, dctx))
+			return true;
+
+		// The segment ends, or has a torn tail.
+		ifs.close();
+	}
+}
+
+corpus_archiver::corpus_archiver(
+	const fs::path& dir, const corpus_options& opts, size_t max_buffer
+):
+	w(dir, opts), max_buffer(max_buffer),
+	t(&corpus_archiver::run, this)
+{}
+
+corpus_archiver::~corpus_archiver()
+{
+	{
+		std::lock_guard lock(m);
+		stopping = true;
+	}
+	has_pages.notify_one();
+	t.join();
+}
+
+void corpus_archiver::put(stored_page&& p)
+{
+	const size_t size = p.url.size() + p.body.size();
+
+	std::unique_lock lock(m);
+	// A page larger than the whole buffer still goes, alone.
+	has_room.wait(lock, [this, size] {
+		return pending_size == 0 || pending_size + size <= max_buffer;
+	});
+	pending.push_back(std::move(p));
+	pending_size += size;
+	++num_put;
+	has_pages.notify_one();
+}
+
+void corpus_archiver::flush()
+{
+	std::unique_lock lock(m);
+	const auto target = num_put;
+	written.wait(lock, [this, target] { return num_written >= target; });
+}
+
+void corpus_archiver::run()
+{
+	std::vector<stored_page> batch;
+	while (true)
+	{
+		{
+			std::unique_lock lock(m);
+			has_pages.wait(lock, [this] {
+				return stopping || !pending.empty();
+			});
+			if (pending.empty())
+				return;
+
+			batch.swap(pending);
+			pending_size = 0;
+		}
+		has_room.notify_all();
+
+		try
+		{
+			for (const auto& p : batch)
+				w.write(p);
+			w.flush();
+		}
+		catch (const std::exception& e)
+		{
+			// The fetching goes on without the archive.
+			util_log(std::string("Archive failed: ") + e.what());
+		}
+
+		{
+			std::lock_guard lock(m);
+			num_written += batch.size();
+		}
+		written.notify_all();
+		batch.clear();
+	}
+}
@@ -0,0 +1,272 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the page corpus, a local store of fetched pages, and its
+ * reader and writers.
+ *
+ * Changing the tokenization, the schema, or the date extraction used to mean
+ * crawling the web again for days. With the pages kept as they were fetched,
+ * the db can instead be rebuilt from them at CPU speed (see tools/reindex).
+ *
+ * @author Guanyuming He
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Forward decl of zstd types.
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+/**
+ * A page as it was fetched.
+ */
+struct stored_page
+{
+	// The url the page was finally fetched from.
+	std::string url;
+	// HTTP status, or 0 if unknown.
+	std::uint32_t status = 0;
+	// Names in lowercase, as in html::headers.
+	std::map<std::string, std::string> headers;
+	std::string body;
+};
+
+/**
+ * A corpus is a dir of segment files, named seg-<6 digits>.pages, and read in
+ * the order of their numbers. A segment is:
+ *   <record>*
+ *
+ *   record:
+ *   <uint32_t MAGIC or ZMAGIC> <uint32_t status> <uint32_t url size>
+ *   <uint32_t headers size> <uint64_t body size>
+ *   <url> <headers> <body>
+ *
+ *   headers:
+ *   (<name>: <value>\n)*
+ *
+ * With ZMAGIC, the body is a zstd frame of the original body, and its size is
+ * that of the frame. Pages compress several times, so it is the default.
+ *
+ * Each segment has an index, seg-<6 digits>.idx, for finding a page without
+ * reading the segment through:
+ *   (<uint64_t url_hash(url)> <uint64_t offset of the record>)*
+ *
+ * A torn record at the end of a segment, left by a crash, is ignored.
+ */
+namespace corpus
+{
+	constexpr std::uint32_t MAGIC = 0x45474150u; // "PAGE"
+	constexpr std::uint32_t ZMAGIC = 0x5a474150u; // "PAGZ"
+	constexpr const char* SEGMENT_EXT = ".pages";
+	constexpr const char* INDEX_EXT = ".idx";
+	// No page is this large. A record claiming so is torn.
+	constexpr std::uint64_t MAX_BODY_SIZE = 1ull << 30;
+	constexpr std::uint32_t MAX_URL_SIZE = 1u << 16;
+	constexpr std::uint32_t MAX_HEADERS_SIZE = 1u << 24;
+
+	// @returns dir/seg-<num>.pages.
+	fs::path segment_path(const fs::path& dir, unsigned num);
+	// @returns the segments in dir, in order.
+	std::vector<fs::path> segments(const fs::path& dir);
+
+	// @returns the 64 bit FNV-1a of url, as written in the index.
+	std::uint64_t url_hash(std::string_view url);
+	/**
+	 * Finds the page of url, i.e. the final url it was fetched from, with the
+	 * indices. If it is stored several times, the latest one is found.
+	 * For many lookups, use a corpus_lookup instead.
+	 */
+	std::optional<stored_page> find(const fs::path& dir, std::string_view url);
+}
+
+/**
+ * Keeps the indices of a corpus in memory, for many lookups, e.g. serving it.
+ */
+class corpus_lookup final
+{
+public:
+	corpus_lookup() = delete;
+	// Loads the indices of the segments now in dir.
+	explicit corpus_lookup(const fs::path& dir);
+
+public:
+	// Same as corpus::find(). Thread safe.
+	std::optional<stored_page> find(std::string_view url) const;
+
+	inline size_t size() const
+	{ return entries.size(); }
+
+private:
+	std::vector<fs::path> segs;
+	// url_hash -> (index in segs, offset), of the latest record.
+	std::unordered_map<std::uint64_t, std::pair<size_t, std::uint64_t>>
+		entries;
+};
+
+struct corpus_options
+{
+	// Compress the bodies with zstd.
+	bool compress = true;
+	int compression_level = 3;
+	// A new segment is started once one is larger than this. 0 for never.
+	std::uint64_t segment_size = 256ull << 20;
+};
+
+/**
+ * Appends pages to new segments of a corpus.
+ */
+class corpus_writer final
+{
+public:
+	corpus_writer() = delete;
+	/**
+	 * Creates the dir if needed, and a segment after all that are in it.
+	 * @throws std::runtime_error if it cannot.
+	 */
+	explicit corpus_writer(
+		const fs::path& dir, const corpus_options& opts = corpus_options{}
+	);
+	~corpus_writer();
+
+	// Owns a zstd context.
+	corpus_writer(const corpus_writer&) = delete;
+	corpus_writer& operator=(const corpus_writer&) = delete;
+
+public:
+	void write(const stored_page& p);
+	void flush();
+
+	// @returns the current segment.
+	inline const fs::path& get_path() const
+	{ return path; }
+
+private:
+	// Opens segment num and its index.
+	void open_segment(unsigned num);
+
+private:
+	const fs::path dir;
+	const corpus_options opts;
+
+	unsigned seg_num;
+	fs::path path;
+	std::ofstream ofs;
+	std::ofstream idx;
+	std::uint64_t seg_size = 0;
+
+	ZSTD_CCtx_s* cctx = nullptr;
+	// Reused for compression to avoid reallocations.
+	std::string zbuf;
+};
+
+/**
+ * Reads all pages of a corpus, segment by segment.
+ */
+class corpus_reader final
+{
+public:
+	corpus_reader() = delete;
+	// @throws std::runtime_error if dir is not a dir.
+	explicit corpus_reader(const fs::path& dir);
+	~corpus_reader();
+
+	// Owns a zstd context.
+	corpus_reader(const corpus_reader&) = delete;
+	corpus_reader& operator=(const corpus_reader&) = delete;
+
+public:
+	/**
+	 * Reads the next page into p.
+	 * @returns false if there is none.
+	 */
+	bool next(stored_page& p);
+
+	/**
+	 * Reads the record at the current position of is into p.
+	 * @returns false if there is none, or it is torn.
+	 */
+	static bool read_record(
+		std::istream& is, stored_page& p, ZSTD_DCtx_s* dctx
+	);
+
+private:
+	// Opens the next segment. @returns false if there is none.
+	bool open_next();
+
+private:
+	std::vector<fs::path> segs;
+	size_t cur_seg = 0;
+	std::ifstream ifs;
+
+	ZSTD_DCtx_s* dctx = nullptr;
+};
+
+/**
+ * Writes pages to a corpus on a thread of its own, so that whoever fetches
+ * them, e.g. the scrapers, does not wait for the disk.
+ *
+ * The pages put are written in batches. The buffer is bounded: if the disk
+ * falls behind so much that it is full, put() blocks until there is room.
+ */
+class corpus_archiver final
+{
+public:
+	static constexpr size_t DEF_MAX_BUFFER = 64u << 20;
+
+public:
+	corpus_archiver() = delete;
+	/**
+	 * @param max_buffer bytes of pages that can wait to be written.
+	 * @throws std::runtime_error if the corpus cannot be written.
+	 */
+	explicit corpus_archiver(
+		const fs::path& dir, const corpus_options& opts = corpus_options{},
+		size_t max_buffer = DEF_MAX_BUFFER
+	);
+	// Writes all the pages put.
+	~corpus_archiver();
+
+	corpus_archiver(const corpus_archiver&) = delete;
+	corpus_archiver& operator=(const corpus_archiver&) = delete;
+
+public:
+	// Thread safe.
+	void put(stored_page&& p);
+	// Blocks until all the pages put so far are written and flushed.
+	void flush();
+
+private:
+	void run();
+
+private:
+	corpus_writer w;
+	const size_t max_buffer;
+
+	std::mutex m;
+	std::condition_variable has_pages;
+	std::condition_variable has_room;
+	std::condition_variable written;
+	std::vector<stored_page> pending;
+	size_t pending_size = 0;
+	std::uint64_t num_put = 0, num_written = 0;
+	bool stopping = false;
+
+	// Declared last, to start after the others are ready.
+	std::thread t;
+};
@@ -8,12 +8,27 @@
  */
 
 #include "index.h"
+#include "metrics.h"
+#include "near_dup.h"
+#include "trace.h"
+#include "url_canon.h"
+#include "text_store.h"
+#include "wal.h"
 #include "url2html.h"
 #include "webpage.h"
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <deque>
 #include <optional>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <xapian.h>
@@ -24,12 +39,35 @@ extern "C" {
 
 #include "utility.h"
 
-std::string index::url2hashid(urls::url_view u)
+// The main text is indexed with this prefix.
+static constexpr std::string_view TEXT_PREFIX = "XD";
+
+// I want only English words as keywords.
+// Allow only lowercase alphabetic terms (min 2 chars)
+static bool is_english_word(std::string_view term)
 {
-	auto essential = url_get_essential(u);
+	return term.size() >= 2 && std::all_of(
+		term.begin(), term.end(),
+		[](char c) { return c >= 'a' && c <= 'z'; }
+	);
+}
 
+// @returns the first len digits of YYYYMMDD of d.
+static std::string date_digits(const ch::year_month_day& d, size_t len)
+{
+	char buf[4+2+2+1];
+	std::snprintf(
+		buf, sizeof(buf), "%4d%02u%02u",
+		(int)d.year(), (unsigned)d.month(), (unsigned)d.day()
+	);
+	return std::string(buf, len);
+}
+
+// @returns "Q" + SHA256(key).
+static std::string hashid_of_key(std::string_view key)
+{
 	uint8_t sha256[32];
-	calc_sha_256(sha256, essential.c_str(), essential.size());
+	calc_sha_256(sha256, key.data(), key.size());
 
 	std::string ret;
 	ret.reserve(1 + 32);
@@ -39,13 +77,124 @@ std::string index::url2hashid(urls::url_view u)
 	return ret;
 }
 
+std::string index::url2hashid(const url_canon& c, urls::url_view u)
+{
+	// Reused, as it is called for every link.
+	thread_local std::string key;
+	c.key(u, key);
+	return hashid_of_key(key);
+}
+
+std::uint32_t index::text_gen_of(const xp::Database& db)
+{
+	const auto gen = db.get_metadata(TEXT_GEN_KEY);
+	return gen.empty() ? 0u : static_cast<std::uint32_t>(std::stoul(gen));
+}
+
+std::string index::legacy_hashid(urls::url_view u)
+{
+	return hashid_of_key(url_get_essential(u));
+}
+
 index::index(
 	const fs::path& dbpath
 ):
-	dbpath(dbpath),
-	db(dbpath.string(), xp::DB_CREATE_OR_OPEN)
+	index(open_params(dbpath))
+{}
+
+index::index(
+	const open_params& par
+):
+	dbpath(par.dbpath),
+	db(par.dbpath.string(), xp::DB_CREATE_OR_OPEN)
 {
-	setup_tg();
+	// The db directory now exists, as Xapian has created it.
+	if (par.store_text || text_store::exists(dbpath))
+	{
+		texts = std::make_unique<text_store>(dbpath, true, text_gen_of(db));
+	}
+
+	// A new db takes the requested profile, while an existing one keeps its
+	// own, as mixing them makes queries miss documents.
+	if (
+		db.get_metadata(PROFILE_KEY).empty() && 
+		db.get_metadata(SCHEMA_KEY).empty() && 
+		db.get_doccount() == 0
+	) {
+		prof = &index_profile::from_name(par.profile.value_or("default"));
+		db.set_metadata(PROFILE_KEY, prof->name);
+		db.set_metadata(SCHEMA_KEY, schema_name(prof->schema));
+	}
+	else
+	{
+		prof = &profile_of(db);
+		if (par.profile && par.profile.value() != prof->name)
+			throw std::runtime_error(
+				"The db is of profile " + prof->name +
+				", not " + par.profile.value() + "."
+			);
+	}
+
+	// Same for the counters: a new db keeps them from the start, while an
+	// old one has to rebuild_stats() first.
+	if (db.get_doccount() == 0 && db.get_metadata(STATS_KEY).empty())
+		db.set_metadata(STATS_KEY, "1");
+	keep_stats = !db.get_metadata(STATS_KEY).empty();
+	if (db.get_doccount() == 0 && db.get_metadata(DATE_TERMS_KEY).empty())
+		db.set_metadata(DATE_TERMS_KEY, "1");
+	date_terms = has_date_terms(db);
+
+	// And for the url keys, whose rules are those of the db from now on.
+	canon_keys = !db.get_metadata(URL_KEYS_KEY).empty();
+	if (db.get_doccount() == 0 && !canon_keys)
+	{
+		canon.parse_rules(par.url_rules.value_or(""));
+		db.set_metadata(URL_KEYS_KEY, "1");
+		db.set_metadata(URL_RULES_KEY, canon.rules_text());
+		canon_keys = true;
+	}
+	else if (!canon_keys)
+	{
+		// Keyed by legacy_hashid() until rekey_urls(), which records them.
+		canon.parse_rules(par.url_rules.value_or(""));
+	}
+	else
+	{
+		const auto rules = db.get_metadata(URL_RULES_KEY);
+		canon.parse_rules(rules);
+		if (par.url_rules)
+		{
+			url_canon requested;
+			requested.parse_rules(*par.url_rules);
+			if (requested.rules_text() != canon.rules_text())
+				throw std::runtime_error(
+					"The db has other url rules. Rekey it to change them."
+				);
+		}
+	}
+
+	commit_every = par.commit_every;
+	commit_interval = par.commit_interval;
+
+	near_dups = par.near_dups;
+	if (near_dups != near_dup_policy::OFF)
+	{
+		recent = std::make_unique<near_dup_index>(par.near_dup_window);
+		seed_recent(par.near_dup_window);
+	}
+
+	filter = std::make_unique<term_filter>(*prof);
+	setup_tg(tg);
+
+	// Pages logged but not committed before a crash are added again.
+	if (par.use_wal || wal::exists(dbpath))
+	{
+		auto seq = db.get_metadata(WAL_SEQ_KEY);
+		log = std::make_unique<wal>(
+			dbpath, seq.empty() ? 0ull : std::stoull(seq)
+		);
+		recover();
+	}
 }
 
 
@@ -58,14 +207,34 @@ index::~index()
 	 * explicitly.
 	 * I ascertained it will be done, as the doc indicates 
 	 * Database::~Database() is virtual.
+	 *
+	 * The text store, however, must be made durable before that commit.
+	 *
+	 * With the WAL, the commit must also record the last seq, or all its
+	 * records will be replayed next time.
 	 */
+	if (log)
+	{
+		try
+		{
+			synchronize();
+		}
+		catch (const std::exception& e)
+		{
+			// The records are still in the log.
+			util_log(std::string("Commit failed at close: ") + e.what());
+		}
+		return;
+	}
+	if (texts)
+		texts->sync();
 }
 
 std::optional<xp::Document> index::get_document(const urls::url& u) const 
 {
 	// Query the document with the unique term.
 	xp::Enquire enquire(db);
-	enquire.set_query(xp::Query(url2hashid(u)));
+	enquire.set_query(xp::Query(hashid_of(u)));
 
 	// Get only one match.
 	Xapian::MSet matches = enquire.get_mset(0, 1);
@@ -106,6 +275,14 @@ std::string index::url_from_doc(const xp::Document& doc)
 	);
 }
 
+std::string index::url_from_doc(const scanned_doc& doc)
+{
+	// data is url \t title.
+	return doc.data.substr(
+		0, doc.data.find('\t')
+	);
+}
+
 std::string index::title_from_doc(const xp::Document& doc)
 {
 	std::string data = doc.get_data();
@@ -115,67 +292,431 @@ std::string index::title_from_doc(const xp::Document& doc)
 	);
 }
 
-void index::add_document(const webpage& w)
+std::string index::keywords_from_doc(const xp::Document& doc)
+{
+	auto ret = doc.get_value(KEYWORDS_SLOT);
+	if (!ret.empty())
+		return ret;
+
+	// Old document without the keywords.
+	return sample_keywords(doc);
+}
+
+std::string index::sample_keywords(const xp::Document& doc)
+{
+	std::string ret;
+
+	// Get all English words and evenly sample a few keywords from them.
+	std::vector<std::string> words;
+	words.reserve(NUM_KEYWORDS);
+	for (
+		auto it = doc.termlist_begin(); 
+		it != doc.termlist_end();
+		++it
+	) {
+		std::string term = *it;
+		if (!term.starts_with(TEXT_PREFIX))
+			continue;
+		term.erase(0, TEXT_PREFIX.size());
+		if (!is_english_word(term))
+			continue;
+		
+		words.emplace_back(std::move(term));
+	}
+
+	float step = words.size() > NUM_KEYWORDS ? 
+		float(words.size()) / float(NUM_KEYWORDS) :
+		1.f;
+	for (float i = 0.f; (size_t)i < words.size(); i+=step)
+	{
+		if (!ret.empty())
+			ret.push_back(' ');
+		ret.append(words[(size_t)i]);
+	}
+
+	return ret;
+}
+
+std::string index::calc_keywords(const xp::Document& doc) const
+{
+	// (wdf, word)
+	std::vector<std::pair<double, std::string>> cands;
+	cands.reserve(1024);
+	for (
+		auto it = doc.termlist_begin(); 
+		it != doc.termlist_end();
+		++it
+	) {
+		std::string term = *it;
+		if (!term.starts_with(TEXT_PREFIX))
+			continue;
+		if (!is_english_word(std::string_view(term).substr(TEXT_PREFIX.size())))
+			continue;
+
+		cands.emplace_back(it.get_wdf(), std::move(term));
+	}
+
+	// Looking up df of every term is costly for long articles.
+	// A word that occurs rarely in the doc will hardly make it,
+	// so only the most frequent ones are looked up.
+	auto by_score_desc = [](const auto& a, const auto& b) { 
+		return a.first > b.first; 
+	};
+	if (cands.size() > 4 * NUM_KEYWORDS)
+	{
+		std::nth_element(
+			cands.begin(), cands.begin() + 4 * NUM_KEYWORDS, cands.end(),
+			by_score_desc
+		);
+		cands.resize(4 * NUM_KEYWORDS);
+	}
+
+	const double num_docs = db.get_doccount();
+	for (auto& [score, term] : cands)
+	{
+		score *= std::log(
+			(num_docs + 2.) / (double(db.get_termfreq(term)) + 1.)
+		);
+	}
+
+	auto num_kw = std::min<size_t>(cands.size(), NUM_KEYWORDS);
+	std::partial_sort(
+		cands.begin(), cands.begin() + num_kw, cands.end(),
+		by_score_desc
+	);
+
+	std::string ret;
+	ret.reserve(num_kw * 8);
+	for (size_t i = 0; i < num_kw; ++i)
+	{
+		if (i != 0)
+			ret.push_back(' ');
+		ret.append(cands[i].second, TEXT_PREFIX.size());
+	}
+
+	return ret;
+}
+
+index::schema index::schema_of(const xp::Database& db)
+{
+	auto name = db.get_metadata(SCHEMA_KEY);
+	if (name.empty())
+		return schema::DOUBLE;
+
+	return schema_from_name(name);
+}
+
+const index_profile& index::profile_of(const xp::Database& db)
+{
+	auto name = db.get_metadata(PROFILE_KEY);
+	if (name.empty())
+		return index_profile::of_schema(schema_of(db));
+
+	return index_profile::from_name(name);
+}
+
+std::string index::schema_name(schema s)
+{
+	switch (s)
+	{
+	case schema::DOUBLE:
+		return "double";
+	case schema::SINGLE:
+		return "single";
+	}
+
+	throw std::runtime_error("Unknown schema.");
+}
+
+index::schema index::schema_from_name(std::string_view n)
+{
+	if (n == "double")
+		return schema::DOUBLE;
+	if (n == "single")
+		return schema::SINGLE;
+
+	throw std::runtime_error("Unknown schema: " + std::string(n));
+}
+
+index::near_dup_policy index::near_dup_policy_from_name(std::string_view n)
+{
+	if (n == "off")
+		return near_dup_policy::OFF;
+	if (n == "link")
+		return near_dup_policy::LINK;
+	if (n == "skip")
+		return near_dup_policy::SKIP;
+
+	throw std::runtime_error("Unknown near-duplicate policy: " + std::string(n));
+}
+
+bool index::is_free_text_term(std::string_view term)
+{
+	auto is_upper = [](char c) { return c >= 'A' && c <= 'Z'; };
+
+	if (term.empty())
+		return false;
+	if (term.front() == 'Z')
+		return term.size() > 1 && !is_upper(term[1]);
+
+	return !is_upper(term.front());
+}
+
+std::optional<std::string> index::text_from_doc(
+	const xp::Document& doc
+) const {
+	if (!texts)
+		return std::nullopt;
+
+	auto loc = doc.get_value(TEXT_SLOT);
+	if (loc.empty())
+		return std::nullopt;
+
+	return texts->get(loc);
+}
+
+bool index::add_document(const webpage& w)
 { 
+	const auto title = w.get_title();
+	const auto text = w.get_text();
+	return add_document(w.url, title, w.get_date(), text);
+}
+
+bool index::add_document(
+	const urls::url& u, std::string_view title, 
+	const ch::year_month_day& date, std::string_view text
+) {
 	// do not index an empty document.
-	if (w.get_title().empty() && w.get_text().empty())
-		return;
+	if (title.empty() && text.empty())
+		return false;
 
-	xp::Document doc;
-	tg.set_document(doc);
+	// Log it before anything is done, so that it can be redone.
+	if (log)
+		log->append(wal::record{
+			u.buffer(), std::string(title), date_digits(date, 8),
+			std::string(text)
+		});
+
+	bool stored;
+	{
+		static auto& index_h = stage_histogram("index");
+		metric_timer t(index_h);
+		trace_span span("index");
+		stored = index_document(u, title, date, text);
+	}
+
+	if (stored)
+		++num_uncommitted;
+	maybe_commit();
+	return stored;
+}
+
+bool index::index_document(
+	const urls::url& u, std::string_view title, 
+	const ch::year_month_day& date, std::string_view full_text
+) {
+	return store_document(
+		make_document(tg, u, title, date, full_text), false
+	);
+}
+
+bool index::add_document(prepared_doc&& d, bool is_new)
+{
+	bool stored;
+	{
+		static auto& index_h = stage_histogram("index");
+		metric_timer t(index_h);
+		trace_span span("index");
+		stored = store_document(std::move(d), is_new);
+	}
+
+	if (stored)
+		++num_uncommitted;
+	maybe_commit();
+	return stored;
+}
+
+xp::TermGenerator index::make_term_generator() const
+{
+	xp::TermGenerator g;
+	setup_tg(g);
+	return g;
+}
+
+index::prepared_doc index::make_document(
+	xp::TermGenerator& g,
+	const urls::url& u, std::string_view title, 
+	const ch::year_month_day& date, std::string_view full_text
+) const {
+	prepared_doc d;
+	g.set_document(d.doc);
 
 	// The magical strings "S" and "XD" are from the official
 	// example https://getting-started-with-xapian.readthedocs.io/en
 	// /latest/practical_example/indexing/writing_the_code.html,
 	// which claims that they are the conventional prefixes of the 
 	// omega search engine.
-	tg.index_text(w.get_title(), 1, "S");
-	tg.index_text(w.get_text(), 1, "XD");
+	auto index_field = [&g](
+		std::string_view text, bool positions, const std::string& prefix
+	) {
+		xp::Utf8Iterator it(text.data(), text.size());
+		if (positions)
+			g.index_text(it, 1, prefix);
+		else
+			g.index_text_without_positions(it, 1, prefix);
+	};
 
-	// Index them without prefixes for free search 
-	tg.index_text(w.get_title());
-	tg.increase_termpos();
-	tg.index_text(w.get_text());
+	// Only the first part of a very long text is indexed, if the profile
+	// says so. The text store still keeps all of it.
+	const auto text = prof->cut_text(full_text);
+	index_field(title, prof->title_positions, "S");
+	index_field(text, prof->text_positions, std::string(TEXT_PREFIX));
+
+	// Index them without prefixes for free search.
+	// The SINGLE schema does that at query time instead.
+	if (prof->schema == schema::DOUBLE)
+	{
+		index_field(title, prof->title_positions, "");
+		g.increase_termpos();
+		index_field(text, prof->text_positions, "");
+	}
 
 	// Add the date as a value.
 	// Xapian supports date string parsing during searching,
 	// I use the same format as the example:
 	// YYYYMMDD
-	std::string date_str(4+2+2, '\0'); 
-	std::snprintf(
-		date_str.data(),
-		date_str.size()+1,
-		"%4d%02d%02d", 
-		(int)w.get_date().year(), 
-		(unsigned)w.get_date().month(), 
-		(unsigned)w.get_date().day()
-	);
-	doc.add_value(DATE_SLOT, date_str);
+	d.date = date_digits(date, 8);
+	d.doc.add_value(DATE_SLOT, d.date);
+	d.doc.add_value(DAYS_SLOT, days_value(date));
+	add_date_terms(d.doc, date);
 
 	// Store the full URL + title for display purposes
 	// I don't want to store the full text, as that makes the database too
 	// large.
-	doc.set_data(
-		std::string(w.url.c_str()) + "\t" + w.get_title()
-	);
+	d.url = u.c_str();
+	d.doc.set_data(d.url + "\t" + std::string(title));
 
 	// This will be the unique identifier of the doc;
-	auto hashid = url2hashid(w.url);
-	doc.add_boolean_term(hashid);
+	d.hashid = hashid_of(u);
+	d.doc.add_boolean_term(d.hashid);
+
+	if (texts)
+		d.text = full_text;
+
+	// Near-duplicates are looked up when it is stored, in the order the
+	// documents are added.
+	if (near_dups != near_dup_policy::OFF)
+	{
+		d.simhash = simhash(full_text);
+		if (d.simhash)
+		{
+			char hex[17];
+			std::snprintf(
+				hex, sizeof(hex), "%016llx",
+				static_cast<unsigned long long>(*d.simhash)
+			);
+			d.doc.add_value(SIMHASH_SLOT, hex);
+		}
+	}
+
+	return d;
+}
+
+bool index::store_document(prepared_doc&& d, bool is_new)
+{
+	if (recent && d.simhash)
+	{
+		auto cluster = recent->find(*d.simhash, d.hashid);
+		if (cluster)
+		{
+			static auto& near_dups_c = metrics_registry::global().counter(
+				"search_near_dups_total",
+				"Documents found to be near-duplicates of recent ones."
+			);
+			near_dups_c.inc();
+			if (near_dups == near_dup_policy::SKIP)
+				return false;
+		}
+		else
+			cluster = d.hashid;
+
+		d.doc.add_value(CLUSTER_SLOT, *cluster);
+		recent->insert(*d.simhash, d.hashid, std::move(*cluster));
+	}
+	else if (near_dups != near_dup_policy::OFF)
+		d.doc.add_value(CLUSTER_SLOT, d.hashid);
+
+	// Precompute the keywords so that displaying a result needs only to
+	// read them, instead of going through the whole termlist.
+	// They need the db for the dfs, so they are not prepared.
+	auto keywords = calc_keywords(d.doc);
+	if (!keywords.empty())
+		d.doc.add_value(KEYWORDS_SLOT, keywords);
+
+	// The text is kept out of the database, if it is kept at all.
+	if (texts)
+		d.doc.add_value(TEXT_SLOT, texts->put(d.text));
+
+	if (keep_stats)
+	{
+		// The doc may be replacing an old version.
+		if (!is_new)
+		{
+			auto old = db.postlist_begin(d.hashid);
+			if (old != db.postlist_end(d.hashid))
+				count_doc(stat_keys(db.get_document(*old)), -1);
+		}
+		count_doc(stat_keys(d.url, d.date), 1);
+	}
 
 	// We can now store the doc in the database.
 	// Use replace_document instead of add_document to make sure 
-	// one document is only indexed once.
-	db.replace_document(hashid, doc);
+	// one document is only indexed once, unless the caller knows it is.
+	if (is_new)
+		db.add_document(d.doc);
+	else
+		db.replace_document(d.hashid, d.doc);
+	return true;
+}
+
+void index::commit_logged()
+{
+	if (log && db.get_metadata(WAL_SEQ_KEY) != std::to_string(log->last_seq()))
+		synchronize();
 }
 
 void index::rm_document(const urls::url& u)
 {
-	db.delete_document((url2hashid(u)));
+	commit_logged();
+	auto hashid = hashid_of(u);
+	if (keep_stats)
+	{
+		auto it = db.postlist_begin(hashid);
+		if (it != db.postlist_end(hashid))
+			count_doc(stat_keys(db.get_document(*it)), -1);
+	}
+
+	db.delete_document(hashid);
 }
 	
+void index::rm_document(xp::docid id)
+{
+	commit_logged();
+	if (keep_stats)
+	{
+		auto doc = get_document(id);
+		if (!doc)
+			return;
+		count_doc(stat_keys(doc.value()), -1);
+	}
+
+	db.delete_document(id);
+}
+
 void index::rm_if(doc_rm_func_t* func)
 {
+	commit_logged();
+
 	// Do not delete while iterating. The documentation didn't
 	// say anything about this, but I will not do it to be safe.
 	std::vector<xp::docid> to_delete;
@@ -193,6 +734,8 @@ void index::rm_if(doc_rm_func_t* func)
 		if(func(doc))
 		{
 			to_delete.push_back(*i);
+			if (keep_stats)
+				count_doc(stat_keys(doc), -1);
 		}
 	}
 
@@ -200,6 +743,113 @@ void index::rm_if(doc_rm_func_t* func)
 		db.delete_document(id);
 }
 
+unsigned index::scan_threads(unsigned requested)
+{
+	if (requested != 0)
+		return requested;
+
+	// May be 0 if unknown.
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Visits all documents in [first, last] of db with func.
+static void scan_range(
+	xp::Database db, const index::scan_projection& proj,
+	xp::docid first, xp::docid last,
+	const std::function<void(const index::scanned_doc&)>& func
+) {
+	index::scanned_doc d;
+	d.values.resize(proj.slots.size());
+
+	xp::docid next = first;
+	while (true)
+	{
+		try
+		{
+			auto it = db.postlist_begin("");
+			const auto end = db.postlist_end("");
+			it.skip_to(next);
+
+			// Values are read from their streams, which are stored 
+			// together, instead of from each document.
+			std::vector<xp::ValueIterator> vits, vends;
+			for (auto slot : proj.slots)
+			{
+				vits.push_back(db.valuestream_begin(slot));
+				vends.push_back(db.valuestream_end(slot));
+			}
+
+			for (; it != end && *it <= last; ++it)
+			{
+				d.id = *it;
+				if (proj.data)
+					d.data = db.get_document(
+						d.id, xp::DOC_ASSUME_VALID
+					).get_data();
+				for (size_t i = 0; i < vits.size(); ++i)
+				{
+					d.values[i].clear();
+					if (vits[i] == vends[i])
+						continue;
+					vits[i].skip_to(d.id);
+					if (vits[i] != vends[i] && vits[i].get_docid() == d.id)
+						d.values[i] = *vits[i];
+				}
+
+				func(d);
+				next = d.id + 1;
+			}
+			return;
+		}
+		catch (const xp::DatabaseModifiedError&)
+		{
+			// The writer has committed too many times since the handle
+			// was opened. Go on from where it stopped with the latest.
+			db.reopen();
+		}
+	}
+}
+
+void index::scan_impl(
+	const fs::path& dbpath, const scan_projection& proj,
+	const std::vector<std::function<void(const scanned_doc&)>>& funcs
+) {
+	const xp::docid last = xp::Database(dbpath.string()).get_lastdocid();
+	const xp::docid n = static_cast<xp::docid>(funcs.size());
+	// Deleted docids leave holes, but they are rare enough that an even
+	// split of the space is also roughly even in documents.
+	const xp::docid per_thread = last / n + 1;
+
+	std::vector<std::exception_ptr> errors(funcs.size());
+	std::vector<std::thread> threads;
+	threads.reserve(funcs.size());
+	for (xp::docid i = 0; i < n; ++i)
+	{
+		threads.emplace_back([&, i] {
+			try
+			{
+				// Each thread must have its own handle, as Xapian's
+				// objects are not thread safe.
+				scan_range(
+					xp::Database(dbpath.string()), proj,
+					i * per_thread + 1, (i + 1) * per_thread,
+					funcs[i]
+				);
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+
+	for (auto& t : threads)
+		t.join();
+	for (const auto& e : errors)
+		if (e)
+			std::rethrow_exception(e);
+}
+
 void index::shrink(
 	unsigned max_num, shrink_policy policy
 ) {
@@ -215,10 +865,147 @@ void index::shrink(
 	if (cur_size <= max_num)
 		return;
 
-	auto num_to_rm = cur_size - max_num;
+	rm_for_shrink(cur_size - max_num, policy);
+	prune_variants();
+	if (texts)
+		compact_texts();
+}
+
+void index::prune_variants()
+{
+	std::vector<std::string> gone;
+	const std::string prefix(CANONICAL_PREFIX);
+	for (
+		auto k = db.metadata_keys_begin(prefix);
+		k != db.metadata_keys_end(prefix); ++k
+	) {
+		// The variant may be fetched again, now that it is not indexed.
+		auto c = urls::parse_uri(db.get_metadata(*k));
+		if (!c.has_value() || !get_document(urls::url(*c)))
+			gone.push_back(*k);
+	}
+	for (const auto& k : gone)
+		db.set_metadata(k, "");
+
+	if (!gone.empty())
+		util_log(
+			"Forgot " + std::to_string(gone.size()) +
+			" variants of removed documents."
+		);
+}
+
+bool index::compact_texts(double garbage_ratio)
+{
+	if (!texts)
+		return false;
+	synchronize();
+
+	std::vector<xp::docid> ids;
+	std::vector<std::string> locs;
+	for (
+		auto i = db.valuestream_begin(TEXT_SLOT);
+		i != db.valuestream_end(TEXT_SLOT); ++i
+	) {
+		ids.push_back(i.get_docid());
+		locs.push_back(*i);
+	}
+	if (texts->garbage_ratio(locs) < garbage_ratio)
+		return false;
+
+	util_log("Compacting the text store.\n");
+	locs = texts->compact(locs);
+	// The new file is only used once the db points to it. Were the commit
+	// lost, the next open removes the file.
+	db.begin_transaction();
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		auto doc = db.get_document(ids[i]);
+		doc.add_value(TEXT_SLOT, locs[i]);
+		db.replace_document(ids[i], doc);
+	}
+	db.set_metadata(
+		TEXT_GEN_KEY, std::to_string(texts->generation() + 1)
+	);
+	db.commit_transaction();
+	texts->commit_compaction();
+	return true;
+}
+
+void index::rm_for_shrink(xp::doccount num_to_rm, shrink_policy policy)
+{
+	commit_logged();
+
+	// With both the day counters and the day terms, the documents are
+	// removed day by day from the oldest (latest), by the postlists of the
+	// days, without going through or sorting any others.
+	if (keep_stats && date_terms)
+	{
+		const auto days = stats_of(db).value().days;
+		xp::doccount num_rmed = 0;
+		std::vector<xp::docid> ids;
+		auto rm_days = [&](auto beg, auto end) {
+			for (auto i = beg; i != end && num_rmed < num_to_rm; ++i)
+			{
+				const auto term = std::string(DAY_PREFIX) + i->first;
+				ids.clear();
+				for (
+					auto p = db.postlist_begin(term);
+					p != db.postlist_end(term) && 
+						num_rmed + ids.size() < num_to_rm;
+					++p
+				)
+					ids.push_back(*p);
+
+				// Do not delete while iterating.
+				for (auto id : ids)
+					rm_document(id);
+				num_rmed += static_cast<xp::doccount>(ids.size());
+			}
+		};
+
+		if (policy == shrink_policy::OLDEST)
+			rm_days(days.begin(), days.end());
+		else
+			rm_days(days.rbegin(), days.rend());
+
+		// Otherwise the counters must be off. Remove the rest below.
+		if (num_rmed >= num_to_rm)
+			return;
+		num_to_rm -= num_rmed;
+	}
+
+	// With the day counters, the cutoff day is found without going through
+	// the documents, and only those up to it are sorted.
+	xp::Query q = xp::Query::MatchAll;
+	if (keep_stats)
+	{
+		const auto days = stats_of(db).value().days;
+		xp::doccount num_found = 0;
+		std::string cutoff;
+		auto find_cutoff = [&](auto beg, auto end) {
+			for (auto i = beg; i != end && num_found < num_to_rm; ++i)
+			{
+				num_found += i->second;
+				cutoff = i->first;
+			}
+		};
+
+		if (policy == shrink_policy::OLDEST)
+			find_cutoff(days.begin(), days.end());
+		else
+			find_cutoff(days.rbegin(), days.rend());
+
+		// Otherwise the counters must be off. Fall back to all.
+		if (num_found >= num_to_rm)
+			q = xp::Query(
+				policy == shrink_policy::OLDEST ? 
+					xp::Query::OP_VALUE_LE : xp::Query::OP_VALUE_GE,
+				DATE_SLOT, cutoff
+			);
+	}
 
     xp::Enquire enquire(db);
-	enquire.set_query(xp::Query::MatchAll);
+	enquire.set_query(q);
     enquire.set_sort_by_value(DATE_SLOT,
 		// false: ascending; true: descending
 		policy != shrink_policy::OLDEST
@@ -227,6 +1014,8 @@ void index::shrink(
 
 	for (auto i = res.begin(); i != res.end(); ++i)
 	{
+		if (keep_stats)
+			count_doc(stat_keys(i.get_document()), -1);
 		db.delete_document(*i);
 	}
 }
@@ -237,9 +1026,19 @@ void index::upd_document(
 	auto doc = get_document(u);
 	if (doc)
 	{
+		std::pair<std::string, std::string> old_keys;
+		if (keep_stats)
+			old_keys = stat_keys(doc.value());
 		// replace only if updated.
 		if(upd_func(doc.value()))
+		{
 			db.replace_document(doc->get_docid(), doc.value());
+			if (keep_stats)
+			{
+				count_doc(old_keys, -1);
+				count_doc(stat_keys(doc.value()), 1);
+			}
+		}
 	}
 }
 
@@ -252,20 +1051,538 @@ void index::upd_all(doc_upd_func_t* upd_func)
 	for (auto i = beg; i != end; ++i)
 	{
 		auto doc = db.get_document(*i);
+		std::pair<std::string, std::string> old_keys;
+		if (keep_stats)
+			old_keys = stat_keys(doc);
 		// replace only if updated.
 		if(upd_func(doc))
+		{
+			db.replace_document(*i, doc);
+			if (keep_stats)
+			{
+				auto new_keys = stat_keys(doc);
+				if (new_keys != old_keys)
+				{
+					count_doc(old_keys, -1);
+					count_doc(new_keys, 1);
+				}
+			}
+		}
+	}
+}
+
+std::optional<index::db_stats> index::stats_of(const xp::Database& db)
+{
+	if (db.get_metadata(STATS_KEY).empty())
+		return std::nullopt;
+
+	db_stats ret;
+	auto read = [&db](
+		std::string_view prefix, std::map<std::string, unsigned>& out
+	) {
+		const std::string p(prefix);
+		for (
+			auto k = db.metadata_keys_begin(p);
+			k != db.metadata_keys_end(p);
+			++k
+		) {
+			std::string key = *k;
+			out.emplace(
+				key.substr(p.size()),
+				static_cast<unsigned>(std::stoul(db.get_metadata(key)))
+			);
+		}
+	};
+	read(HOST_STAT_PREFIX, ret.hosts);
+	read(DAY_STAT_PREFIX, ret.days);
+
+	return ret;
+}
+
+std::pair<std::string, std::string> index::stat_keys(
+	std::string_view url, std::string_view day
+) {
+	std::pair<std::string, std::string> ret;
+
+	auto u = urls::parse_uri(url);
+	if (u.has_value() && !u->encoded_host().empty())
+		ret.first = std::string(HOST_STAT_PREFIX).append(
+			std::string_view(u->encoded_host())
+		);
+	if (!day.empty())
+		ret.second = std::string(DAY_STAT_PREFIX).append(day);
+
+	return ret;
+}
+
+std::pair<std::string, std::string> index::stat_keys(
+	const xp::Document& doc
+) {
+	return stat_keys(url_from_doc(doc), doc.get_value(DATE_SLOT));
+}
+
+void index::count_doc(
+	const std::pair<std::string, std::string>& keys, int delta
+) {
+	if (!keep_stats)
+		return;
+
+	if (!keys.first.empty())
+		add_to_stat(keys.first, delta);
+	if (!keys.second.empty())
+		add_to_stat(keys.second, delta);
+}
+
+void index::add_to_stat(const std::string& key, int delta)
+{
+	// Xapian keeps the uncommitted metadata in memory, and commits it
+	// together with the documents.
+	auto cur = db.get_metadata(key);
+	long long n = (cur.empty() ? 0ll : std::stoll(cur)) + delta;
+
+	// Removing a counter once it reaches 0 bounds the number of keys by
+	// the hosts and days present.
+	db.set_metadata(key, n > 0 ? std::to_string(n) : std::string());
+}
+
+void index::rebuild_stats()
+{
+	// scan() only sees what has been committed.
+	synchronize();
+
+	struct stat_counter
+	{
+		std::unordered_map<std::string, unsigned> counts;
+
+		void operator()(const scanned_doc& doc)
+		{
+			auto [host_key, day_key] = 
+				stat_keys(url_from_doc(doc), doc.values.front());
+			if (!host_key.empty())
+				++counts[host_key];
+			if (!day_key.empty())
+				++counts[day_key];
+		}
+
+		void merge(stat_counter&& other)
+		{
+			for (const auto& [k, c] : other.counts)
+				counts[k] += c;
+		}
+	};
+
+	scan_projection proj;
+	proj.data = true;
+	proj.slots.push_back(DATE_SLOT);
+	auto res = scan(dbpath, proj, stat_counter{});
+
+	// Remove the old ones, which may have counters no longer present.
+	std::vector<std::string> old_keys;
+	for (auto prefix : {HOST_STAT_PREFIX, DAY_STAT_PREFIX})
+	{
+		const std::string p(prefix);
+		for (
+			auto k = db.metadata_keys_begin(p);
+			k != db.metadata_keys_end(p);
+			++k
+		)
+			old_keys.push_back(*k);
+	}
+	for (const auto& k : old_keys)
+		db.set_metadata(k, "");
+
+	for (const auto& [k, c] : res.counts)
+		db.set_metadata(k, std::to_string(c));
+	db.set_metadata(STATS_KEY, "1");
+	keep_stats = true;
+
+	synchronize();
+}
+
+bool index::has_date_terms(const xp::Database& db)
+{
+	return !db.get_metadata(DATE_TERMS_KEY).empty();
+}
+
+void index::add_date_terms(xp::Document& doc, const ch::year_month_day& d)
+{
+	doc.add_boolean_term(std::string(YEAR_PREFIX) + date_digits(d, 4));
+	doc.add_boolean_term(std::string(MONTH_PREFIX) + date_digits(d, 6));
+	doc.add_boolean_term(std::string(DAY_PREFIX) + date_digits(d, 8));
+}
+
+std::string index::days_value(const ch::year_month_day& d)
+{
+	return xp::sortable_serialise(
+		double(ch::sys_days(d).time_since_epoch().count())
+	);
+}
+
+std::optional<ch::year_month_day> index::date_from_value(std::string_view v)
+{
+	if (v.size() != 8)
+		return std::nullopt;
+
+	int y = 0;
+	unsigned m = 0, d = 0;
+	auto parse = [](std::string_view sv, auto& out) {
+		auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), out);
+		return ec == std::errc() && ptr == sv.data() + sv.size();
+	};
+	// The year may be padded with spaces.
+	auto year = v.substr(0, 4);
+	while (!year.empty() && year.front() == ' ')
+		year.remove_prefix(1);
+	if (!parse(year, y) || !parse(v.substr(4, 2), m) || !parse(v.substr(6, 2), d))
+		return std::nullopt;
+
+	ch::year_month_day ret{ch::year{y}, ch::month{m}, ch::day{d}};
+	if (!ret.ok())
+		return std::nullopt;
+	return ret;
+}
+
+xp::Query index::date_range_query(
+	const ch::year_month_day& b, const ch::year_month_day& e
+) {
+	if (e < b)
+		return xp::Query::MatchNothing;
+
+	// Documents of month m in [from, to]. Only the month's docs are
+	// checked for the value.
+	auto month_part = [](
+		const ch::year_month& m, 
+		const ch::year_month_day& from, const ch::year_month_day& to
+	) {
+		return xp::Query(
+			xp::Query::OP_FILTER,
+			xp::Query(
+				std::string(MONTH_PREFIX) + 
+				date_digits(ch::year_month_day{m / ch::day{1}}, 6)
+			),
+			xp::Query(
+				xp::Query::OP_VALUE_RANGE, DATE_SLOT,
+				date_digits(from, 8), date_digits(to, 8)
+			)
+		);
+	};
+	auto month_end = [](const ch::year_month& m) {
+		return ch::year_month_day{m / ch::last};
+	};
+
+	const ch::year_month bm{b.year(), b.month()}, em{e.year(), e.month()};
+	if (bm == em)
+	{
+		// Within a single month.
+		if (b.day() == ch::day{1} && e == month_end(em))
+			return xp::Query(
+				std::string(MONTH_PREFIX) + date_digits(b, 6)
+			);
+		return month_part(bm, b, e);
+	}
+
+	std::vector<xp::Query> parts;
+
+	// The edges, if partly within.
+	auto first_full = bm, last_full = em;
+	if (b.day() != ch::day{1})
+	{
+		parts.push_back(month_part(bm, b, month_end(bm)));
+		first_full += ch::months{1};
+	}
+	if (e != month_end(em))
+	{
+		parts.push_back(month_part(em, ch::year_month_day{em / ch::day{1}}, e));
+		last_full -= ch::months{1};
+	}
+
+	// Whole years and months in between.
+	for (auto m = first_full; m <= last_full; )
+	{
+		if (
+			m.month() == ch::January && 
+			ch::year_month{m.year(), ch::December} <= last_full
+		) {
+			parts.emplace_back(
+				std::string(YEAR_PREFIX) + 
+				date_digits(ch::year_month_day{m / ch::day{1}}, 4)
+			);
+			m += ch::years{1};
+		}
+		else
+		{
+			parts.emplace_back(
+				std::string(MONTH_PREFIX) + 
+				date_digits(ch::year_month_day{m / ch::day{1}}, 6)
+			);
+			m += ch::months{1};
+		}
+	}
+
+	// It's a filter. The terms must not add to the weights.
+	return xp::Query(
+		xp::Query::OP_SCALE_WEIGHT,
+		xp::Query(xp::Query::OP_OR, parts.begin(), parts.end()),
+		0.
+	);
+}
+
+void index::add_missing_date_fields()
+{
+	unsigned num_added = 0;
+	for (auto i = db.postlist_begin(""); i != db.postlist_end(""); ++i)
+	{
+		auto doc = db.get_document(*i);
+		auto d = date_from_value(doc.get_value(DATE_SLOT));
+		if (!d)
+			continue;
+
+		bool updated = false;
+
+		const auto day_term = std::string(DAY_PREFIX) + date_digits(*d, 8);
+		auto t = doc.termlist_begin();
+		t.skip_to(day_term);
+		if (t == doc.termlist_end() || *t != day_term)
+		{
+			add_date_terms(doc, *d);
+			updated = true;
+		}
+		if (doc.get_value(DAYS_SLOT).empty())
+		{
+			doc.add_value(DAYS_SLOT, days_value(*d));
+			updated = true;
+		}
+
+		if (updated)
+		{
 			db.replace_document(*i, doc);
+			++num_added;
+		}
 	}
+
+	util_log(
+		"Added date fields to " + std::to_string(num_added) + 
+		" documents.\n"
+	);
+
+	db.set_metadata(DATE_TERMS_KEY, "1");
+	date_terms = true;
+	synchronize();
+}
+
+index::rekey_stats index::rekey_urls(std::optional<std::string_view> rules)
+{
+	// Only used once committed.
+	url_canon next = canon;
+	if (rules)
+		next.parse_rules(*rules);
+
+	// Do not modify while iterating.
+	std::vector<xp::docid> ids;
+	ids.reserve(db.get_doccount());
+	for (auto i = db.postlist_begin(""); i != db.postlist_end(""); ++i)
+		ids.push_back(*i);
+
+	// The pending changes are committed first, by themselves. Were the
+	// transaction lost, the db keeps its keys and rules.
+	synchronize();
+	db.begin_transaction();
+	rekey_stats ret;
+	for (const auto id : ids)
+	{
+		auto doc = db.get_document(id);
+		auto u = urls::parse_uri(url_from_doc(doc));
+		if (!u.has_value())
+			continue;
+		const auto key = url2hashid(next, *u);
+
+		// The id term is the only one prefixed with Q.
+		std::string old;
+		auto t = doc.termlist_begin();
+		t.skip_to("Q");
+		if (t != doc.termlist_end() && (*t).starts_with('Q'))
+			old = *t;
+		if (old == key)
+			continue;
+
+		// e.g. another variant of the url, which is the same page.
+		if (db.postlist_begin(key) != db.postlist_end(key))
+		{
+			rm_document(id);
+			++ret.num_merged;
+			continue;
+		}
+
+		if (!old.empty())
+			doc.remove_term(old);
+		doc.add_boolean_term(key);
+		db.replace_document(id, doc);
+		++ret.num_rekeyed;
+	}
+
+	std::vector<std::string> variants;
+	const std::string prefix(CANONICAL_PREFIX);
+	for (
+		auto k = db.metadata_keys_begin(prefix);
+		k != db.metadata_keys_end(prefix); ++k
+	)
+		variants.push_back(*k);
+	for (const auto& k : variants)
+		db.set_metadata(k, "");
+
+	db.set_metadata(URL_KEYS_KEY, "1");
+	db.set_metadata(URL_RULES_KEY, next.rules_text());
+	db.commit_transaction();
+	canon = std::move(next);
+	canon_keys = true;
+
+	util_log(
+		"Rekeyed " + std::to_string(ret.num_rekeyed) + " documents, merged " +
+		std::to_string(ret.num_merged) + "."
+	);
+	return ret;
 }
 
 void index::synchronize()
 {
+	static auto& commit_h = stage_histogram("commit");
+	metric_timer t(commit_h);
+	// Not of one page, and so traced whenever tracing is on.
+	trace_span span("commit", true);
+
+	// The committed docs must not point to texts that are lost.
+	if (texts)
+		texts->sync();
+	if (log)
+		db.set_metadata(WAL_SEQ_KEY, std::to_string(log->last_seq()));
 	db.commit();
+
+	// A crash before this only makes the records be skipped on replay.
+	if (log)
+		log->reset();
+	num_uncommitted = 0;
+	last_commit = ch::steady_clock::now();
+}
+
+void index::checkpoint(const std::map<std::string, std::string>& meta)
+{
+	for (const auto& [k, v] : meta)
+		db.set_metadata(k, v);
+	synchronize();
+}
+
+void index::add_variant(urls::url_view variant, urls::url_view canonical)
+{
+	db.set_metadata(
+		std::string(CANONICAL_PREFIX) + hashid_of(variant),
+		std::string(canonical.buffer())
+	);
+}
+
+std::optional<urls::url> index::canonical_of(urls::url_view u) const
+{
+	auto c = db.get_metadata(std::string(CANONICAL_PREFIX) + hashid_of(u));
+	if (c.empty())
+		return std::nullopt;
+
+	auto parsed = urls::parse_uri(c);
+	if (!parsed.has_value())
+		return std::nullopt;
+	return urls::url(*parsed);
 }
 
-void index::setup_tg()
+void index::maybe_commit()
 {
-	tg.set_stemmer(xp::Stem("en"));
+	if (
+		(commit_every != 0 && num_uncommitted >= commit_every) ||
+		(
+			commit_interval != ch::seconds{0} &&
+			ch::steady_clock::now() - last_commit >= commit_interval
+		)
+	)
+		synchronize();
+}
+
+void index::seed_recent(size_t window)
+{
+	if (window == 0)
+		return;
+
+	// Only the fingerprints are read through, keeping the last window.
+	std::deque<std::pair<xp::docid, std::uint64_t>> last;
+	for (
+		auto it = db.valuestream_begin(SIMHASH_SLOT);
+		it != db.valuestream_end(SIMHASH_SLOT); ++it
+	) {
+		const auto v = *it;
+		std::uint64_t fp;
+		auto [end, ec] = std::from_chars(v.data(), v.data() + v.size(), fp, 16);
+		if (ec != std::errc())
+			continue;
+		if (last.size() == window)
+			last.pop_front();
+		last.emplace_back(it.get_docid(), fp);
+	}
+
+	// In the order of the docids, as are the clusters.
+	auto cit = db.valuestream_begin(CLUSTER_SLOT);
+	const auto cend = db.valuestream_end(CLUSTER_SLOT);
+	for (const auto& [id, fp] : last)
+	{
+		cit.skip_to(id);
+		if (cit == cend)
+			break;
+		if (cit.get_docid() != id)
+			continue;
+
+		auto t = db.termlist_begin(id);
+		t.skip_to("Q");
+		if (t == db.termlist_end(id) || !(*t).starts_with('Q'))
+			continue;
+		recent->insert(fp, *t, *cit);
+	}
+}
+
+void index::recover()
+{
+	const auto seq = db.get_metadata(WAL_SEQ_KEY);
+	unsigned num_replayed = 0;
+	log->replay(seq.empty() ? 0ull : std::stoull(seq), 
+		[this, &num_replayed](const wal::record& r) {
+			auto u = urls::parse_uri(r.url);
+			auto date = date_from_value(r.date);
+			if (!u.has_value() || !date)
+				return;
+
+			index_document(urls::url(*u), r.title, *date, r.text);
+			++num_replayed;
+		}
+	);
+
+	if (num_replayed != 0)
+	{
+		util_log(
+			"Replayed " + std::to_string(num_replayed) + 
+			" pages from the WAL.\n"
+		);
+		synchronize();
+	}
+}
+
+void index::setup_tg(xp::TermGenerator& g) const
+{
+	g.set_stemmer(xp::Stem("en"));
+	g.set_stemming_strategy(prof->stemming);
+	g.set_max_word_length(prof->max_term_length);
+
+	// The filter is only read, so it is shared by all generators.
+	if (filter->active())
+	{
+		g.set_stopper(filter.get());
+		// Stopped words are not indexed at all, instead of only their
+		// stemmed forms.
+		g.set_stopper_strategy(xp::TermGenerator::STOP_ALL);
+	}
 }
 
 //// commented out for now as I plan to use SHA256(url) as unique
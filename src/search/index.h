@@ -14,18 +14,34 @@
  * @author Guanyuming He
  */
 
+#include <chrono>
+#include <concepts>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include <boost/url.hpp>
 #include <xapian.h>
 
+#include "index_profile.h"
+#include "url_canon.h"
+
+namespace ch = std::chrono;
 namespace fs = std::filesystem;
 namespace urls = boost::urls;
 namespace xp = Xapian;
 
+class near_dup_index;
 class webpage;
+class text_store;
+class wal;
 
 /**
  * The index class handles the main database stored on disk,
@@ -46,14 +62,191 @@ public:
 	enum value_slots : xp::valueno
 	{
 		DATE_SLOT = 1,
+		// Space separated keywords of the document, best first.
+		KEYWORDS_SLOT = 2,
+		// Location of the document's text in the text store, if any.
+		TEXT_SLOT = 3,
+		// The date as sortable_serialise(days since the epoch), which,
+		// unlike DATE_SLOT, can be used numerically in the matcher.
+		DAYS_SLOT = 4,
+		// The SimHash of the text as 16 hex digits (see near_dup.h), if the
+		// text is long enough.
+		SIMHASH_SLOT = 5,
+		// The hashid of the first document of its near-duplicates, its own
+		// if it has none, so that results can be collapsed on it.
+		CLUSTER_SLOT = 6,
+	};
+
+	/**
+	 * What to do with a document whose text is a near-duplicate of one of
+	 * the recent documents.
+	 */
+	enum class near_dup_policy : unsigned
+	{
+		// Nothing is computed.
+		OFF,
+		// Added, in the cluster of the earlier one.
+		LINK,
+		// Not added.
+		SKIP,
 	};
 
+	/**
+	 * Prefixes of the boolean terms of the date buckets a document is in,
+	 * e.g. XY2025, XM202507 and XDAY20250714, so that filtering and removing
+	 * by date are done on posting lists instead of DATE_SLOT values.
+	 */
+	static constexpr std::string_view YEAR_PREFIX = "XY";
+	static constexpr std::string_view MONTH_PREFIX = "XM";
+	static constexpr std::string_view DAY_PREFIX = "XDAY";
+	// Set iff all documents have the date terms.
+	static constexpr const char* DATE_TERMS_KEY = "date_terms";
+
+	// Max number of keywords stored in KEYWORDS_SLOT.
+	static constexpr unsigned NUM_KEYWORDS = 150u;
+
 	enum class shrink_policy : unsigned 
 	{
 		OLDEST,	// oldest is removed.
 		LATEST,	// latest is removed.
 	};
 
+	// See index_profile.h
+	using schema = index_schema;
+	/**
+	 * The schema and the profile of a db are recorded in its metadata under
+	 * these, so that the searcher can parse queries accordingly.
+	 * Dbs created before the profiles only have the schema.
+	 */
+	static constexpr const char* SCHEMA_KEY = "schema";
+	static constexpr const char* PROFILE_KEY = "profile";
+	// Seq of the last record of the WAL (see wal.h) that is committed.
+	static constexpr const char* WAL_SEQ_KEY = "wal_seq";
+	/**
+	 * Set iff the documents are identified by url2hashid(), i.e. by the key
+	 * of their url under the url rules of the db (see url_canon.h), which
+	 * are recorded under URL_RULES_KEY. Dbs created before have
+	 * legacy_hashid()s until rekey_urls().
+	 */
+	static constexpr const char* URL_KEYS_KEY = "url_keys";
+	static constexpr const char* URL_RULES_KEY = "url_rules";
+	// Generation of the text store (see text_store.h), if not 0.
+	static constexpr const char* TEXT_GEN_KEY = "text_gen";
+	// @returns the generation of the text store of db, as in TEXT_GEN_KEY.
+	static std::uint32_t text_gen_of(const xp::Database& db);
+
+	/**
+	 * Options of opening an index.
+	 * A path alone is enough to open one with the defaults.
+	 */
+	struct open_params
+	{
+		open_params(const fs::path& dbpath) :
+			dbpath(dbpath)
+		{}
+
+		fs::path dbpath;
+		/**
+		 * If true, the text of documents are also kept in a compressed side
+		 * store (see text_store.h) for generating snippets. 
+		 * Once a db has the store, the text is always kept, regardless
+		 * of this.
+		 */
+		bool store_text = false;
+		/**
+		 * Name of the profile of a new db (default if empty).
+		 * If the db exists, then its profile is used and this must be
+		 * either empty or the same.
+		 */
+		std::optional<std::string> profile{};
+		/**
+		 * If true, the added pages are first logged in a write-ahead log
+		 * (see wal.h), so that they survive a crash before the next commit.
+		 * Once a db has the log, it is always used, regardless of this.
+		 */
+		bool use_wal = false;
+		/**
+		 * The index commits itself every commit_every documents added, or
+		 * commit_interval after the last commit, whichever comes first.
+		 * 0 for either means never. Xapian also commits by itself every
+		 * XAPIAN_FLUSH_THRESHOLD modifications, which should then be set
+		 * larger.
+		 */
+		unsigned commit_every = 0;
+		ch::seconds commit_interval{0};
+		/**
+		 * The url rules of a new db, as url_canon::parse_rules() reads,
+		 * or the default ones if none. An existing db keeps its own, and
+		 * this must be either empty or the same. Change them with
+		 * rekey_urls(). A legacy db (see URL_KEYS_KEY) has none yet, and
+		 * takes these when rekeyed.
+		 */
+		std::optional<std::string> url_rules{};
+		/**
+		 * Near-duplicates are looked for among the last near_dup_window
+		 * documents added since the db is opened.
+		 */
+		near_dup_policy near_dups = near_dup_policy::LINK;
+		size_t near_dup_window = 100000u;
+	};
+
+	/**
+	 * Number of documents per host and per day, kept up to date by every
+	 * change made through the class, in the metadata of the db.
+	 */
+	struct db_stats
+	{
+		std::map<std::string, unsigned> hosts;
+		// Key is YYYYMMDD, as in DATE_SLOT.
+		std::map<std::string, unsigned> days;
+	};
+	// Keys of the counters in the metadata are these + the host or the day.
+	static constexpr std::string_view HOST_STAT_PREFIX = "stat:host:";
+	static constexpr std::string_view DAY_STAT_PREFIX = "stat:day:";
+	// Set iff the counters are complete.
+	static constexpr const char* STATS_KEY = "stats";
+
+	/**
+	 * The variants of canonical urls, e.g. AMP and mobile versions of an
+	 * article, are recorded in the metadata under this + url2hashid(variant)
+	 * with the canonical url as the value, so that the crawl can drop a
+	 * known variant without fetching it.
+	 */
+	static constexpr std::string_view CANONICAL_PREFIX = "canon:";
+
+	/**
+	 * What scan() reads of each document. Nothing else is decoded.
+	 */
+	struct scan_projection
+	{
+		// doc's data, i.e. url \t title.
+		bool data = false;
+		std::vector<xp::valueno> slots{};
+	};
+
+	/**
+	 * A document as seen by scan(). Only the projected fields are filled.
+	 */
+	struct scanned_doc
+	{
+		xp::docid id;
+		std::string data;
+		// values[i] is of scan_projection::slots[i]; empty if not set.
+		std::vector<std::string> values;
+	};
+
+	/**
+	 * Each thread of scan() visits its documents with its own copy of a
+	 * visitor. The copies are merged into one in the end.
+	 */
+	template <typename V>
+	static constexpr bool is_scan_visitor = 
+		std::copy_constructible<V> &&
+		requires(V v, V other, const scanned_doc& d) {
+			v(d);
+			v.merge(std::move(other));
+		};
+
 public:
 	// Empty index not allowed.
 	index() = delete;
@@ -71,6 +264,9 @@ public:
 	explicit index(
 		const fs::path& dbpath
 	);
+	explicit index(
+		const open_params& par
+	);
 
 public:
 	// @returns the document with the internal id, if present.
@@ -83,12 +279,130 @@ public:
 	inline auto num_documents() const
 	{ return db.get_doccount(); }
 
+	inline auto get_schema() const
+	{ return prof->schema; }
+	inline const index_profile& get_profile() const
+	{ return *prof; }
+	inline const fs::path& get_path() const
+	{ return dbpath; }
+
+	/**
+	 * @returns the schema recorded in db. Dbs without the record are of the
+	 * old DOUBLE schema.
+	 * @throws std::runtime_error if the record is invalid.
+	 */
+	static schema schema_of(const xp::Database& db);
+	static std::string schema_name(schema s);
+	/**
+	 * @returns the profile recorded in db, or the one of its schema if db
+	 * only has that.
+	 * @throws std::runtime_error if the record is invalid.
+	 */
+	static const index_profile& profile_of(const xp::Database& db);
+	/**
+	 * @returns the schema named n.
+	 * @throws std::runtime_error if there is no such schema.
+	 */
+	static schema schema_from_name(std::string_view n);
+	/**
+	 * @returns the policy named n, one of off, link, and skip.
+	 * @throws std::runtime_error if there is no such policy.
+	 */
+	static near_dup_policy near_dup_policy_from_name(std::string_view n);
+
+	/**
+	 * @returns the counters in db, or nothing if db does not keep them,
+	 * e.g. it was created before they were introduced.
+	 * Reads only the metadata, O(#hosts + #days).
+	 */
+	static std::optional<db_stats> stats_of(const xp::Database& db);
+	inline std::optional<db_stats> stats() const
+	{ return stats_of(db); }
+
+	// @returns true iff all documents in db have the date terms.
+	static bool has_date_terms(const xp::Database& db);
+	// Adds the year, month and day terms of d to doc.
+	static void add_date_terms(xp::Document& doc, const ch::year_month_day& d);
+	// @returns the value of DAYS_SLOT of d.
+	static std::string days_value(const ch::year_month_day& d);
+	// @returns the date in a DATE_SLOT value, if valid.
+	static std::optional<ch::year_month_day> date_from_value(
+		std::string_view v
+	);
+	/**
+	 * @returns a boolean query that matches the documents dated in [b, e],
+	 * if the db has the date terms.
+	 * The whole years and months within are ORed, while DATE_SLOT is checked
+	 * only in the months partly within.
+	 */
+	static xp::Query date_range_query(
+		const ch::year_month_day& b, const ch::year_month_day& e
+	);
+
+	/**
+	 * Visits all documents of the db at dbpath in parallel.
+	 *
+	 * Each thread opens its own read-only handle and visits a part of the
+	 * docid space. Readers never block the writer, so this can run while
+	 * the db is being updated, though documents changed during it may be
+	 * seen either before or after the change.
+	 *
+	 * @param visitor copied for each thread. Its copies are merged into the
+	 * returned one, in the order of their docid ranges.
+	 * @param nthreads 0 to use all cores.
+	 */
+	template <typename V>
+		requires is_scan_visitor<V>
+	static V scan(
+		const fs::path& dbpath, const scan_projection& proj,
+		V visitor, unsigned nthreads = 0
+	) {
+		std::vector<V> parts(scan_threads(nthreads), visitor);
+
+		std::vector<std::function<void(const scanned_doc&)>> funcs;
+		funcs.reserve(parts.size());
+		for (auto& p : parts)
+			funcs.emplace_back([&p](const scanned_doc& d) { p(d); });
+		scan_impl(dbpath, proj, funcs);
+
+		for (size_t i = 1; i < parts.size(); ++i)
+			parts.front().merge(std::move(parts[i]));
+		return std::move(parts.front());
+	}
+
+	/**
+	 * @returns true iff term is an unprefixed term, or the stemmed form of
+	 * one, i.e. one generated for free search in the DOUBLE schema.
+	 * By Xapian's convention, prefixes are capital letters, and stemmed
+	 * terms have a Z before their prefix.
+	 */
+	static bool is_free_text_term(std::string_view term);
+
 	/**
 	 * Because how the data is stored in the document is decided by the class,
 	 * the class should thus provide means to recover them.
 	 */
 	static std::string url_from_doc(const xp::Document& doc);
+	// The doc must be scanned with scan_projection::data.
+	static std::string url_from_doc(const scanned_doc& doc);
 	static std::string title_from_doc(const xp::Document& doc);
+	/**
+	 * @returns the keywords of the doc, separated by spaces.
+	 * Documents indexed before the keywords were stored do not have them, in
+	 * which case they are sampled from the doc's termlist, which is much
+	 * slower.
+	 */
+	static std::string keywords_from_doc(const xp::Document& doc);
+	/**
+	 * The fallback of keywords_from_doc(): gets all English words in the
+	 * doc's termlist and evenly samples NUM_KEYWORDS of them.
+	 */
+	static std::string sample_keywords(const xp::Document& doc);
+	/**
+	 * @returns the text of the doc from the text store, or nothing if the db
+	 * has no store or the doc is added before the store.
+	 */
+	std::optional<std::string> text_from_doc(const xp::Document& doc) const;
 
 public:
 	/**
@@ -96,8 +410,64 @@ public:
 	 * You MUST manually call has_document() to check 
 	 * if it's already in the index.
 	 * For performance reason, it won't be checked here.
+	 *
+	 * @returns false if it is not added, as it is empty or a skipped
+	 * near-duplicate.
+	 */
+	bool add_document(const webpage& doc);
+	/**
+	 * Adds the document of the url, with its title, date, and text, as
+	 * extracted from the page.
+	 * All others, e.g. add_document(const webpage&), end up here.
+	 * @returns as add_document(const webpage&).
+	 */
+	bool add_document(
+		const urls::url& u, std::string_view title, 
+		const ch::year_month_day& date, std::string_view text
+	);
+
+	/**
+	 * A document with its terms generated, but not added yet.
+	 *
+	 * Generating the terms is most of the work of adding a document, and it
+	 * does not need the db. So, many threads can do it with make_document(),
+	 * each with its own term generator, while one thread adds the results.
+	 */
+	struct prepared_doc
+	{
+		xp::Document doc;
+		std::string hashid;
+		std::string url;
+		// YYYYMMDD.
+		std::string date;
+		// The full text, kept only if the db has a text store.
+		std::string text;
+		// Of the full text, unless it is short or near_dup_policy::OFF.
+		std::optional<std::uint64_t> simhash;
+	};
+
+	// @returns a term generator set up for the profile of the db.
+	xp::TermGenerator make_term_generator() const;
+	/**
+	 * Thread safe, as long as each thread uses its own g from
+	 * make_term_generator().
 	 */
-	void add_document(const webpage& doc);
+	prepared_doc make_document(
+		xp::TermGenerator& g,
+		const urls::url& u, std::string_view title, 
+		const ch::year_month_day& date, std::string_view text
+	) const;
+	/**
+	 * Adds a document from make_document(). It is not logged to the WAL.
+	 * Like the other add_document()s, it is not added if it is a
+	 * near-duplicate and the policy is near_dup_policy::SKIP.
+	 *
+	 * @param is_new true if the caller knows that no document of the url is
+	 * in the db, e.g. when it builds a new db from distinct urls. Then, the
+	 * document is simply added, without looking for one to replace.
+	 * @returns false if it is a skipped near-duplicate.
+	 */
+	bool add_document(prepared_doc&& d, bool is_new = false);
 
 	/**
 	 * Attempts to remove the document identified by url 
@@ -107,6 +477,8 @@ public:
 	 * whether that succeeds or not, so I can't either.
 	 */
 	void rm_document(const urls::url& u);
+	// Removes the document with the internal id, e.g. one found by scan().
+	void rm_document(xp::docid id);
 
 	/**
 	 * Iterate through all documents.
@@ -126,6 +498,9 @@ public:
 	/**
 	 * Shrinks the database to max_num.
 	 * No effect if num_documents() <= max_num.
+	 * Otherwise, the variants of add_variant() whose canonical urls are no
+	 * longer in the db are forgotten, and the texts of the removed documents
+	 * are reclaimed with compact_texts(), which commits.
 	 *
 	 * @param max_num num_documents() will be <= after the call.
 	 * @param policy decides which documents to remove 
@@ -134,6 +509,33 @@ public:
 	 */
 	void shrink(unsigned max_num, shrink_policy policy);
 
+	// The texts are compacted once this much of the store is garbage.
+	static constexpr double DEF_TEXT_GARBAGE_RATIO = .25;
+	/**
+	 * Copies the texts of the documents into a new text store file,
+	 * leaving out those of removed documents, if at least garbage_ratio
+	 * of the store is theirs. The documents are updated to the new
+	 * locations in the same commit.
+	 * Commits before it.
+	 * @returns true iff it compacted.
+	 */
+	bool compact_texts(double garbage_ratio = DEF_TEXT_GARBAGE_RATIO);
+
+	/**
+	 * Recounts the counters of stats() from all documents with scan(),
+	 * so that a db without them gets them.
+	 * Commits before and after it.
+	 */
+	void rebuild_stats();
+
+	/**
+	 * Adds the date terms and DAYS_SLOT to all documents that do not have
+	 * them, so that a db created before them can be filtered and ranked
+	 * with them.
+	 * Commits after it.
+	 */
+	void add_missing_date_fields();
+
 	/**
 	 * Updates disk content with in memory content.
 	 * Does nothing if dirty = false or paths is invalid.
@@ -147,23 +549,177 @@ public:
 	 * conservative, and if you have a machine with plenty of memory, you can
 	 * improve indexing throughput dramatically by setting
 	 * XAPIAN_FLUSH_THRESHOLD in the environment to a larger value.
+	 *
+	 * With the WAL, the seq of its last record is committed together, and
+	 * the log is emptied after it.
 	 */
 	void synchronize();
 
+	/**
+	 * synchronize()s with the metadata entries of meta set in the same
+	 * commit. A Xapian commit is atomic, so after a crash, the db has either
+	 * them and every document added before them, or neither.
+	 * The indexer records its checkpoints with it.
+	 */
+	void checkpoint(const std::map<std::string, std::string>& meta);
+	// @returns the metadata of key, or "" if none.
+	inline std::string get_metadata(const std::string& key) const
+	{ return db.get_metadata(key); }
+
+	/**
+	 * Records that variant is a variant of canonical. It is committed with
+	 * the next commit.
+	 */
+	void add_variant(urls::url_view variant, urls::url_view canonical);
+	// @returns the canonical url of u, if u is a known variant.
+	std::optional<urls::url> canonical_of(urls::url_view u) const;
+
+	/**
+	 * @returns "Q" + SHA256(c.key(u)), the unique id term of the document of
+	 * u in a db of the rules c.
+	 */
+	static std::string url2hashid(const url_canon& c, urls::url_view u);
+	// @returns url2hashid() under the rules of the db.
+	inline std::string url2hashid(urls::url_view u) const
+	{ return url2hashid(canon, u); }
+	/**
+	 * The url rules of the db, by which the crawl should key the urls too.
+	 * Those of open_params for a legacy db, until rekey_urls().
+	 */
+	inline const url_canon& get_url_canon() const
+	{ return canon; }
+	// @returns "Q" + SHA256(url_get_essential(u)), the id term of dbs
+	// without URL_KEYS_KEY.
+	static std::string legacy_hashid(urls::url_view u);
+
+	struct rekey_stats
+	{
+		unsigned num_rekeyed = 0;
+		// Removed, as an earlier document has the same new key.
+		unsigned num_merged = 0;
+	};
+	/**
+	 * Identifies all documents by url2hashid() under rules, or the current
+	 * rules if none, so that a db created before url_canon or with other
+	 * rules gets the new keys. Of the documents whose urls now have the
+	 * same key, only the first is kept.
+	 * The variants of add_variant() are forgotten, as their keys cannot be
+	 * recomputed.
+	 * All is committed in one transaction, with the rules, so that the keys
+	 * and the rules of the db always agree.
+	 * @throws std::runtime_error if rules are invalid.
+	 */
+	rekey_stats rekey_urls(std::optional<std::string_view> rules = {});
+
 private:
 	fs::path dbpath;
 	xp::WritableDatabase db;
+	// Points to one of the built-in profiles.
+	const index_profile* prof;
+	std::unique_ptr<term_filter> filter;
+
+	// nullptr if the db does not keep the texts.
+	std::unique_ptr<text_store> texts;
+
+	// If the db keeps the counters of stats().
+	bool keep_stats;
+	// If all documents have the date terms.
+	bool date_terms;
+	// If the documents are identified by url2hashid().
+	bool canon_keys;
+	// The url rules of the db.
+	url_canon canon;
+
+	// nullptr if the db does not use the WAL.
+	std::unique_ptr<wal> log;
+
+	near_dup_policy near_dups;
+	// nullptr if near_dups is OFF.
+	std::unique_ptr<near_dup_index> recent;
+
+	// See open_params.
+	unsigned commit_every;
+	ch::seconds commit_interval;
+	unsigned num_uncommitted = 0;
+	ch::steady_clock::time_point last_commit = ch::steady_clock::now();
 
 	// Used to turn free text in a document into terms that are indexed.
 	// From the official doc, it seems that it can be reused across multiple
 	// documents.
 	xp::TermGenerator tg{};
 
-private:
-	// @returns "Q" + SHA256(url_get_essential(u)).
-	static std::string url2hashid(urls::url_view u);
+	void setup_tg(xp::TermGenerator& g) const;
+
+	// @returns the id term of the document of u in the db.
+	inline std::string hashid_of(urls::url_view u) const
+	{ return canon_keys ? url2hashid(u) : legacy_hashid(u); }
 
-	void setup_tg();
+	// add_document() without logging it, used by it and to replay the WAL.
+	// @returns false as store_document() does.
+	bool index_document(
+		const urls::url& u, std::string_view title, 
+		const ch::year_month_day& date, std::string_view text
+	);
+	/**
+	 * Adds the prepared d, with the parts that need the db.
+	 * @param is_new see add_document(prepared_doc&&, bool).
+	 * @returns false if d is a near-duplicate that is skipped.
+	 */
+	bool store_document(prepared_doc&& d, bool is_new);
+	// Replays the WAL records after the last commit, if any.
+	void recover();
+	/**
+	 * Fills recent with the fingerprints of the last window documents in
+	 * the db, as far as the docids tell, so that the near-duplicates of
+	 * those added before it was opened are found too.
+	 */
+	void seed_recent(size_t window);
+	/**
+	 * Commits if the WAL has records the db has not committed.
+	 * Deletions are not logged, so this is called before any. Otherwise, a
+	 * crash could replay an addition over a later deletion.
+	 */
+	void commit_logged();
+	// Removes num_to_rm documents for shrink().
+	void rm_for_shrink(xp::doccount num_to_rm, shrink_policy policy);
+	// Forgets the variants whose canonical urls are not in the db.
+	void prune_variants();
+	// Commits if the cadence of open_params says so.
+	void maybe_commit();
+
+	// @returns the metadata keys of the host and day counters of a doc.
+	// Either is empty if the doc has no valid url or date.
+	static std::pair<std::string, std::string> stat_keys(
+		std::string_view url, std::string_view day
+	);
+	static std::pair<std::string, std::string> stat_keys(
+		const xp::Document& doc
+	);
+	// Adds delta to the counters of keys. Does nothing if !keep_stats.
+	void count_doc(
+		const std::pair<std::string, std::string>& keys, int delta
+	);
+	void add_to_stat(const std::string& key, int delta);
+
+	// @returns the number of threads scan() uses.
+	static unsigned scan_threads(unsigned requested);
+	/**
+	 * Splits the docid space evenly into funcs.size() ranges, and visits
+	 * each in a thread with the corresponding func.
+	 * @throws the first exception thrown in any thread.
+	 */
+	static void scan_impl(
+		const fs::path& dbpath, const scan_projection& proj,
+		const std::vector<std::function<void(const scanned_doc&)>>& funcs
+	);
+
+	/**
+	 * Calculates the keywords of doc, whose terms have been generated.
+	 * Only the English words in the text are considered. Each is scored by
+	 * a TF-IDF like weight, wdf * log((N+2)/(df+1)), and the best
+	 * NUM_KEYWORDS are returned, separated by spaces.
+	 */
+	std::string calc_keywords(const xp::Document& doc) const;
 
 private:
 	//// commented out for now as I plan to use SHA256(url) as unique id.
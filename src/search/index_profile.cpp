@@ -0,0 +1,131 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the index profiles.
+ *
+ * @author Guanyuming He
+ */
+
+#include "index_profile.h"
+
+#include <array>
+#include <stdexcept>
+
+/**
+ * All of them stem some, as Xapian does by default: a word is indexed as
+ * it is, with positions, and stemmed with a Z prefix, without positions.
+ * Only the stemmed terms, as STEM_ALL_Z does, would save little, as they
+ * would need the positions instead, and lose the exact matches that rank
+ * "markets" above "market". Still, a profile may stem otherwise, and the
+ * searcher follows it with query_stemming().
+ */
+static const std::array<index_profile, 3> profiles {{
+	{
+		"default", index_schema::DOUBLE,
+		true, true,
+		false, 0,
+		// Xapian's default max word length.
+		1, 64,
+		xp::TermGenerator::STEM_SOME
+	},
+	{
+		"single", index_schema::SINGLE,
+		true, true,
+		false, 0,
+		1, 64,
+		xp::TermGenerator::STEM_SOME
+	},
+	{
+		"compact", index_schema::SINGLE,
+		// Titles are short. Keep phrase search for them.
+		true, false,
+		true, 64 * 1024,
+		// Longer words are mostly URLs, hashes, and tracking ids.
+		2, 32,
+		xp::TermGenerator::STEM_SOME
+	},
+}};
+
+const index_profile& index_profile::from_name(std::string_view n)
+{
+	for (const auto& p : profiles)
+		if (p.name == n)
+			return p;
+
+	throw std::runtime_error("Unknown index profile: " + std::string(n));
+}
+
+const index_profile& index_profile::of_schema(index_schema s)
+{
+	return s == index_schema::SINGLE ?
+		from_name("single") : from_name("default");
+}
+
+xp::QueryParser::stem_strategy index_profile::query_stemming() const
+{
+	switch (stemming)
+	{
+	case xp::TermGenerator::STEM_NONE:
+		return xp::QueryParser::STEM_NONE;
+	case xp::TermGenerator::STEM_ALL:
+		return xp::QueryParser::STEM_ALL;
+	case xp::TermGenerator::STEM_ALL_Z:
+		return xp::QueryParser::STEM_ALL_Z;
+	default:
+		return xp::QueryParser::STEM_SOME;
+	}
+}
+
+std::string_view index_profile::cut_text(std::string_view text) const
+{
+	if (max_text_length == 0 || text.size() <= max_text_length)
+		return text;
+
+	// Do not cut a word into half.
+	auto end = text.find_last_of(" \t\n\r", max_text_length);
+	// Without a space, e.g. in CJK text, at least not a UTF-8 char:
+	// cut before the first byte of the char at max_text_length.
+	if (end == std::string_view::npos)
+	{
+		end = max_text_length;
+		while (end > 0 && (text[end] & 0xC0) == 0x80)
+			--end;
+	}
+
+	return text.substr(0, end);
+}
+
+// From the list of the Snowball English stemmer, which Xapian uses.
+static const char* const english_stopwords[] {
+	"a", "about", "above", "after", "again", "against", "all", "am", "an",
+	"and", "any", "are", "as", "at", "be", "because", "been", "before",
+	"being", "below", "between", "both", "but", "by", "could", "did", "do",
+	"does", "doing", "down", "during", "each", "few", "for", "from",
+	"further", "had", "has", "have", "having", "he", "her", "here", "hers",
+	"herself", "him", "himself", "his", "how", "i", "if", "in", "into", "is",
+	"it", "its", "itself", "me", "more", "most", "my", "myself", "no", "nor",
+	"not", "of", "off", "on", "once", "only", "or", "other", "ought", "our",
+	"ours", "ourselves", "out", "over", "own", "same", "she", "should", "so",
+	"some", "such", "than", "that", "the", "their", "theirs", "them",
+	"themselves", "then", "there", "these", "they", "this", "those",
+	"through", "to", "too", "under", "until", "up", "very", "was", "we",
+	"were", "what", "when", "where", "which", "while", "who", "whom", "why",
+	"with", "would", "you", "your", "yours", "yourself", "yourselves",
+};
+
+term_filter::term_filter(const index_profile& p):
+	min_length(p.min_term_length), stopwords(p.stopwords)
+{
+	if (stopwords)
+		for (const char* w : english_stopwords)
+			stop_list.add(w);
+}
+
+bool term_filter::operator()(const std::string& word) const
+{
+	if (word.size() < min_length)
+		return true;
+
+	return stopwords && stop_list(word);
+}
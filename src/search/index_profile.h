@@ -0,0 +1,103 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the index profiles, named sets of options of how
+ * documents are turned into terms.
+ *
+ * Indexing every term of every page with positional information gives
+ * phrase search, but makes the database large and slow to update. A profile
+ * trades some of that for a smaller, faster index. As the searcher must parse
+ * queries the same way as the documents were indexed, the profile of a
+ * database is recorded in its metadata.
+ *
+ * @author Guanyuming He
+ */
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include <xapian.h>
+
+namespace xp = Xapian;
+
+/**
+ * How the title and the text of a document are indexed.
+ */
+enum class index_schema : unsigned
+{
+	// Each is indexed twice, once with its prefix and once without any
+	// for free search. All dbs without the metadata are like this.
+	DOUBLE,
+	// Each is indexed once, with its prefix only. Free search is done at
+	// query time by searching both prefixes, which saves roughly half of
+	// the postings and positions.
+	SINGLE,
+};
+
+struct index_profile
+{
+	std::string name;
+
+	index_schema schema;
+	// Without positions, phrase and NEAR queries cannot match the field.
+	bool title_positions;
+	bool text_positions;
+	// Don't index English stopwords at all.
+	bool stopwords;
+	// In bytes. Longer texts are cut at a word boundary before it.
+	// 0 means no limit.
+	size_t max_text_length;
+	// In bytes. Words out of [min, max] are not indexed.
+	unsigned min_term_length;
+	unsigned max_term_length;
+	// Of the TermGenerator. The QueryParser uses query_stemming().
+	xp::TermGenerator::stem_strategy stemming;
+
+	/**
+	 * The profiles are:
+	 * default: what all dbs had before the profiles. Everything is indexed
+	 * twice with positions.
+	 * single: default but of the SINGLE schema.
+	 * compact: single, but the text has no positions, stopwords and very
+	 * short or long words are dropped, and only the first 64KiB of text is
+	 * indexed.
+	 *
+	 * @throws std::runtime_error if there is no profile named n.
+	 */
+	static const index_profile& from_name(std::string_view n);
+	// @returns the profile of dbs that only recorded their schema.
+	static const index_profile& of_schema(index_schema s);
+
+	// @returns the same strategy for a QueryParser.
+	xp::QueryParser::stem_strategy query_stemming() const;
+
+	// @returns text, cut at a word boundary to be within max_text_length.
+	std::string_view cut_text(std::string_view text) const;
+};
+
+/**
+ * Decides which words are not indexed, and thus not searched for either,
+ * according to a profile.
+ * Used as the stopper of both the TermGenerator and the QueryParser.
+ */
+class term_filter final : public xp::Stopper
+{
+public:
+	explicit term_filter(const index_profile& p);
+
+	// @returns true iff word should not be indexed.
+	bool operator()(const std::string& word) const override;
+
+	// @returns true iff it may stop any word.
+	inline bool active() const
+	{ return min_length > 1 || stopwords; }
+
+private:
+	unsigned min_length;
+	bool stopwords;
+	// Empty if not stopwords.
+	xp::SimpleStopper stop_list{};
+};
@@ -8,16 +8,63 @@
  */
 
 #include "indexer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "url2html.h"
+#include "url_canon.h"
 #include "utility.h"
 #include "webpage.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
 #include <unordered_set>
 #include <stdexcept>
 #include <string>
 
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+// Writes <uint32_t size> <char string>.
+static void write_str(std::ostream& os, std::string_view s)
+{
+	// I know urls will be < 2^32.
+	auto len = static_cast<uint32_t>(s.size());
+	os.write(reinterpret_cast<char*>(&len), sizeof(len));
+	os.write(s.data(), len);
+}
+
+static std::string read_str(std::istream& is)
+{
+	uint32_t len = 0;
+	is.read(reinterpret_cast<char*>(&len), sizeof(len));
+
+	std::string s(len, '\0');
+	is.read(s.data(), len);
+	return s;
+}
+
+// Makes the file, or the entries of the dir, at p durable.
+static void fsync_path(const fs::path& p)
+{
+	int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open to fsync: " + p.string());
+	int ret = ::fsync(fd);
+	::close(fd);
+	if (ret != 0)
+		throw std::runtime_error("Cannot fsync: " + p.string());
+}
+
+// @returns the number in the metadata of key, or 0 if none.
+static std::uint64_t meta_num(const class index& db, const char* key)
+{
+	auto v = db.get_metadata(key);
+	return v.empty() ? 0ull : std::stoull(v);
+}
+
 indexer::uque_t indexer::load_url_q(
 	const fs::path& p
 ) {
@@ -29,6 +76,11 @@ indexer::uque_t indexer::load_url_q(
 		);
 
 	// File exists. Read it.
+	return load_url_q(ifs);
+}
+
+indexer::uque_t indexer::load_url_q(std::istream& ifs)
+{
 	uque_t ret;
 	// We have this many entries.
     uint32_t size;
@@ -37,13 +89,7 @@ indexer::uque_t indexer::load_url_q(
     for (uint32_t i = 0; i < size; ++i) 
 	{
 		// url is stored as <number of chars> <char string>
-		uint32_t num_chars;
-    	ifs.read(reinterpret_cast<char*>(&num_chars), sizeof(num_chars));
-
-		std::string u_str(num_chars, '\0');
-        ifs.read(reinterpret_cast<char*>(u_str.data()), num_chars);
-
-		ret.emplace_back(u_str);
+		ret.emplace_back(read_str(ifs));
     }
 
     return ret;
@@ -65,19 +111,138 @@ void indexer::save_url_q()
 	fs.write(reinterpret_cast<char*>(&sz), sizeof(sz));
 
 	// Write urls
-	while (!q.empty())
+	for (const auto& url : q)
 	{
-		auto url{std::move(q.front())};
-		q.pop_front();
-
 		// Write size and char string.
-		auto full{url.c_str()};
-		// I know urls will be < 2^32.
-		uint32_t len = static_cast<uint32_t>(
-			std::char_traits<char>::length(full)
-		);
-		fs.write(reinterpret_cast<char*>(&len), sizeof(len));
-		fs.write(full, len);
+		write_str(fs, url.buffer());
+	}
+}
+
+std::uint64_t indexer::db_ckpt_id() const
+{
+	return meta_num(db, CKPT_ID_KEY);
+}
+
+fs::path indexer::snapshot_path(std::uint64_t id) const
+{
+	// Kept with the db that refers to it, rather than wherever q_path is,
+	// e.g. the working directory.
+	return db.get_path() /
+		(q_path.filename().string() + "." + std::to_string(id));
+}
+
+void indexer::resume()
+{
+	ckpt_id = db_ckpt_id();
+	const auto p = snapshot_path(ckpt_id);
+	if (ckpt_id == 0 || !fs::exists(p))
+	{
+		q = load_url_q(q_path);
+		return;
+	}
+
+	// The snapshot is the queue as in q_path, followed by
+	// <uint32_t number of essentials> <that number>*<uint32_t size> <chars>
+	std::ifstream ifs(p, std::ios::binary);
+	q = load_url_q(ifs);
+
+	uint32_t size;
+	ifs.read(reinterpret_cast<char*>(&size), sizeof(size));
+	enqueued.reserve(size);
+	for (uint32_t i = 0; i < size; ++i)
+		enqueued.emplace(read_str(ifs));
+	if (!ifs)
+		throw std::runtime_error("Corrupted checkpoint: " + p.string());
+
+	resumed_indexed = meta_num(db, CKPT_INDEXED_KEY);
+	resumed_fetched = meta_num(db, CKPT_FETCHED_KEY);
+	util_log(
+		"Resumed from checkpoint " + std::to_string(ckpt_id) + " with " +
+		std::to_string(q.size()) + " urls queued."
+	);
+}
+
+void indexer::set_checkpoint_cadence(unsigned every_docs, ch::seconds interval)
+{
+	ckpt_every = every_docs;
+	ckpt_interval = interval;
+}
+
+void indexer::checkpoint()
+{
+	const auto id = ckpt_id + 1;
+	const auto p = snapshot_path(id);
+	{
+		std::ofstream ofs(p, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			throw std::runtime_error(
+				"Could not create checkpoint file: " + p.string()
+			);
+
+		auto sz = static_cast<uint32_t>(q.size());
+		ofs.write(reinterpret_cast<char*>(&sz), sizeof(sz));
+		for (const auto& url : q)
+			write_str(ofs, url.buffer());
+
+		sz = static_cast<uint32_t>(enqueued.size());
+		ofs.write(reinterpret_cast<char*>(&sz), sizeof(sz));
+		for (const auto& e : enqueued)
+			write_str(ofs, e);
+
+		if (!ofs.flush())
+			throw std::runtime_error(
+				"Could not write checkpoint file: " + p.string()
+			);
+	}
+	// The snapshot must be durable before the db refers to it.
+	fsync_path(p);
+	fsync_path(p.parent_path());
+
+	db.checkpoint({
+		{CKPT_ID_KEY, std::to_string(id)},
+		{CKPT_INDEXED_KEY, std::to_string(resumed_indexed + num_indexed)},
+		{CKPT_FETCHED_KEY, std::to_string(resumed_fetched + num_fetched)},
+	});
+
+	// The db no longer refers to the previous one.
+	std::error_code ec;
+	fs::remove(snapshot_path(ckpt_id), ec);
+
+	ckpt_id = id;
+	ckpt_last_indexed = num_indexed;
+	ckpt_last = ch::steady_clock::now();
+}
+
+void indexer::maybe_checkpoint()
+{
+	if (
+		(ckpt_every != 0 && num_indexed - ckpt_last_indexed >= ckpt_every) ||
+		(
+			ckpt_interval != ch::seconds{0} &&
+			ch::steady_clock::now() - ckpt_last >= ckpt_interval
+		)
+	)
+		checkpoint();
+}
+
+void indexer::set_stage_stats_path(const fs::path& p)
+{
+	stage_stats_path = p;
+}
+
+void indexer::save_stage_stats() const
+{
+	std::ofstream ofs(stage_stats_path);
+	for (const char* stage : {"fetch", "parse", "date", "index"})
+	{
+		const auto& h = stage_histogram(stage);
+		if (h.count() == 0)
+			continue;
+
+		ofs << stage << ' ' << h.count() << ' '
+			<< h.quantile_seconds(0.5) * 1000.0 << ' '
+			<< h.quantile_seconds(0.99) * 1000.0 << ' '
+			<< h.sum_seconds() << '\n';
 	}
 }
 
@@ -92,50 +257,107 @@ void indexer::start_indexing()
 	// new urls.
 	//
 	// I chose to make the set local to each indexing.
+	// A resumed checkpoint, however, restores the set of its indexing, as
+	// the indexing is then continued instead.
 	
-	std::unordered_set<std::string> enqueued;
 	// register the initial queue.
 	for (const auto& u : q)
 	{
-		enqueued.emplace(url_get_essential(u));
+		enqueued.emplace(db.get_url_canon().key(u));
 	}
 
+	auto& reg = metrics_registry::global();
+	auto& fetched_c = reg.counter(
+		"search_pages_fetched_total", "Pages fetched by the indexer."
+	);
+	auto& indexed_c = reg.counter(
+		"search_pages_indexed_total", "Pages indexed by the indexer."
+	);
+	auto& enqueued_c = reg.counter(
+		"search_urls_enqueued_total", "Urls put into the crawl queue."
+	);
+	auto& queue_g = reg.gauge(
+		"search_queue_length", "Urls in the crawl queue."
+	);
+	auto& filter_h = stage_histogram("filter");
+	auto& links_h = stage_histogram("links");
+	std::string key_buf;
+
 	while (
 		!q.empty() && 
 		!interrupted && 
 		num_indexed < index_limit
 	) {
+		queue_g.set(double(q.size()));
 		auto url{std::move(q.front())};
 		q.pop_front();
 
+		// Learnt to be a variant after it was enqueued. Its canonical url
+		// has been fetched through another variant.
+		if (db.canonical_of(url))
+			continue;
+		trace_page traced(url.buffer());
+
 		// Not indexed.
 		webpage pg(url, convertor);
+		++num_fetched;
+		fetched_c.inc();
+
+		// The page is indexed under its canonical url, if it names one that
+		// would be indexed, and the variant is remembered so that it is never
+		// fetched again.
+		auto canonical = pg.get_canonical_url(db.get_url_canon());
+		if (canonical && !index_filter(*canonical))
+			canonical.reset();
+		if (canonical)
+		{
+			db.add_variant(url, *canonical);
+			enqueued.emplace(db.get_url_canon().key(*canonical));
+		}
+		auto key = canonical.value_or(url);
+
 		// Only index if this filter returns true
 		// and the document not indexed previously.
 		// Advantage: much faster.
 		// Disadvantage: cannot update an already indexed page.
+		// Only recurse when the other filters return true.
+		bool to_index, to_recurse;
+		{
+			metric_timer t(filter_h);
+			trace_span span("filter");
+			to_index = 
+				index_filter(key) && wp_index_filter(pg) && 
+				!db.get_document(key).has_value();
+			to_recurse = recurse_filter(url) && wp_recurse_filter(pg);
+		}
+
+		// It may still be skipped as a near-duplicate, or for being empty.
 		if (
-			index_filter(url) && wp_index_filter(pg) && 
-			!db.get_document(url).has_value()
+			to_index && db.add_document(
+				key, pg.get_title(), pg.get_date(), pg.get_text()
+			)
 		)
 		{
-			db.add_document(pg);
+			indexed_c.inc();
 			// log the webpage indexed:
-			util_log(
-				std::to_string(num_indexed) + "th indexed: " +
-				url.c_str()
+			UTIL_LOG(
+				log_levels::VERBOSE_1, "indexed",
+				{"n", num_indexed}, {"url", key.buffer()}
 			);
 			++num_indexed;
 		}
 
-		// Only recurse when the filters return true.
-		if (
-			recurse_filter(url) && wp_recurse_filter(pg))
+		if (to_recurse)
 		{
-
+			metric_timer t(links_h);
+			trace_span span("links");
 			auto urls{pg.get_urls()};
 			for (auto&& u : urls)
 			{
+				// A known variant is checked as its canonical url.
+				if (auto c = db.canonical_of(u))
+					u = std::move(*c);
+
 				// If url is already indexed, don't put it into queue at all.
 				// Advantage: much faster.
 				// Disadvantage: cannot update an already indexed page.
@@ -149,15 +371,18 @@ void indexer::start_indexing()
 				)
 					continue;
 
-				auto essential = url_get_essential(u);
-				if (!enqueued.contains(essential))
+				// Only a new one is copied into the set.
+				db.get_url_canon().key(u, key_buf);
+				if (!enqueued.contains(key_buf))
 				{
 					q.emplace_back(u);
-					enqueued.emplace(essential);
+					enqueued.emplace(key_buf);
+					enqueued_c.inc();
 				}
 			}
 		}
 
+		maybe_checkpoint();
 	}
 }
 
@@ -168,5 +393,17 @@ void indexer::interrupt()
 
 indexer::~indexer()
 {
+	try
+	{
+		checkpoint();
+	}
+	catch (const std::exception& e)
+	{
+		// The last checkpoint still agrees with the db.
+		util_log(std::string("Checkpoint failed at exit: ") + e.what());
+	}
 	save_url_q();
+
+	if (!stage_stats_path.empty())
+		save_stage_stats();
 }
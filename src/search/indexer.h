@@ -9,10 +9,17 @@
  * @author Guanyuming He
  */
 
+#include <chrono>
+#include <cstdint>
 #include <deque>
 #include <filesystem>
+#include <istream>
 #include <limits>
+#include <map>
+#include <string>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 #include "url2html.h"
 #include "index.h"
@@ -43,6 +50,15 @@
  *
  * It would be desirable for the queue to be saved when the indexing is
  * interrupted.
+ *
+ * Saving it only then, however, makes the queue and the db disagree after a
+ * crash. So, the indexer also takes checkpoints periodically and when it
+ * stops: it snapshots the queue and the set of enqueued urls to
+ * <q_path's name>.<id> in the db directory, and then commits the db with the
+ * id and its counters in the metadata. Resuming loads the snapshot of the id in the db, so it continues
+ * exactly from the last commit. Pages indexed after the checkpoint but
+ * committed with the db by themselves are fetched again but not indexed
+ * again.
  */
 class indexer
 {
@@ -61,6 +77,11 @@ public:
 	// I could iterate over it.
 	using uque_t = std::deque<urls::url>;
 
+	// The metadata keys of the last checkpoint in the db.
+	static constexpr const char* CKPT_ID_KEY = "ckpt_id";
+	static constexpr const char* CKPT_INDEXED_KEY = "ckpt_num_indexed";
+	static constexpr const char* CKPT_FETCHED_KEY = "ckpt_num_fetched";
+
 public:
 	indexer() = delete;
 	~indexer();
@@ -101,9 +122,13 @@ public:
 		index_filter(index_filter), recurse_filter(recurse_filter),
 		wp_index_filter(wp_index_filter), wp_recurse_filter(wp_recurse_filter),
 		index_limit(index_limit)
-	{}
+	{
+		// Ids keep increasing over the checkpoints of a db.
+		ckpt_id = db_ckpt_id();
+	}
 	/**
-	 * Resumes indexing with a stored queue on disk
+	 * Resumes indexing from the last checkpoint of the db, or with a stored
+	 * queue on disk if it has none.
 	 *
 	 * @param db_par One single parameter to construct an index. It could be a
 	 * path or a rvalue ref to an existing index.
@@ -131,11 +156,12 @@ public:
 	):
 		db(std::forward<D>(db_par)),
 		q_path(std::forward<P>(q_path)),
-		q(load_url_q(this->q_path)), 
 		index_filter(index_filter), recurse_filter(recurse_filter),
 		wp_index_filter(wp_index_filter), wp_recurse_filter(wp_recurse_filter),
 		index_limit(index_limit)
-	{}
+	{
+		resume();
+	}
 
 public:
 	/**
@@ -149,17 +175,57 @@ public:
 	 */
 	void interrupt();
 
+	/**
+	 * Takes a checkpoint every that many pages indexed, or every that long,
+	 * whichever comes first. 0 disables either.
+	 * By default, one is taken only when the indexer stops.
+	 */
+	void set_checkpoint_cadence(unsigned every_docs, ch::seconds interval);
+
+	/**
+	 * Snapshots the queue and the enqueued urls to <db>/<q_path's name>.<id>,
+	 * and commits
+	 * the db with the id and the counters.
+	 * @throws std::runtime_error if the snapshot cannot be written.
+	 */
+	void checkpoint();
+
+	/**
+	 * Makes the indexer write how long each stage of a page took, i.e.
+	 * fetch, parse, date, and index, to p when it stops, as lines of
+	 *   <stage> <count> <p50 ms> <p99 ms> <total s>
+	 * The percentiles are from the stage histograms (see metrics.h), and so
+	 * within 1/8 of the exact ones.
+	 * For benchmarks, e.g. tools/crawl_bench.cpp.
+	 */
+	void set_stage_stats_path(const fs::path& p);
+
 
 private:
 	/**
 	 * @throws std::runtime_error if file does not exist.
 	 */
 	static uque_t load_url_q(const fs::path& q_path);
+	// Reads a queue stored as in q_path from is.
+	static uque_t load_url_q(std::istream& is);
 	/**
 	 * Not const because one can't loop over a queue immutably.
 	 */
 	void save_url_q();
 
+	// @returns the id of the last checkpoint in db, or 0 if none.
+	std::uint64_t db_ckpt_id() const;
+	// @returns <db>/<q_path's name>.<id>.
+	fs::path snapshot_path(std::uint64_t id) const;
+	/**
+	 * Loads the checkpoint recorded in the db, or the queue in q_path if
+	 * there is none or its snapshot is missing.
+	 */
+	void resume();
+	// Takes a checkpoint if the cadence says so.
+	void maybe_checkpoint();
+	void save_stage_stats() const;
+
 private:
 	class index db;
 
@@ -173,6 +239,9 @@ private:
 	 */
 	const fs::path q_path;
 	uque_t q;
+	// Keys (see url_canon.h) of the urls ever put into q in this indexing,
+	// or since the checkpoint resumed from.
+	std::unordered_set<std::string> enqueued;
 
 	// Two stages:
 	// When a url is retrieved from a recursed webpage,
@@ -197,6 +266,21 @@ private:
 
 	size_t num_indexed = 0;
 	const size_t index_limit{};
+	size_t num_fetched = 0;
+
+	// Id of the last checkpoint, and the counters of the one resumed from,
+	// to which num_indexed and num_fetched are added.
+	std::uint64_t ckpt_id = 0;
+	size_t resumed_indexed = 0, resumed_fetched = 0;
+	// See set_checkpoint_cadence().
+	unsigned ckpt_every = 0;
+	ch::seconds ckpt_interval{0};
+	size_t ckpt_last_indexed = 0;
+	ch::steady_clock::time_point ckpt_last = ch::steady_clock::now();
+
+	// Empty if the stage times are not saved. They are always recorded in
+	// the stage histograms of the metrics.
+	fs::path stage_stats_path;
 
 	bool interrupted = false;
 
@@ -0,0 +1,259 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the logger declared in logger.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "logger.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+
+// How long the writer sleeps when there is nothing to write.
+constexpr ch::milliseconds IDLE_WAIT{2};
+
+logger& logger::global()
+{
+	static logger* l = [] {
+		auto* ret = new logger;
+		std::atexit([] { global().stop(); });
+		return ret;
+	}();
+	return *l;
+}
+
+logger::logger():
+	slots(std::make_unique<slot[]>(CAPACITY))
+{
+	for (size_t i = 0; i < CAPACITY; ++i)
+		slots[i].seq.store(i, std::memory_order_relaxed);
+
+	if (const char* l = std::getenv(LEVEL_ENV))
+	{
+		const int v = std::atoi(l);
+		if (v >= int(log_levels::NO_LOG) && v <= int(log_levels::VERBOSE_2))
+			lvl = log_levels(v);
+	}
+
+	writer = std::thread([this] { write_loop(); });
+}
+
+void logger::open(const options& o)
+{
+	std::FILE* f = o.path.empty() ? stdout : std::fopen(o.path.c_str(), "a");
+	if (!f)
+		throw std::runtime_error(
+			"Could not open log file: " + o.path.string()
+		);
+
+	flush();
+	std::lock_guard lock(out_m);
+	if (out != stdout)
+		std::fclose(out);
+	out = f;
+	opts = o;
+	out_size = 0;
+	std::error_code ec;
+	if (!o.path.empty())
+		out_size = fs::file_size(o.path, ec);
+}
+
+// Quotes v if it has spaces, quotes, or '=' so that a line can be split.
+static void append_value(std::string& s, std::string_view v)
+{
+	if (v.find_first_of(" \"=") == std::string_view::npos && !v.empty())
+	{
+		s += v;
+		return;
+	}
+
+	s += '"';
+	for (char c : v)
+	{
+		if (c == '"' || c == '\\')
+			s += '\\';
+		s += c;
+	}
+	s += '"';
+}
+
+void logger::log(
+	std::string_view msg, std::initializer_list<log_field> fields,
+	const std::source_location& loc
+) {
+	const auto now = ch::system_clock::now();
+
+	std::string line;
+	line.reserve(msg.size() + 64 * fields.size() + 1);
+	if (enabled(log_levels::VERBOSE_2))
+	{
+		line += loc.file_name();
+		line += '(';
+		line += std::to_string(loc.line());
+		line += "): ";
+	}
+	line += msg;
+	for (const auto& f : fields)
+	{
+		line += ' ';
+		line += f.key;
+		line += '=';
+		append_value(line, f.value);
+	}
+	line += '\n';
+
+	// After the writer has stopped, e.g. from the destructor of a static.
+	if (stopping.load(std::memory_order_acquire))
+	{
+		std::lock_guard lock(out_m);
+		write_line(now, line);
+		std::fflush(out);
+		return;
+	}
+
+	if (!try_push(now, std::move(line)))
+		num_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool logger::try_push(ch::system_clock::time_point t, std::string&& line)
+{
+	size_t pos = head.load(std::memory_order_relaxed);
+	slot* s;
+	for (;;)
+	{
+		s = &slots[pos & (CAPACITY - 1)];
+		const size_t seq = s->seq.load(std::memory_order_acquire);
+		const auto dif = static_cast<std::ptrdiff_t>(seq - pos);
+		if (dif == 0)
+		{
+			if (head.compare_exchange_weak(
+				pos, pos + 1, std::memory_order_relaxed
+			))
+				break;
+		}
+		// The writer has not read the slot of the last round.
+		else if (dif < 0)
+			return false;
+		else
+			pos = head.load(std::memory_order_relaxed);
+	}
+
+	s->time = t;
+	s->line = std::move(line);
+	s->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool logger::drain()
+{
+	std::lock_guard lock(out_m);
+	size_t pos = tail.load(std::memory_order_relaxed);
+	const size_t start = pos;
+	for (;;)
+	{
+		slot& s = slots[pos & (CAPACITY - 1)];
+		if (s.seq.load(std::memory_order_acquire) != pos + 1)
+			break;
+
+		write_line(s.time, s.line);
+		s.line.clear();
+		s.seq.store(pos + CAPACITY, std::memory_order_release);
+		tail.store(++pos, std::memory_order_relaxed);
+	}
+
+	const auto d = num_dropped.load(std::memory_order_relaxed);
+	if (d != num_dropped_reported)
+	{
+		write_line(
+			ch::system_clock::now(),
+			std::to_string(d - num_dropped_reported) +
+				" log messages dropped.\n"
+		);
+		num_dropped_reported = d;
+	}
+
+	if (pos != start)
+		std::fflush(out);
+	flushed.store(pos, std::memory_order_release);
+	return pos != start;
+}
+
+void logger::write_line(
+	ch::system_clock::time_point t, const std::string& line
+) {
+	// e.g. 2025-07-14T09:30:00.123
+	const auto secs = ch::system_clock::to_time_t(t);
+	const auto ms = ch::duration_cast<ch::milliseconds>(
+		t.time_since_epoch()
+	).count() % 1000;
+	std::tm tm{};
+	localtime_r(&secs, &tm);
+	char ts[32];
+	const auto n = std::strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+	std::snprintf(ts + n, sizeof(ts) - n, ".%03d ", int(ms));
+
+	std::fputs(ts, out);
+	std::fwrite(line.data(), 1, line.size(), out);
+	out_size += n + 5 + line.size();
+
+	if (
+		out != stdout && opts.max_file_size != 0 &&
+		out_size >= opts.max_file_size
+	)
+		rotate();
+}
+
+void logger::rotate()
+{
+	std::fclose(out);
+	std::error_code ec;
+	for (unsigned i = opts.max_files; i > 0; --i)
+	{
+		auto from = opts.path;
+		if (i > 1)
+			from += "." + std::to_string(i - 1);
+		auto to = opts.path;
+		to += "." + std::to_string(i);
+		if (fs::exists(from, ec))
+			fs::rename(from, to, ec);
+	}
+	if (opts.max_files == 0)
+		fs::remove(opts.path, ec);
+
+	out = std::fopen(opts.path.c_str(), "a");
+	// Better than losing the messages.
+	if (!out)
+		out = stdout;
+	out_size = 0;
+}
+
+void logger::write_loop()
+{
+	while (!stopping.load(std::memory_order_acquire))
+		if (!drain())
+			std::this_thread::sleep_for(IDLE_WAIT);
+	drain();
+}
+
+void logger::flush()
+{
+	const size_t target = head.load(std::memory_order_acquire);
+	while (
+		flushed.load(std::memory_order_acquire) < target &&
+		!stopping.load(std::memory_order_acquire)
+	)
+		std::this_thread::sleep_for(IDLE_WAIT);
+}
+
+void logger::stop()
+{
+	if (stopping.exchange(true))
+		return;
+	writer.join();
+	std::lock_guard lock(out_m);
+	std::fflush(out);
+}
@@ -0,0 +1,189 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the logger behind util_log() and UTIL_LOG().
+ *
+ * Logging a message only formats it and puts it in a lock-free ring buffer;
+ * a background thread writes the buffer out, so that the crawl never waits
+ * for the terminal or the disk. When the buffer is full, messages are
+ * dropped and counted rather than waited for.
+ *
+ * @author Guanyuming He
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+namespace ch = std::chrono;
+namespace fs = std::filesystem;
+
+/**
+ * A message is written iff its level is <= the logger's, and the logger's is
+ * not NO_LOG. VERBOSE_2 also writes where each message was logged.
+ */
+enum class log_levels : int
+{
+	NO_LOG,
+	VERBOSE_1,
+	VERBOSE_2
+};
+
+// A key=value of a message, e.g. url, host, stage, or latency.
+struct log_field
+{
+	log_field(std::string_view key, std::string_view value):
+		key(key), value(value)
+	{}
+	log_field(std::string_view key, const char* value):
+		key(key), value(value)
+	{}
+	template <typename T>
+	requires std::is_arithmetic_v<T>
+	log_field(std::string_view key, T value):
+		key(key), value(std::to_string(value))
+	{}
+	// In ms.
+	template <typename R, typename P>
+	log_field(std::string_view key, ch::duration<R, P> d):
+		key(key),
+		value(std::to_string(ch::duration<double, std::milli>(d).count()))
+	{}
+
+	std::string_view key;
+	std::string value;
+};
+
+class logger final
+{
+public:
+	struct options
+	{
+		// Empty for stdout.
+		fs::path path{};
+		// The file is rotated to path.1, path.1 to path.2, and so on, when
+		// it exceeds this many bytes. 0 never rotates.
+		std::uintmax_t max_file_size = 64ull << 20;
+		// The number of rotated files kept.
+		unsigned max_files = 4;
+	};
+
+	// A power of 2.
+	static constexpr size_t CAPACITY = 8192;
+
+	/**
+	 * The logger of the process, writing to stdout at the level of
+	 * LEVEL_ENV (0, 1, or 2) if set, or VERBOSE_1.
+	 * It is never destroyed, as statics log in their destructors. Its
+	 * writer is stopped at exit, after which messages are written at once.
+	 */
+	static logger& global();
+	static constexpr const char* LEVEL_ENV = "SEARCH_LOG_LEVEL";
+
+	logger(const logger&) = delete;
+	logger& operator=(const logger&) = delete;
+
+public:
+	inline bool enabled(log_levels l) const
+	{
+		const auto cur = lvl.load(std::memory_order_relaxed);
+		return cur != log_levels::NO_LOG && l <= cur;
+	}
+	inline void set_level(log_levels l)
+	{ lvl.store(l, std::memory_order_relaxed); }
+
+	/**
+	 * Writes to the file of o, or stdout, from now on, after the messages
+	 * before.
+	 * @throws std::runtime_error if the file cannot be opened.
+	 */
+	void open(const options& o);
+
+	/**
+	 * Logs msg and the fields as one line, e.g.
+	 *   <time> indexed url=https://a.com/b stage=index latency_ms=1.5
+	 * Does not check the level. Use UTIL_LOG(), which does before
+	 * evaluating the arguments.
+	 */
+	void log(
+		std::string_view msg, std::initializer_list<log_field> fields,
+		const std::source_location& loc
+	);
+
+	// Blocks until all messages logged before are written.
+	void flush();
+
+	// @returns the number of messages dropped as the buffer was full.
+	inline std::uint64_t dropped() const
+	{ return num_dropped.load(std::memory_order_relaxed); }
+
+private:
+	logger();
+
+	struct slot
+	{
+		std::atomic<size_t> seq;
+		ch::system_clock::time_point time;
+		std::string line;
+	};
+
+	std::atomic<log_levels> lvl{log_levels::VERBOSE_1};
+
+	/**
+	 * The bounded queue of Dmitry Vyukov: a slot can be written by the
+	 * producer of position pos iff its seq is pos, and then read by the
+	 * writer iff its seq is pos + 1.
+	 */
+	std::unique_ptr<slot[]> slots;
+	alignas(64) std::atomic<size_t> head{0};
+	// Only the writer moves it.
+	alignas(64) std::atomic<size_t> tail{0};
+	// Positions before it are written and flushed.
+	std::atomic<size_t> flushed{0};
+	std::atomic<std::uint64_t> num_dropped{0};
+	std::uint64_t num_dropped_reported = 0;
+
+	// Guards out and the options, between the writer and open().
+	std::mutex out_m;
+	std::FILE* out = stdout;
+	options opts{};
+	std::uintmax_t out_size = 0;
+
+	std::atomic<bool> stopping{false};
+	std::thread writer;
+
+	bool try_push(ch::system_clock::time_point t, std::string&& line);
+	void write_loop();
+	// Writes all in the buffer. @returns if any was.
+	bool drain();
+	void write_line(ch::system_clock::time_point t, const std::string& line);
+	void rotate();
+	// Stops the writer after it drains the buffer.
+	void stop();
+};
+
+/**
+ * Logs the message and fields at level l, evaluating them only if l is
+ * enabled, so that a disabled message costs nothing to build, e.g.
+ *   UTIL_LOG(log_levels::VERBOSE_2, "fetched", {"url", u.buffer()});
+ */
+#define UTIL_LOG(l, msg, ...) \
+	do { \
+		auto& util_log_l_ = logger::global(); \
+		if (util_log_l_.enabled(l)) \
+			util_log_l_.log( \
+				msg, {__VA_ARGS__}, std::source_location::current() \
+			); \
+	} while (0)
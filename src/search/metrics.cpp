@@ -0,0 +1,329 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the metrics declared in metrics.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "metrics.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+void metric_histogram::observe(ch::nanoseconds d)
+{
+	const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(
+		d.count(), 0
+	));
+	buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+	num.fetch_add(1, std::memory_order_relaxed);
+	sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+	auto old = max_ns.load(std::memory_order_relaxed);
+	while (old < ns && !max_ns.compare_exchange_weak(
+		old, ns, std::memory_order_relaxed
+	));
+}
+
+unsigned metric_histogram::bucket_of(std::uint64_t ns)
+{
+	if (ns < 2 * SUB_COUNT)
+		return static_cast<unsigned>(ns);
+
+	// ns is in [2^e, 2^(e+1)), split into SUB_COUNT buckets.
+	const unsigned e = static_cast<unsigned>(std::bit_width(ns)) - 1;
+	const auto sub = static_cast<unsigned>(ns >> (e - SUB_BITS)) &
+		(SUB_COUNT - 1);
+	return 2 * SUB_COUNT + (e - SUB_BITS - 1) * SUB_COUNT + sub;
+}
+
+std::uint64_t metric_histogram::bucket_max(unsigned b)
+{
+	if (b < 2 * SUB_COUNT)
+		return b;
+
+	const unsigned k = b - 2 * SUB_COUNT;
+	const unsigned e = k / SUB_COUNT + SUB_BITS + 1;
+	const std::uint64_t width = std::uint64_t(1) << (e - SUB_BITS);
+	const std::uint64_t lower = (SUB_COUNT + k % SUB_COUNT) * width;
+	return lower + width - 1;
+}
+
+double metric_histogram::quantile_seconds(double q) const
+{
+	const auto n = count();
+	if (n == 0)
+		return 0.;
+
+	// Nearest rank.
+	const auto rank = static_cast<std::uint64_t>(
+		std::clamp(q, 0., 1.) * double(n - 1)
+	) + 1;
+	std::uint64_t seen = 0;
+	for (unsigned b = 0; b < NUM_BUCKETS; ++b)
+	{
+		seen += buckets[b].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return double(std::min(
+				bucket_max(b), max_ns.load(std::memory_order_relaxed)
+			)) * 1e-9;
+	}
+	return max_seconds();
+}
+
+std::uint64_t metric_histogram::count_below(std::uint64_t ns) const
+{
+	std::uint64_t ret = 0;
+	for (unsigned b = 0; b < NUM_BUCKETS && bucket_max(b) < ns; ++b)
+		ret += buckets[b].load(std::memory_order_relaxed);
+	return ret;
+}
+
+metrics_registry& metrics_registry::global()
+{
+	// Never destroyed, as it is used by the destructors of other statics,
+	// e.g. the indexer's, which commits.
+	static auto* r = new metrics_registry;
+	return *r;
+}
+
+metrics_registry::family& metrics_registry::get_family(
+	std::string_view name, std::string_view help, type t
+) {
+	auto it = families.find(name);
+	if (it == families.end())
+		it = families.emplace(
+			std::string(name), family{t, std::string(help), {}, {}, {}}
+		).first;
+	else if (it->second.t != t)
+		throw std::logic_error(
+			"Metric " + std::string(name) + " has another type."
+		);
+	return it->second;
+}
+
+// @returns the metric of labels in ms, created if there is none.
+template <typename M>
+static M& get_or_make(
+	std::map<std::string, std::unique_ptr<M>>& ms, std::string_view labels
+) {
+	auto& p = ms[std::string(labels)];
+	if (!p)
+		p = std::make_unique<M>();
+	return *p;
+}
+
+metric_counter& metrics_registry::counter(
+	std::string_view name, std::string_view help, std::string_view labels
+) {
+	std::lock_guard lock(m);
+	return get_or_make(
+		get_family(name, help, type::COUNTER).counters, labels
+	);
+}
+
+metric_gauge& metrics_registry::gauge(
+	std::string_view name, std::string_view help, std::string_view labels
+) {
+	std::lock_guard lock(m);
+	return get_or_make(get_family(name, help, type::GAUGE).gauges, labels);
+}
+
+metric_histogram& metrics_registry::histogram(
+	std::string_view name, std::string_view help, std::string_view labels
+) {
+	std::lock_guard lock(m);
+	return get_or_make(
+		get_family(name, help, type::HISTOGRAM).histograms, labels
+	);
+}
+
+metric_histogram& stage_histogram(std::string_view stage)
+{
+	return metrics_registry::global().histogram(
+		"search_stage_seconds", "Time of each stage of a page.",
+		"stage=\"" + std::string(stage) + "\""
+	);
+}
+
+// @returns name{labels}, or name without labels.
+static std::string full_name(
+	const std::string& name, const std::string& labels,
+	const std::string& extra = ""
+) {
+	std::string l = labels;
+	if (!extra.empty())
+		l += (l.empty() ? "" : ",") + extra;
+	return l.empty() ? name : name + "{" + l + "}";
+}
+
+void metrics_registry::write_prometheus(std::ostream& os) const
+{
+	// From 2^10ns, about 1us, to 2^36ns, about 69s.
+	constexpr unsigned MIN_LE_EXP = 10, MAX_LE_EXP = 36;
+
+	std::lock_guard lock(m);
+	for (const auto& [name, f] : families)
+	{
+		os << "# HELP " << name << ' ' << f.help << '\n';
+		switch (f.t)
+		{
+		case type::COUNTER:
+			os << "# TYPE " << name << " counter\n";
+			for (const auto& [l, c] : f.counters)
+				os << full_name(name, l) << ' ' << c->value() << '\n';
+			break;
+		case type::GAUGE:
+			os << "# TYPE " << name << " gauge\n";
+			for (const auto& [l, g] : f.gauges)
+				os << full_name(name, l) << ' ' << g->value() << '\n';
+			break;
+		case type::HISTOGRAM:
+			os << "# TYPE " << name << " histogram\n";
+			for (const auto& [l, h] : f.histograms)
+			{
+				for (unsigned e = MIN_LE_EXP; e <= MAX_LE_EXP; ++e)
+				{
+					const std::uint64_t ns = std::uint64_t(1) << e;
+					char le[32];
+					std::snprintf(
+						le, sizeof(le), "le=\"%.9g\"", double(ns) * 1e-9
+					);
+					os
+						<< full_name(name + "_bucket", l, le) << ' '
+						<< h->count_below(ns) << '\n';
+				}
+				os
+					<< full_name(name + "_bucket", l, "le=\"+Inf\"") << ' '
+					<< h->count() << '\n'
+					<< full_name(name + "_sum", l) << ' '
+					<< h->sum_seconds() << '\n'
+					<< full_name(name + "_count", l) << ' '
+					<< h->count() << '\n';
+			}
+			break;
+		}
+	}
+}
+
+// @returns s quoted as a JSON string.
+static std::string json_str(const std::string& s)
+{
+	std::string ret = "\"";
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+			ret += '\\';
+		ret += c;
+	}
+	return ret + '"';
+}
+
+void metrics_registry::write_json(std::ostream& os) const
+{
+	std::lock_guard lock(m);
+	bool first = true;
+	auto key = [&](const std::string& name, const std::string& l) {
+		os << (first ? "{\n  " : ",\n  ") << json_str(full_name(name, l))
+			<< ": ";
+		first = false;
+	};
+
+	for (const auto& [name, f] : families)
+	{
+		for (const auto& [l, c] : f.counters)
+		{
+			key(name, l);
+			os << c->value();
+		}
+		for (const auto& [l, g] : f.gauges)
+		{
+			key(name, l);
+			os << g->value();
+		}
+		for (const auto& [l, h] : f.histograms)
+		{
+			key(name, l);
+			os
+				<< "{\"count\": " << h->count()
+				<< ", \"sum\": " << h->sum_seconds()
+				<< ", \"p50\": " << h->quantile_seconds(0.5)
+				<< ", \"p90\": " << h->quantile_seconds(0.9)
+				<< ", \"p99\": " << h->quantile_seconds(0.99)
+				<< ", \"max\": " << h->max_seconds() << "}";
+		}
+	}
+	os << (first ? "{}\n" : "\n}\n");
+}
+
+// Writes p with write, atomically.
+template <typename F>
+static void save_atomically(const fs::path& p, F&& write)
+{
+	auto tmp = p;
+	tmp += ".tmp";
+	{
+		std::ofstream ofs(tmp, std::ios::trunc);
+		write(ofs);
+		if (!ofs.flush())
+			throw std::runtime_error("Could not write " + tmp.string());
+	}
+	fs::rename(tmp, p);
+}
+
+void metrics_registry::save(
+	const fs::path& prom_path, const fs::path& json_path
+) const {
+	if (!prom_path.empty())
+		save_atomically(prom_path, [this](std::ostream& os) {
+			write_prometheus(os);
+		});
+	if (!json_path.empty())
+		save_atomically(json_path, [this](std::ostream& os) {
+			write_json(os);
+		});
+}
+
+metrics_exporter::metrics_exporter(
+	const metrics_registry& r, fs::path prom_path, fs::path json_path,
+	ch::seconds interval
+):
+	r(r), prom_path(std::move(prom_path)), json_path(std::move(json_path)),
+	interval(std::max(interval, ch::seconds{1}))
+{
+	t = std::thread([this] {
+		std::unique_lock lock(m);
+		while (!cv.wait_for(lock, this->interval, [this] { return stopping; }))
+			save();
+	});
+}
+
+metrics_exporter::~metrics_exporter()
+{
+	{
+		std::lock_guard lock(m);
+		stopping = true;
+	}
+	cv.notify_all();
+	t.join();
+	save();
+}
+
+void metrics_exporter::save() const
+{
+	// A metrics file that cannot be written must not stop the crawl.
+	try
+	{
+		r.save(prom_path, json_path);
+	}
+	catch (const std::exception& e)
+	{
+		util_log(std::string("Could not save the metrics: ") + e.what());
+	}
+}
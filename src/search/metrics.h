@@ -0,0 +1,226 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the metrics of the crawl: counters, gauges, and latency
+ * histograms kept in a registry, which can be written as a Prometheus
+ * textfile and as JSON, for seeing which stage bounds the throughput.
+ *
+ * @author Guanyuming He
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace ch = std::chrono;
+namespace fs = std::filesystem;
+
+class metric_counter final
+{
+public:
+	inline void inc(std::uint64_t n = 1)
+	{ v.fetch_add(n, std::memory_order_relaxed); }
+	inline std::uint64_t value() const
+	{ return v.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<std::uint64_t> v{0};
+};
+
+class metric_gauge final
+{
+public:
+	inline void set(double x)
+	{ v.store(x, std::memory_order_relaxed); }
+	inline double value() const
+	{ return v.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<double> v{0.};
+};
+
+/**
+ * A histogram of durations, with the buckets of HdrHistogram: below 16ns
+ * each ns has its own, and above, each power of 2 is split into 8, so that
+ * any quantile is off by at most 1/8. Observing is a few atomic adds, and so
+ * it can be done from any thread on every page.
+ */
+class metric_histogram final
+{
+public:
+	static constexpr unsigned SUB_BITS = 3;
+	static constexpr unsigned SUB_COUNT = 1u << SUB_BITS;
+	static constexpr unsigned NUM_BUCKETS =
+		2 * SUB_COUNT + (64 - SUB_BITS - 1) * SUB_COUNT;
+
+	void observe(ch::nanoseconds d);
+
+	std::uint64_t count() const
+	{ return num.load(std::memory_order_relaxed); }
+	double sum_seconds() const
+	{ return double(sum_ns.load(std::memory_order_relaxed)) * 1e-9; }
+	double max_seconds() const
+	{ return double(max_ns.load(std::memory_order_relaxed)) * 1e-9; }
+	/**
+	 * @param q in [0, 1].
+	 * @returns the upper bound of the bucket of the q quantile, or 0 if
+	 * nothing was observed.
+	 */
+	double quantile_seconds(double q) const;
+	// @returns the number of observations < ns.
+	std::uint64_t count_below(std::uint64_t ns) const;
+
+	static unsigned bucket_of(std::uint64_t ns);
+	// @returns the largest value in bucket b.
+	static std::uint64_t bucket_max(unsigned b);
+
+private:
+	std::atomic<std::uint64_t> buckets[NUM_BUCKETS]{};
+	std::atomic<std::uint64_t> num{0};
+	std::atomic<std::uint64_t> sum_ns{0};
+	std::atomic<std::uint64_t> max_ns{0};
+};
+
+// Observes how long it lives into a histogram.
+class metric_timer final
+{
+public:
+	explicit metric_timer(metric_histogram& h):
+		h(h)
+	{}
+	~metric_timer()
+	{ h.observe(ch::steady_clock::now() - start); }
+
+	metric_timer(const metric_timer&) = delete;
+	metric_timer& operator=(const metric_timer&) = delete;
+
+private:
+	metric_histogram& h;
+	const ch::steady_clock::time_point start = ch::steady_clock::now();
+};
+
+/**
+ * Holds the metrics by their names and labels. A metric is created on the
+ * first get of its name and labels, and lives as long as the registry, so
+ * callers can keep the reference instead of looking it up every time.
+ *
+ * Getting is thread safe; so is using the metrics.
+ */
+class metrics_registry final
+{
+public:
+	metrics_registry() = default;
+	metrics_registry(const metrics_registry&) = delete;
+	metrics_registry& operator=(const metrics_registry&) = delete;
+
+	// The registry the components of search_eng record into.
+	static metrics_registry& global();
+
+public:
+	/**
+	 * @param name in the Prometheus convention, e.g. search_pages_total.
+	 * @param help is kept from the first get of name.
+	 * @param labels as they go in the braces, e.g. stage="parse", or "".
+	 *
+	 * @throws std::logic_error if name is already a metric of another type.
+	 */
+	metric_counter& counter(
+		std::string_view name, std::string_view help,
+		std::string_view labels = ""
+	);
+	metric_gauge& gauge(
+		std::string_view name, std::string_view help,
+		std::string_view labels = ""
+	);
+	// Written in seconds, as Prometheus wants.
+	metric_histogram& histogram(
+		std::string_view name, std::string_view help,
+		std::string_view labels = ""
+	);
+
+	/**
+	 * Writes the Prometheus text format. The histogram buckets are at the
+	 * powers of 2 of ns from about 1us to about 1min.
+	 */
+	void write_prometheus(std::ostream& os) const;
+	/**
+	 * Writes an object of name{labels} -> the value of a counter or gauge,
+	 * or {count, sum, p50, p90, p99, max} of a histogram in seconds.
+	 */
+	void write_json(std::ostream& os) const;
+
+	/**
+	 * Writes the formats to the paths, each empty one skipped.
+	 * Each is written to a temporary file renamed over the path, so that a
+	 * reader, e.g. node_exporter's textfile collector, never sees half a
+	 * file.
+	 * @throws std::runtime_error if one cannot be written.
+	 */
+	void save(const fs::path& prom_path, const fs::path& json_path) const;
+
+private:
+	enum class type { COUNTER, GAUGE, HISTOGRAM };
+	struct family
+	{
+		type t;
+		std::string help;
+		// By the labels.
+		std::map<std::string, std::unique_ptr<metric_counter>> counters;
+		std::map<std::string, std::unique_ptr<metric_gauge>> gauges;
+		std::map<std::string, std::unique_ptr<metric_histogram>> histograms;
+	};
+
+	mutable std::mutex m;
+	std::map<std::string, family, std::less<>> families;
+
+	family& get_family(std::string_view name, std::string_view help, type t);
+};
+
+/**
+ * @returns the histogram of the time of a stage of a page in the crawl, i.e.
+ * search_stage_seconds{stage="<stage>"} in the global registry: fetch,
+ * parse, date, filter, links, index, or commit.
+ * Keep the reference, e.g. in a static, as getting it locks the registry.
+ */
+metric_histogram& stage_histogram(std::string_view stage);
+
+/**
+ * Saves a registry every interval on its own thread, and once more when
+ * destroyed, so that the files also have the final values.
+ */
+class metrics_exporter final
+{
+public:
+	metrics_exporter(
+		const metrics_registry& r, fs::path prom_path, fs::path json_path,
+		ch::seconds interval
+	);
+	// Saves the registry for the last time.
+	~metrics_exporter();
+
+	metrics_exporter(const metrics_exporter&) = delete;
+	metrics_exporter& operator=(const metrics_exporter&) = delete;
+
+private:
+	const metrics_registry& r;
+	const fs::path prom_path, json_path;
+	const ch::seconds interval;
+
+	std::mutex m;
+	std::condition_variable cv;
+	bool stopping = false;
+	std::thread t;
+
+	void save() const;
+};
@@ -0,0 +1,138 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the near-duplicate detection declared in near_dup.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "near_dup.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <stdexcept>
+
+// 64 bit FNV-1a, with the finalizer of splitmix64, as FNV alone spreads
+// short inputs poorly over the high bits.
+static std::uint64_t word_hash(std::string_view w)
+{
+	std::uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : w)
+	{
+		h ^= static_cast<unsigned char>(std::tolower(c));
+		h *= 1099511628211ull;
+	}
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebull;
+	return h ^ (h >> 31);
+}
+
+std::optional<std::uint64_t> simhash(std::string_view text)
+{
+	// A word is a run of alphanumerics; the rest, e.g. punctuation, differs
+	// between copies of a story and is ignored.
+	std::vector<std::uint64_t> words;
+	words.reserve(text.size() / 6);
+	size_t i = 0;
+	while (i < text.size())
+	{
+		while (
+			i < text.size() &&
+			!std::isalnum(static_cast<unsigned char>(text[i]))
+		)
+			++i;
+		const size_t b = i;
+		while (
+			i < text.size() &&
+			std::isalnum(static_cast<unsigned char>(text[i]))
+		)
+			++i;
+		if (i > b)
+			words.push_back(word_hash(text.substr(b, i - b)));
+	}
+	if (words.size() < MIN_SIMHASH_WORDS)
+		return std::nullopt;
+
+	std::array<int, 64> votes{};
+	for (size_t w = 0; w + 2 < words.size(); ++w)
+	{
+		// A shingle of 3 words, order sensitive.
+		const std::uint64_t s =
+			words[w] ^ std::rotl(words[w + 1], 21) ^ std::rotl(words[w + 2], 42);
+		for (unsigned b = 0; b < 64; ++b)
+			votes[b] += (s >> b) & 1 ? 1 : -1;
+	}
+
+	std::uint64_t ret = 0;
+	for (unsigned b = 0; b < 64; ++b)
+		if (votes[b] > 0)
+			ret |= std::uint64_t(1) << b;
+	return ret;
+}
+
+near_dup_index::near_dup_index(size_t capacity)
+{
+	if (capacity == 0 || capacity > UINT32_MAX)
+		throw std::invalid_argument("Invalid capacity of near_dup_index.");
+	entries.resize(capacity);
+}
+
+std::optional<std::string> near_dup_index::find(
+	std::uint64_t fp, std::string_view id
+) const {
+	const entry* best = nullptr;
+	unsigned best_dist = MAX_DISTANCE + 1;
+	for (unsigned b = 0; b < NUM_BANDS; ++b)
+	{
+		auto [beg, end] = bands[b].equal_range(band_of(fp, b));
+		for (auto it = beg; it != end; ++it)
+		{
+			const auto& e = entries[it->second];
+			const auto dist = static_cast<unsigned>(std::popcount(e.fp ^ fp));
+			if (dist < best_dist && e.id != id)
+			{
+				best = &e;
+				best_dist = dist;
+			}
+		}
+	}
+
+	if (!best)
+		return std::nullopt;
+	return best->cluster;
+}
+
+void near_dup_index::insert(
+	std::uint64_t fp, std::string id, std::string cluster
+) {
+	const auto i = static_cast<std::uint32_t>(next);
+	if (num == entries.size())
+		erase_bands(i);
+	else
+		++num;
+
+	entries[i] = {fp, std::move(id), std::move(cluster)};
+	for (unsigned b = 0; b < NUM_BANDS; ++b)
+		bands[b].emplace(band_of(fp, b), i);
+	next = (next + 1) % entries.size();
+}
+
+void near_dup_index::erase_bands(std::uint32_t i)
+{
+	const auto fp = entries[i].fp;
+	for (unsigned b = 0; b < NUM_BANDS; ++b)
+	{
+		auto [beg, end] = bands[b].equal_range(band_of(fp, b));
+		for (auto it = beg; it != end; ++it)
+			if (it->second == i)
+			{
+				bands[b].erase(it);
+				break;
+			}
+	}
+}
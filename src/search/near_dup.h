@@ -0,0 +1,91 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the detection of near-duplicate pages, e.g. the same wire
+ * story republished by several outlets under different urls, which
+ * url2hashid() cannot tell apart.
+ *
+ * Each text gets a 64 bit SimHash over its word shingles, so that similar
+ * texts get fingerprints that differ in only a few bits. The fingerprints of
+ * the recent documents are kept in an LSH index of bands, so that a near
+ * one is found without comparing against all of them.
+ *
+ * @author Guanyuming He
+ */
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @returns the SimHash of the 3-word shingles of text, case folded, or
+ * nothing if text has fewer than MIN_SIMHASH_WORDS words, as the fingerprints
+ * of short texts, e.g. an index page, are too alike to mean anything.
+ */
+std::optional<std::uint64_t> simhash(std::string_view text);
+constexpr unsigned MIN_SIMHASH_WORDS = 50u;
+
+/**
+ * The fingerprints of the last capacity documents added.
+ *
+ * A fingerprint is split into NUM_BANDS bands. Two within MAX_DISTANCE bits
+ * must agree on at least one band, so only those sharing a band are compared.
+ *
+ * Not thread safe. The index uses it from the one thread that adds.
+ */
+class near_dup_index final
+{
+public:
+	static constexpr unsigned NUM_BANDS = 4u;
+	static constexpr unsigned BAND_BITS = 64u / NUM_BANDS;
+	// Of the Hamming distance, < NUM_BANDS, so that the bands find them all.
+	static constexpr unsigned MAX_DISTANCE = 3u;
+
+	explicit near_dup_index(size_t capacity);
+
+	/**
+	 * @returns the cluster of the nearest recent fingerprint within
+	 * MAX_DISTANCE of fp, skipping those of id, e.g. an older version of the
+	 * same page.
+	 */
+	std::optional<std::string> find(
+		std::uint64_t fp, std::string_view id
+	) const;
+	/**
+	 * Remembers fp of the document id, in cluster, forgetting the oldest if
+	 * there are capacity already.
+	 */
+	void insert(std::uint64_t fp, std::string id, std::string cluster);
+
+	inline size_t size() const
+	{ return num; }
+
+private:
+	struct entry
+	{
+		std::uint64_t fp;
+		std::string id;
+		std::string cluster;
+	};
+
+	// A ring of the entries, the oldest at next once full.
+	std::vector<entry> entries;
+	size_t next = 0;
+	size_t num = 0;
+
+	// Band value -> index in entries, one map per band.
+	std::unordered_multimap<std::uint32_t, std::uint32_t> bands[NUM_BANDS];
+
+	static inline std::uint32_t band_of(std::uint64_t fp, unsigned b)
+	{
+		return static_cast<std::uint32_t>(
+			(fp >> (b * BAND_BITS)) & ((std::uint64_t(1) << BAND_BITS) - 1)
+		);
+	}
+	void erase_bands(std::uint32_t i);
+};
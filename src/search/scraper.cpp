@@ -8,10 +8,144 @@
  */
 
 #include "scraper.h"
+#include "corpus.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <optional>
 
 void scraper::global_init()
 {
 	curl_global_init(CURL_GLOBAL_ALL);
+
+	if (const char* proxy = std::getenv(REPLAY_PROXY_ENV))
+		replay_proxy = proxy;
+}
+
+void scraper::set_archive(corpus_archiver* a)
+{
+	archive = a;
+}
+
+// @returns the value of the header name of the last response, if any.
+static std::optional<std::string> get_header(CURL* handle, const char* name)
+{
+	curl_header* header;
+	if (CURLHE_OK != curl_easy_header(
+		handle, name, 0, CURLH_HEADER, -1, &header
+	))
+		return std::nullopt;
+
+	return std::string(header->value);
+}
+
+namespace
+{
+	// The metrics of the transfers, shared by all scrapers.
+	struct fetch_metrics
+	{
+		static metric_histogram& phase(const char* p)
+		{
+			return metrics_registry::global().histogram(
+				"search_fetch_phase_seconds",
+				"Time of each phase of a transfer, as reported by curl.",
+				std::string("phase=\"") + p + "\""
+			);
+		}
+		static metric_counter& error(const char* c)
+		{
+			return metrics_registry::global().counter(
+				"search_fetch_errors_total", "Failed transfers by cause.",
+				std::string("class=\"") + c + "\""
+			);
+		}
+		static metric_counter& responses(const char* c)
+		{
+			return metrics_registry::global().counter(
+				"search_http_responses_total", "Responses by status class.",
+				std::string("code=\"") + c + "\""
+			);
+		}
+
+		metric_histogram& dns = phase("dns");
+		metric_histogram& connect = phase("connect");
+		metric_histogram& tls = phase("tls");
+		metric_histogram& transfer = phase("transfer");
+		metric_counter& bytes = metrics_registry::global().counter(
+			"search_fetch_bytes_total", "Bytes of the bodies transferred."
+		);
+
+		metric_counter& err_dns = error("dns");
+		metric_counter& err_connect = error("connect");
+		metric_counter& err_timeout = error("timeout");
+		metric_counter& err_tls = error("tls");
+		metric_counter& err_other = error("other");
+
+		metric_counter* const codes[6] = {
+			&responses("other"), &responses("1xx"), &responses("2xx"),
+			&responses("3xx"), &responses("4xx"), &responses("5xx")
+		};
+
+		static fetch_metrics& get()
+		{
+			static fetch_metrics m;
+			return m;
+		}
+	};
+}
+
+// Records the timings of the last transfer of handle, and its result.
+static void record_transfer(CURL* handle, CURLcode res)
+{
+	auto& m = fetch_metrics::get();
+	switch (res)
+	{
+	case CURLE_OK:
+		break;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_RESOLVE_PROXY:
+		m.err_dns.inc();
+		return;
+	case CURLE_COULDNT_CONNECT:
+		m.err_connect.inc();
+		return;
+	case CURLE_OPERATION_TIMEDOUT:
+		m.err_timeout.inc();
+		return;
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_PEER_FAILED_VERIFICATION:
+		m.err_tls.inc();
+		return;
+	default:
+		m.err_other.inc();
+		return;
+	}
+
+	// All in us, since the start of the transfer.
+	curl_off_t dns = 0, connect = 0, tls = 0, total = 0, size = 0;
+	curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+	curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+	curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+	curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &size);
+
+	using us = ch::microseconds;
+	// A reused connection has no dns, connect, or tls.
+	m.dns.observe(us(dns));
+	m.connect.observe(us(std::max<curl_off_t>(connect - dns, 0)));
+	// 0 without TLS.
+	if (tls > 0)
+		m.tls.observe(us(std::max<curl_off_t>(tls - connect, 0)));
+	m.transfer.observe(us(std::max<curl_off_t>(
+		total - std::max(tls, connect), 0
+	)));
+	m.bytes.inc(static_cast<std::uint64_t>(size));
+
+	long status = 0;
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+	m.codes[status >= 100 && status < 600 ? status / 100 : 0]->inc();
 }
 
 scraper::scraper():
@@ -46,6 +180,9 @@ scraper::scraper():
 	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &writeback);
 	curl_easy_setopt(handle, CURLOPT_WRITEDATA, this);
 
+	if (!replay_proxy.empty())
+		curl_easy_setopt(handle, CURLOPT_PROXY, replay_proxy.c_str());
+
 }
 
 scraper::~scraper()
@@ -58,29 +195,53 @@ std::string scraper::transfer(
 	std::map<std::string, std::string>& headers
 ) const
 {
+	trace_span span("fetch");
 	buffer.clear();
 	// reserves 64KB, an average size of HTML articles of pure text.
 	// This avoids the first few reallocations
 	// and also does not waste much if the website is small.
 	buffer.reserve(64*1024u);
 
-	curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
-	curl_easy_perform(handle);
+	if (replay_proxy.empty())
+		curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+	else
+	{
+		// A proxy can only see the request of plain http.
+		urls::url plain(url);
+		if (plain.scheme_id() == urls::scheme::https)
+			plain.set_scheme_id(urls::scheme::http);
+		curl_easy_setopt(handle, CURLOPT_URL, plain.c_str());
+	}
+	record_transfer(handle, curl_easy_perform(handle));
 
 	// check the headers
-	for (const auto& [k,v] : headers)
+	for (auto& [k,v] : headers)
 	{
-		curl_header* header;
-		auto h = curl_easy_header(
-			handle, k.c_str(), 
-			0, CURLH_HEADER,
-			-1, &header
-		);
+		if (auto h = get_header(handle, k.c_str()))
+			v = std::move(*h);
+	}
 
-		if (CURLHE_OK == h)
-		{
-			headers[k] = std::string(header->value);
-		}
+	// The archive writes on its own thread. Only the copy is made here.
+	if (archive && !buffer.empty())
+	{
+		stored_page p;
+		char* effective = nullptr;
+		if (replay_proxy.empty())
+			curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &effective);
+		p.url = effective ? effective : url.c_str();
+		long status = 0;
+		curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+		p.status = static_cast<std::uint32_t>(status);
+
+		for (const char* name : ARCHIVED_HEADERS)
+			if (auto h = get_header(handle, name))
+				p.headers.emplace(name, std::move(*h));
+		for (const auto& [k,v] : headers)
+			if (!v.empty())
+				p.headers.emplace(k, v);
+
+		p.body = buffer;
+		archive->put(std::move(p));
 	}
 
 	// buffer is no use to me. I relinquish its resource to you.
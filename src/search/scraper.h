@@ -19,6 +19,8 @@ extern "C" {
 #include <boost/url.hpp>
 namespace urls = boost::urls;
 
+class corpus_archiver;
+
 /*
  * Encapsulates a curl handle that does the scraping.
  *
@@ -31,8 +33,29 @@ namespace urls = boost::urls;
 class scraper final 
 {
 public:
-	// Inits libcurl.
+	/**
+	 * Inits libcurl.
+	 *
+	 * If REPLAY_PROXY_ENV is set, e.g. to http://127.0.0.1:8080, all
+	 * transfers go to that replay server (see tools/replay_server.cpp)
+	 * instead of the web, so that crawling can be measured offline. It acts
+	 * as an HTTP proxy, and so https urls are requested as http.
+	 */
 	static void global_init();
+	static constexpr const char* REPLAY_PROXY_ENV = "SEARCH_REPLAY_PROXY";
+
+	/**
+	 * Makes all scrapers tee each response they transfer, i.e. the final url
+	 * after redirects, the status, the ARCHIVED_HEADERS, and the body, into
+	 * a, or stop doing so if nullptr.
+	 * Set it before scraping starts. a must outlive the scraping.
+	 */
+	static void set_archive(corpus_archiver* a);
+
+	// Headers kept in the archive, besides those the caller asks for.
+	static constexpr const char* ARCHIVED_HEADERS[] {
+		"date", "last-modified", "content-type", "content-language"
+	};
 
 public:
 	scraper();
@@ -87,5 +110,9 @@ private:
 
 	CURL* handle;
 
+	inline static corpus_archiver* archive = nullptr;
+	// From REPLAY_PROXY_ENV, or empty.
+	inline static std::string replay_proxy;
+
 };
 
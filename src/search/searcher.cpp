@@ -7,62 +7,275 @@
  */
 
 #include "searcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <string_view>
+
 #include <xapian.h>
 
+// Parses YYYY-MM-DD or YYYYMMDD.
+static std::optional<ch::year_month_day> parse_range_date(std::string_view s)
+{
+	std::string digits;
+	if (s.size() == 10 && s[4] == '-' && s[7] == '-')
+		digits.append(s.substr(0, 4))
+			.append(s.substr(5, 2))
+			.append(s.substr(8, 2));
+	else if (s.size() == 8)
+		digits = s;
+	else
+		return std::nullopt;
+
+	for (char c : digits)
+		if (c < '0' || c > '9')
+			return std::nullopt;
+
+	return index::date_from_value(digits);
+}
+
+xp::Query date_bucket_rp::operator()(
+	const std::string& begin, const std::string& end
+) {
+	if (use_terms)
+	{
+		auto b = parse_range_date(begin), e = parse_range_date(end);
+		if (b && e)
+			return index::date_range_query(*b, *e);
+	}
+
+	return xp::DateRangeProcessor::operator()(begin, end);
+}
+
+freshness_source::freshness_source(
+	double now_days, double half_life, double max_weight
+):
+	xp::ValuePostingSource(index::DAYS_SLOT),
+	now_days(now_days), half_life(half_life), max_weight(max_weight)
+{}
+
+double freshness_source::weight_of(double days) const
+{
+	double age = std::max(0., now_days - days);
+	return max_weight * std::exp2(-age / half_life);
+}
+
+double freshness_source::get_weight() const
+{
+	return weight_of(xp::sortable_unserialise(get_value()));
+}
+
+freshness_source* freshness_source::clone() const
+{
+	return new freshness_source(now_days, half_life, max_weight);
+}
+
+std::string freshness_source::name() const
+{
+	return "freshness_source";
+}
+
+void freshness_source::init(const xp::Database& db)
+{
+	xp::ValuePostingSource::init(db);
+
+	// The latest document bounds the weight, which lets the matcher skip
+	// more when the whole db is old.
+	auto ub = db.get_value_upper_bound(index::DAYS_SLOT);
+	set_maxweight(
+		ub.empty() ? 0. : weight_of(xp::sortable_unserialise(ub))
+	);
+}
+
 searcher::searcher(
 	const fs::path& dbpath, const query_params& par
 ):
-	db(dbpath.string()), g_pars(par),
-	daterp(index::DATE_SLOT)
+	db(dbpath.string()), g_pars(par)
 {
 	apply_def_params();
 	setup_qparser();
+	open_text_store(dbpath);
 }
 
 searcher::searcher(
 	class index& inddb, const query_params& par
 ):
-	db(inddb.db), g_pars(par),
-	daterp(index::DATE_SLOT)
-
+	db(inddb.db), g_pars(par)
 {
 	apply_def_params();
 	setup_qparser();
+	open_text_store(inddb.dbpath);
 }
 
 void searcher::apply_def_params()
 {
 	if (!g_pars.max_num_results.has_value())
 		g_pars.max_num_results = DEF_MAX_RESULTS;
+	if (!g_pars.time_limit.has_value())
+		g_pars.time_limit = DEF_TIME_LIMIT;
+	if (!g_pars.check_at_least.has_value())
+		g_pars.check_at_least = DEF_CHECK_AT_LEAST;
+	if (!g_pars.percent_cutoff.has_value())
+		g_pars.percent_cutoff = DEF_PERCENT_CUTOFF;
+	if (!g_pars.weight_cutoff.has_value())
+		g_pars.weight_cutoff = DEF_WEIGHT_CUTOFF;
+	if (!g_pars.order.has_value())
+		g_pars.order = DEF_ORDER;
+	if (!g_pars.collapse.has_value())
+		g_pars.collapse = DEF_COLLAPSE;
+	if (!g_pars.half_life.has_value())
+		g_pars.half_life = DEF_HALF_LIFE;
+	if (!g_pars.freshness_weight.has_value())
+		g_pars.freshness_weight = DEF_FRESHNESS_WEIGHT;
 }
 
 void searcher::setup_qparser()
 {
-    qparser.set_stemmer(Xapian::Stem("en"));
-    qparser.set_stemming_strategy(qparser.STEM_SOME);
+	// Queries must be turned into terms the same way as the documents.
+	const auto& prof = index::profile_of(db);
+
+    qparser.set_stemmer(stemmer);
+    qparser.set_stemming_strategy(prof.query_stemming());
     qparser.add_prefix("title", "S");
     qparser.add_prefix("description", "XD");
 
+	filter = std::make_unique<term_filter>(prof);
+	if (filter->active())
+		qparser.set_stopper(filter.get());
+
+	// A phrase can then only match the titles. Rather search its words.
+	if (!prof.text_positions)
+		parse_flags &= ~unsigned(xp::QueryParser::FLAG_PHRASE);
+
+	// Without the unprefixed terms, free text must search both fields.
+	if (prof.schema == index::schema::SINGLE)
+	{
+		qparser.add_prefix("", "S");
+		qparser.add_prefix("", "XD");
+	}
+
 	// Do not create a temp daterp here.
 	// @see the comment before daterp.
+	daterp.use_terms = index::has_date_terms(db);
     qparser.add_rangeprocessor(&daterp);
 } 
 
-xp::MSet searcher::query(
+void searcher::open_text_store(const fs::path& dbpath)
+{
+	if (text_store::exists(dbpath))
+		texts = std::make_unique<text_store>(dbpath, false);
+}
+
+searcher::query_result searcher::query(
 	const std::string& q, const query_params& par
 ) {
-	xp::Query xq(qparser.parse_query(q));
+	xp::Query xq(qparser.parse_query(q, parse_flags));
 
 	xp::Enquire enq(db);
-	enq.set_query(xq);
 
 	// Local par overrides global g_par,
 	// if it's value is set.
 	//
 	// g_pars is guaranteed always set.
-	auto max_res = par.max_num_results ?
-		par.max_num_results.value() : g_pars.max_num_results.value();
+	auto max_res = par.max_num_results.value_or(
+		g_pars.max_num_results.value()
+	);
+	auto time_limit = par.time_limit.value_or(
+		g_pars.time_limit.value()
+	);
+	auto check_at_least = par.check_at_least.value_or(
+		g_pars.check_at_least.value()
+	);
+	auto percent_cutoff = par.percent_cutoff.value_or(
+		g_pars.percent_cutoff.value()
+	);
+	auto weight_cutoff = par.weight_cutoff.value_or(
+		g_pars.weight_cutoff.value()
+	);
+	auto order = par.order.value_or(
+		g_pars.order.value()
+	);
+	auto collapse = par.collapse.value_or(
+		g_pars.collapse.value()
+	);
+
+	switch (order)
+	{
+	case query_params::ordering::RELEVANCE:
+		break;
+	case query_params::ordering::DATE:
+		// YYYYMMDD sorts as well as DAYS_SLOT, and all docs have it.
+		enq.set_sort_by_value_then_relevance(index::DATE_SLOT, true);
+		break;
+	case query_params::ordering::BLENDED:
+	{
+		auto now_days = double(
+			ch::floor<ch::days>(ch::system_clock::now())
+				.time_since_epoch().count()
+		);
+		auto fresh = new freshness_source(
+			now_days,
+			par.half_life.value_or(g_pars.half_life.value()),
+			par.freshness_weight.value_or(g_pars.freshness_weight.value())
+		);
+		// Only the documents matching xq, with the freshness added to
+		// their weights. The query owns the source once released.
+		xq = xp::Query(
+			xp::Query::OP_AND_MAYBE, xq, xp::Query(fresh->release())
+		);
+		break;
+	}
+	}
+	enq.set_query(xq);
+
+	// The matcher keeps only the best of each cluster as it goes, so the
+	// max_res results are of max_res distinct stories.
+	if (collapse)
+		enq.set_collapse_key(index::CLUSTER_SLOT);
+
+	if (time_limit > 0.)
+		enq.set_time_limit(time_limit);
+	if (percent_cutoff > 0 || weight_cutoff > 0.)
+		enq.set_cutoff(percent_cutoff, weight_cutoff);
+
+	auto start = std::chrono::steady_clock::now();
+	query_result res{enq.get_mset(0, max_res, check_at_least)};
+	std::chrono::duration<double> elapsed = 
+		std::chrono::steady_clock::now() - start;
+
+	// Xapian does not tell whether the time limit was hit. Had the matcher
+	// considered check_at_least documents, it would have counted at least
+	// that many matches, or all of them, exactly. So it was cut short if
+	// the limit elapsed and the count is still a loose estimate below that.
+	const auto& m = res.mset;
+	res.truncated =
+		time_limit > 0. && elapsed.count() >= time_limit &&
+		check_at_least > max_res &&
+		m.get_matches_lower_bound() < std::min<xp::doccount>(
+			check_at_least, m.get_matches_upper_bound()
+		);
+
+	return res;
+}
+
+std::optional<std::string> searcher::snippet(
+	const xp::MSet& mset, const xp::Document& doc,
+	size_t length
+) const {
+	if (!texts)
+		return std::nullopt;
+
+	auto loc = doc.get_value(index::TEXT_SLOT);
+	if (loc.empty())
+		return std::nullopt;
 
-	xp::MSet mset(enq.get_mset(0, max_res));
-	return mset;
+	// The snippets are for humans and LLMs, not HTML,
+	// so highlight with markdown's bold.
+	return mset.snippet(
+		texts->get(loc), length, stemmer,
+		xp::MSet::SNIPPET_BACKGROUND_MODEL | xp::MSet::SNIPPET_EXHAUSTIVE,
+		"**", "**", "..."
+	);
 }
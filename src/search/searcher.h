@@ -10,9 +10,65 @@
  */
 
 #include "index.h"
+#include "text_store.h"
+
+#include <memory>
 
 #include <xapian.h>
 
+/**
+ * Rewrites the date ranges of queries into the date bucket terms (see
+ * index.h), so that filtering by date intersects posting lists instead of
+ * checking the value of each candidate.
+ *
+ * Falls back to the plain DateRangeProcessor for open ranges, dates it
+ * cannot parse, or dbs without the terms.
+ */
+class date_bucket_rp final : public xp::DateRangeProcessor
+{
+public:
+	// @param use_terms true iff the db has the date terms.
+	explicit date_bucket_rp(bool use_terms = false) :
+		xp::DateRangeProcessor(index::DATE_SLOT),
+		use_terms(use_terms)
+	{}
+
+	xp::Query operator()(
+		const std::string& begin, const std::string& end
+	) override;
+
+	bool use_terms;
+};
+
+/**
+ * Gives each document a weight that decays exponentially with its age, read
+ * from DAYS_SLOT, so that the matcher can prefer fresh documents itself.
+ * Documents without the value get nothing.
+ */
+class freshness_source final : public xp::ValuePostingSource
+{
+public:
+	/**
+	 * @param now_days days since the epoch of now.
+	 * @param half_life in days, after which the weight halves.
+	 * @param max_weight of a document dated now or later.
+	 */
+	freshness_source(double now_days, double half_life, double max_weight);
+
+	double get_weight() const override;
+	freshness_source* clone() const override;
+	std::string name() const override;
+	void init(const xp::Database& db) override;
+
+private:
+	double now_days;
+	double half_life;
+	double max_weight;
+
+	// @returns the weight of a document dated days.
+	double weight_of(double days) const;
+};
+
 /**
  * A searcher seaches a database using text queries.
  *
@@ -37,9 +93,81 @@ public:
 		query_params(const query_params&) = default;
 		
 		std::optional<unsigned> max_num_results{};
+
+		/**
+		 * Latency budget of check_at_least, in seconds. 0 means no limit.
+		 * The matcher always finds the best max_num_results, but
+		 * check_at_least may make it consider many more documents, e.g.
+		 * for exact match counts. Once the limit is reached, Xapian stops
+		 * doing so, as if check_at_least were max_num_results. So it only
+		 * has an effect with a larger check_at_least.
+		 */
+		std::optional<double> time_limit{};
+		/**
+		 * The minimum number of documents the matcher must consider,
+		 * passed as get_mset()'s checkatleast. Larger values make the
+		 * match count estimates more accurate at the cost of latency.
+		 */
+		std::optional<unsigned> check_at_least{};
+		/**
+		 * Matches below this relevance percentage (0--100) or below this
+		 * weight are not returned. Both 0 mean no cutoff.
+		 * Cutoffs also let the matcher terminate early.
+		 */
+		std::optional<int> percent_cutoff{};
+		std::optional<double> weight_cutoff{};
+
+		/**
+		 * How the results are ordered:
+		 * RELEVANCE: by BM25 only.
+		 * DATE: latest first, ties broken by relevance.
+		 * BLENDED: by BM25 plus a freshness weight that halves every
+		 * half_life days, up to freshness_weight for documents of today.
+		 */
+		enum class ordering : unsigned { RELEVANCE, DATE, BLENDED };
+		std::optional<ordering> order{};
+		std::optional<double> half_life{};
+		std::optional<double> freshness_weight{};
+
+		/**
+		 * If true, only the best document of each cluster of
+		 * near-duplicates (index::CLUSTER_SLOT) is returned, e.g. one
+		 * report of a syndicated story. get_collapse_count() of its
+		 * MSetIterator is then a lower bound of the others collapsed into
+		 * it. Documents without a cluster are never collapsed.
+		 */
+		std::optional<bool> collapse{};
+	};
+
+	/**
+	 * The result of a query.
+	 * If truncated is true, the mset still has the best matches, but its
+	 * match counts are estimates, as fewer than check_at_least documents
+	 * were considered.
+	 */
+	struct query_result
+	{
+		xp::MSet mset;
+		// true iff the time limit cut check_at_least short.
+		bool truncated = false;
 	};
 
 	static constexpr unsigned DEF_MAX_RESULTS = 64u;
+	static constexpr double DEF_TIME_LIMIT = 0.;
+	static constexpr unsigned DEF_CHECK_AT_LEAST = 0u;
+	static constexpr int DEF_PERCENT_CUTOFF = 0;
+	static constexpr double DEF_WEIGHT_CUTOFF = 0.;
+	static constexpr auto DEF_ORDER = query_params::ordering::RELEVANCE;
+	// In days.
+	static constexpr double DEF_HALF_LIFE = 7.;
+	// About the weight of a term of average rarity in BM25, so that
+	// freshness is a tie breaker among similarly relevant documents rather
+	// than drowning the relevance.
+	static constexpr double DEF_FRESHNESS_WEIGHT = 2.;
+	static constexpr bool DEF_COLLAPSE = false;
+
+	// In bytes.
+	static constexpr size_t DEF_SNIPPET_LENGTH = 500u;
 
 public:	
 	explicit searcher(
@@ -57,15 +185,33 @@ public:
 	 * @param Parameters for this query only. Will override the global
 	 * parameters.
 	 *
-	 * @returns a Mset of matches.
+	 * @returns a Mset of matches, and whether its counts are
+	 * truncated by the time limit.
 	 */
-	xp::MSet query(
+	query_result query(
 		const std::string& q, const query_params& par = {}
 	);
 
+	/**
+	 * @param mset returned by query().
+	 * @param doc a document in mset.
+	 * @param length max length of the snippet in bytes.
+	 *
+	 * @returns a snippet of doc's text, selected and highlighted by the
+	 * query of mset, or nothing if the text is not stored.
+	 */
+	std::optional<std::string> snippet(
+		const xp::MSet& mset, const xp::Document& doc,
+		size_t length = DEF_SNIPPET_LENGTH
+	) const;
+
 private: 
 	xp::Database db;
 	xp::QueryParser qparser;
+	xp::Stem stemmer{"en"};
+
+	// nullptr if the db does not keep the texts.
+	std::unique_ptr<text_store> texts;
 	
 	/**
 	 * As it turned out, despite its having a release() function
@@ -76,7 +222,11 @@ private:
 	 * uncover, just because its API mislead me into thinking it's a handle 
 	 * and would be copied.
 	 */
-	xp::DateRangeProcessor daterp;
+	date_bucket_rp daterp;
+	// Stops the same words as the index did. A member for the same reason.
+	std::unique_ptr<term_filter> filter;
+	// Flags of parse_query(), decided by the db's profile.
+	unsigned parse_flags = xp::QueryParser::FLAG_DEFAULT;
 
 	query_params g_pars;
 
@@ -88,4 +238,5 @@ private:
 	void apply_def_params();
 
 	void setup_qparser();
+	void open_text_store(const fs::path& dbpath);
 };
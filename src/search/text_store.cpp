@@ -0,0 +1,465 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the class text_store.
+ *
+ * @author Guanyuming He
+ */
+
+#include "text_store.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <zdict.h>
+#include <zstd.h>
+
+// Writes all of [p, p + n) to fd.
+static void write_all(int fd, const char* p, size_t n)
+{
+	while (n != 0)
+	{
+		auto w = ::write(fd, p, n);
+		if (w < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Cannot write to the text store.");
+		}
+		p += w;
+		n -= static_cast<size_t>(w);
+	}
+}
+
+text_store::text_store(
+	const fs::path& dir, bool writable, std::uint32_t gen
+):
+	dir(dir), writable(writable)
+{
+	if (writable)
+	{
+		// Those of an older generation, or of a newer one whose compaction
+		// was not committed.
+		for (const auto& e : fs::directory_iterator(dir))
+			if (auto g = gen_of(e.path().filename().string()); g && *g != gen)
+				fs::remove(e.path());
+	}
+	else
+	{
+		gen = 0;
+		for (const auto& e : fs::directory_iterator(dir))
+			if (auto g = gen_of(e.path().filename().string()); g && *g > gen)
+				gen = *g;
+	}
+	open_gen(gen);
+
+	cctx = ZSTD_createCCtx();
+	dctx = ZSTD_createDCtx();
+
+	load_dict();
+	if (writable && !dict.empty())
+		cdict = ZSTD_createCDict(dict.data(), dict.size(), COMPRESSION_LEVEL);
+	if (writable && dict.empty())
+		load_samples();
+}
+
+text_store::~text_store()
+{
+	close_gen();
+
+	ZSTD_freeCDict(cdict);
+	ZSTD_freeDDict(ddict);
+	ZSTD_freeCCtx(cctx);
+	ZSTD_freeDCtx(dctx);
+}
+
+bool text_store::exists(const fs::path& dir)
+{
+	if (!fs::is_directory(dir))
+		return false;
+	for (const auto& e : fs::directory_iterator(dir))
+		if (gen_of(e.path().filename().string()))
+			return true;
+	return false;
+}
+
+void text_store::copy(
+	const fs::path& from, const fs::path& to, std::uint32_t gen
+) {
+	fs::copy_file(path_of(from, gen), path_of(to, gen));
+	if (fs::exists(from / DICT_FILE_NAME))
+		fs::copy_file(from / DICT_FILE_NAME, to / DICT_FILE_NAME);
+}
+
+fs::path text_store::path_of(const fs::path& dir, std::uint32_t gen)
+{
+	// Generation 0 is the file of the stores from before the compaction.
+	if (gen == 0)
+		return dir / FILE_NAME;
+	return dir / (std::string(FILE_NAME) + '.' + std::to_string(gen));
+}
+
+std::optional<std::uint32_t> text_store::gen_of(const std::string& name)
+{
+	const std::string_view n(name), f(FILE_NAME);
+	if (n == f)
+		return 0u;
+	if (!n.starts_with(f) || n.size() < f.size() + 2 || n[f.size()] != '.')
+		return std::nullopt;
+
+	std::uint32_t ret = 0;
+	for (char c : n.substr(f.size() + 1))
+	{
+		if (c < '0' || c > '9')
+			return std::nullopt;
+		ret = ret * 10 + static_cast<std::uint32_t>(c - '0');
+	}
+	return ret;
+}
+
+void text_store::open_gen(std::uint32_t g) const
+{
+	close_gen();
+
+	auto path = path_of(dir, g);
+	fd = writable ?
+		::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644) :
+		::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error(
+			"Cannot open text store: " + path.string()
+		);
+
+	struct stat st;
+	if (0 != ::fstat(fd, &st))
+	{
+		close_gen();
+		throw std::runtime_error(
+			"Cannot stat text store: " + path.string()
+		);
+	}
+	gen = g;
+	file_size = static_cast<std::uint64_t>(st.st_size);
+}
+
+void text_store::close_gen() const
+{
+	unmap();
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+}
+
+void text_store::load_dict() const
+{
+	std::ifstream ifs(dir / DICT_FILE_NAME, std::ios::binary);
+	if (!ifs)
+		return;
+
+	dict.assign(
+		std::istreambuf_iterator<char>(ifs),
+		std::istreambuf_iterator<char>()
+	);
+	dict_id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+	ZSTD_freeDDict(ddict);
+	ddict = ZSTD_createDDict(dict.data(), dict.size());
+}
+
+void text_store::load_samples()
+{
+	for (
+		std::uint64_t off = 0;
+		off < file_size && samples.size() < NUM_DICT_SAMPLES;
+	) {
+		const auto h = read_header(off);
+		if (h.dict_id == 0)
+			samples.push_back(get(make_loc(off, gen)));
+		off += sizeof(h) + h.comp_size;
+	}
+}
+
+void text_store::train_dict()
+{
+	std::string all;
+	std::vector<size_t> sizes;
+	sizes.reserve(samples.size());
+	for (const auto& s : samples)
+	{
+		all.append(s);
+		sizes.push_back(s.size());
+	}
+
+	std::vector<char> new_dict(DICT_CAPACITY);
+	auto res = ZDICT_trainFromBuffer(
+		new_dict.data(), new_dict.size(),
+		all.data(), sizes.data(), static_cast<unsigned>(sizes.size())
+	);
+
+	samples.clear();
+	samples.shrink_to_fit();
+
+	// Training may fail if the samples are too few or too small.
+	// Then just go on without a dictionary.
+	if (ZDICT_isError(res))
+		return;
+
+	// Write to a tmp file first, so that a crash in the middle will not
+	// leave a broken dictionary that makes later records unreadable.
+	auto tmp_path = dir / (std::string(DICT_FILE_NAME) + ".tmp");
+	{
+		std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			return;
+		ofs.write(new_dict.data(), static_cast<std::streamsize>(res));
+		if (!ofs)
+			return;
+	}
+	fs::rename(tmp_path, dir / DICT_FILE_NAME);
+
+	load_dict();
+	cdict = ZSTD_createCDict(dict.data(), dict.size(), COMPRESSION_LEVEL);
+}
+
+std::string text_store::put(std::string_view text)
+{
+	if (!writable)
+		throw std::runtime_error("The text store is read only.");
+
+	// Collect samples until the dictionary is trained.
+	if (!cdict && dict.empty())
+	{
+		samples.emplace_back(text);
+		if (samples.size() >= NUM_DICT_SAMPLES)
+			train_dict();
+	}
+
+	comp_buf.resize(
+		sizeof(record_header) + ZSTD_compressBound(text.size())
+	);
+	char* dst = comp_buf.data() + sizeof(record_header);
+	size_t dst_cap = comp_buf.size() - sizeof(record_header);
+
+	size_t comp_size = cdict ?
+		ZSTD_compress_usingCDict(
+			cctx, dst, dst_cap, text.data(), text.size(), cdict
+		) :
+		ZSTD_compressCCtx(
+			cctx, dst, dst_cap, text.data(), text.size(), COMPRESSION_LEVEL
+		);
+	if (ZSTD_isError(comp_size))
+		throw std::runtime_error(
+			std::string("zstd compression failed: ") +
+			ZSTD_getErrorName(comp_size)
+		);
+
+	record_header h {
+		static_cast<std::uint32_t>(text.size()),
+		static_cast<std::uint32_t>(comp_size),
+		cdict ? dict_id : 0u
+	};
+	std::memcpy(comp_buf.data(), &h, sizeof(h));
+
+	const size_t rec_size = sizeof(h) + comp_size;
+	write_all(fd, comp_buf.data(), rec_size);
+
+	auto loc = make_loc(file_size, gen);
+	file_size += rec_size;
+	return loc;
+}
+
+std::pair<std::uint64_t, std::uint32_t> text_store::parse_loc(
+	std::string_view loc
+) {
+	// The offset, then the generation if it is not 0, so that the
+	// locations of the stores from before the compaction stay valid.
+	std::uint64_t offset;
+	std::uint32_t g = 0;
+	if (
+		loc.size() != sizeof(offset) &&
+		loc.size() != sizeof(offset) + sizeof(g)
+	)
+		throw std::runtime_error("Invalid text store location.");
+	std::memcpy(&offset, loc.data(), sizeof(offset));
+	if (loc.size() != sizeof(offset))
+		std::memcpy(&g, loc.data() + sizeof(offset), sizeof(g));
+	return {offset, g};
+}
+
+std::string text_store::make_loc(std::uint64_t offset, std::uint32_t gen)
+{
+	std::string ret(sizeof(offset) + (gen != 0 ? sizeof(gen) : 0), '\0');
+	std::memcpy(ret.data(), &offset, sizeof(offset));
+	if (gen != 0)
+		std::memcpy(ret.data() + sizeof(offset), &gen, sizeof(gen));
+	return ret;
+}
+
+text_store::record_header text_store::read_header(std::uint64_t offset) const
+{
+	record_header h;
+	map_until(offset + sizeof(h));
+	std::memcpy(&h, map + offset, sizeof(h));
+	map_until(offset + sizeof(h) + h.comp_size);
+	return h;
+}
+
+std::string text_store::get(std::string_view loc) const
+{
+	const auto [offset, g] = parse_loc(loc);
+	if (g != gen)
+	{
+		// Only a reader may lag behind the db.
+		if (writable)
+			throw std::runtime_error(
+				"Text store location of another generation."
+			);
+		open_gen(g);
+	}
+
+	const auto h = read_header(offset);
+	// A reader opened before the dictionary was trained.
+	if (h.dict_id != 0 && h.dict_id != dict_id)
+		load_dict();
+	if (h.dict_id != 0 && h.dict_id != dict_id)
+		throw std::runtime_error(
+			"The text store dictionary does not match the record."
+		);
+
+	std::string ret(h.raw_size, '\0');
+	const char* src = map + offset + sizeof(h);
+	size_t res = h.dict_id != 0 ?
+		ZSTD_decompress_usingDDict(
+			dctx, ret.data(), ret.size(), src, h.comp_size, ddict
+		) :
+		ZSTD_decompressDCtx(
+			dctx, ret.data(), ret.size(), src, h.comp_size
+		);
+	if (ZSTD_isError(res) || res != h.raw_size)
+		throw std::runtime_error("Corrupted text store record.");
+
+	return ret;
+}
+
+void text_store::sync()
+{
+	if (writable)
+		::fdatasync(fd);
+}
+
+std::uintmax_t text_store::size_on_disk() const
+{
+	std::uintmax_t ret = file_size;
+	if (fs::exists(dir / DICT_FILE_NAME))
+		ret += fs::file_size(dir / DICT_FILE_NAME);
+	return ret;
+}
+
+double text_store::garbage_ratio(const std::vector<std::string>& live) const
+{
+	if (file_size == 0)
+		return 0.;
+
+	std::uint64_t live_size = 0;
+	for (const auto& l : live)
+	{
+		const auto [offset, g] = parse_loc(l);
+		if (g == gen)
+			live_size += sizeof(record_header) + read_header(offset).comp_size;
+	}
+	return 1. - double(live_size) / double(file_size);
+}
+
+std::vector<std::string> text_store::compact(
+	const std::vector<std::string>& live
+) {
+	if (!writable)
+		throw std::runtime_error("The text store is read only.");
+
+	const auto next = gen + 1;
+	const auto path = path_of(dir, next);
+	const int out = ::open(
+		path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644
+	);
+	if (out < 0)
+		throw std::runtime_error("Cannot open text store: " + path.string());
+
+	std::vector<std::string> ret;
+	ret.reserve(live.size());
+	std::uint64_t off = 0;
+	try
+	{
+		for (const auto& l : live)
+		{
+			const auto [offset, g] = parse_loc(l);
+			if (g != gen)
+				throw std::runtime_error(
+					"Text store location of another generation."
+				);
+
+			// Copied as they are, still compressed.
+			const auto h = read_header(offset);
+			const size_t rec_size = sizeof(h) + h.comp_size;
+			write_all(out, map + offset, rec_size);
+			ret.push_back(make_loc(off, next));
+			off += rec_size;
+		}
+		if (0 != ::fdatasync(out))
+			throw std::runtime_error("Cannot sync the text store.");
+	}
+	catch (...)
+	{
+		::close(out);
+		fs::remove(path);
+		throw;
+	}
+	::close(out);
+	return ret;
+}
+
+void text_store::commit_compaction()
+{
+	const auto old = path_of(dir, gen);
+	open_gen(gen + 1);
+	fs::remove(old);
+}
+
+void text_store::map_until(std::uint64_t end) const
+{
+	if (end <= map_size)
+		return;
+
+	// The file may have grown since it was mapped, by me or by a writer in
+	// another process.
+	struct stat st;
+	if (0 != ::fstat(fd, &st) || static_cast<std::uint64_t>(st.st_size) < end)
+		throw std::runtime_error("Text store location out of range.");
+
+	unmap();
+	void* p = ::mmap(
+		nullptr, static_cast<size_t>(st.st_size),
+		PROT_READ, MAP_SHARED, fd, 0
+	);
+	if (MAP_FAILED == p)
+		throw std::runtime_error("Cannot mmap the text store.");
+
+	map = static_cast<const char*>(p);
+	map_size = static_cast<std::uint64_t>(st.st_size);
+}
+
+void text_store::unmap() const
+{
+	if (map)
+		::munmap(const_cast<char*>(map), static_cast<size_t>(map_size));
+	map = nullptr;
+	map_size = 0;
+}
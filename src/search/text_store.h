@@ -0,0 +1,206 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the class text_store, an optional side store of the
+ * extracted text of indexed documents.
+ *
+ * I don't store the full text in the Xapian database, as that makes it too
+ * large. However, without the text, the searcher cannot generate real
+ * snippets. News articles are very similar to each other, so they compress
+ * very well with a shared zstd dictionary trained on some of them. This store
+ * does exactly that, in a separate file that can be mmapped by the searcher.
+ *
+ * @author Guanyuming He
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Forward decl of zstd types.
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+/**
+ * The store consists of two files in a directory (usually the db's):
+ * 1. text_store, or text_store.<generation> after it is compacted, which is
+ * append only:
+ *   <record>*
+ *
+ *   record:
+ *   <uint32_t raw size> <uint32_t compressed size> <uint32_t dict id>
+ *   <compressed bytes>
+ *
+ * 2. text_store.dict, the shared dictionary.
+ * It is absent at first. The first NUM_DICT_SAMPLES texts are compressed
+ * without it (dict id 0), and are the samples it is trained on, so that
+ * they are read back if the store is reopened before. Then, the dictionary
+ * is trained and used for all the texts after.
+ *
+ * A record is located by its offset in the file and the generation of the
+ * file. The location is returned by put() as an opaque string, so that the
+ * caller can store it (e.g. as a Xapian value) and later give it back to
+ * get(). A reader follows the locations to a newer generation or dictionary
+ * when it meets them.
+ *
+ * When a document is deleted from the database, its text stays as garbage
+ * until compact() copies the others into the next generation.
+ */
+class text_store final
+{
+public:
+	static constexpr const char* FILE_NAME = "text_store";
+	static constexpr const char* DICT_FILE_NAME = "text_store.dict";
+
+	// Number of texts the dictionary is trained on.
+	static constexpr unsigned NUM_DICT_SAMPLES = 1000u;
+	// zstd recommends ~100KB dictionaries.
+	static constexpr size_t DICT_CAPACITY = 110u * 1024u;
+	static constexpr int COMPRESSION_LEVEL = 6;
+
+public:
+	text_store() = delete;
+	/**
+	 * @param dir where the store files are.
+	 * @param writable if false, the store is only read from and must exist.
+	 * @param gen the generation to append to, as recorded with the
+	 * locations, if writable. The files of the others are removed, e.g.
+	 * those of a compaction that was not committed. A reader starts with
+	 * the latest.
+	 * @throws std::runtime_error if the files cannot be opened or created.
+	 */
+	text_store(const fs::path& dir, bool writable, std::uint32_t gen = 0);
+	~text_store();
+
+	// Owns file descriptors and mappings.
+	text_store(const text_store&) = delete;
+	text_store& operator=(const text_store&) = delete;
+
+	// @returns true iff a store is in dir.
+	static bool exists(const fs::path& dir);
+	// @returns the file of generation gen of the store in dir.
+	static fs::path path_of(const fs::path& dir, std::uint32_t gen);
+	/**
+	 * Copies the file of generation gen and the dictionary, if any, of the
+	 * store in from to to, where the locations of gen stay valid.
+	 * @throws fs::filesystem_error if they cannot be copied.
+	 */
+	static void copy(
+		const fs::path& from, const fs::path& to, std::uint32_t gen
+	);
+
+public:
+	/**
+	 * Compresses and appends text to the store.
+	 * @returns the location of the text in the store.
+	 */
+	std::string put(std::string_view text);
+
+	/**
+	 * @param loc returned by put().
+	 * @returns the text at loc.
+	 * @throws std::runtime_error if loc is not a valid location.
+	 */
+	std::string get(std::string_view loc) const;
+
+	// Makes everything put() durable.
+	void sync();
+
+	// @returns the number of bytes of the store files.
+	std::uintmax_t size_on_disk() const;
+
+	inline std::uint32_t generation() const
+	{ return gen; }
+	/**
+	 * @param live the locations of all the texts still used.
+	 * @returns the fraction of the current file that is not theirs.
+	 */
+	double garbage_ratio(const std::vector<std::string>& live) const;
+	/**
+	 * Copies the records at live into a new file of the next generation,
+	 * and makes it durable. The store still appends to the current one
+	 * until commit_compaction().
+	 * @returns the new locations of live, in order.
+	 * @throws std::runtime_error if a location is not of the current
+	 * generation, or the file cannot be written.
+	 */
+	std::vector<std::string> compact(const std::vector<std::string>& live);
+	/**
+	 * Switches to the generation of compact(), once its locations are
+	 * committed, and removes the current file.
+	 */
+	void commit_compaction();
+
+private:
+	struct record_header
+	{
+		std::uint32_t raw_size;
+		std::uint32_t comp_size;
+		std::uint32_t dict_id;
+	};
+
+	// Called once NUM_DICT_SAMPLES samples are collected.
+	void train_dict();
+	// Also called by a reader that meets a record of a newer dictionary.
+	void load_dict() const;
+	// Reads the records without the dictionary back as samples.
+	void load_samples();
+
+	// @returns the generation of the store file named name, if it is one.
+	static std::optional<std::uint32_t> gen_of(const std::string& name);
+	// Opens the file of generation g, as the current one.
+	void open_gen(std::uint32_t g) const;
+	void close_gen() const;
+	// @returns the offset and the generation of loc.
+	static std::pair<std::uint64_t, std::uint32_t> parse_loc(
+		std::string_view loc
+	);
+	static std::string make_loc(std::uint64_t offset, std::uint32_t gen);
+	// @returns the header of the record at offset, mapping it all.
+	record_header read_header(std::uint64_t offset) const;
+
+	// Makes sure [0, end) of the file is mapped.
+	void map_until(std::uint64_t end) const;
+	void unmap() const;
+
+private:
+	const fs::path dir;
+	const bool writable;
+
+	// Of the current file. A reader switches to the generation of the
+	// locations it is given.
+	mutable std::uint32_t gen = 0;
+	mutable int fd = -1;
+	// Current size of the file, i.e. offset of the next record.
+	mutable std::uint64_t file_size = 0;
+
+	// Read only mapping of text_store.
+	// Remapped when a record beyond it is read.
+	mutable const char* map = nullptr;
+	mutable std::uint64_t map_size = 0;
+
+	mutable std::vector<char> dict;
+	mutable std::uint32_t dict_id = 0;
+	ZSTD_CDict_s* cdict = nullptr;
+	mutable ZSTD_DDict_s* ddict = nullptr;
+
+	ZSTD_CCtx_s* cctx = nullptr;
+	ZSTD_DCtx_s* dctx = nullptr;
+
+	// Samples for training the dictionary. Cleared once trained.
+	std::vector<std::string> samples;
+
+	// Reused for compression to avoid reallocations.
+	std::string comp_buf;
+};
@@ -0,0 +1,207 @@
+/**
+ * This file implements a benchmark of crawling, which runs the indexer and
+ * the updater against a replay_server instead of the web, and reports their
+ * throughput, latency of each stage, and peak memory.
+ *
+ * As nothing real is fetched, the numbers can be compared across changes to
+ * the crawler, for the same server options.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#include "../index.h"
+#include "../scraper.h"
+#include "../utility.h"
+
+namespace ch = std::chrono;
+
+constexpr unsigned DEF_PORT = 18080;
+constexpr unsigned DEF_PAGES = 1000;
+
+struct run_result
+{
+	double secs;
+	// KiB.
+	long max_rss;
+	int status;
+};
+
+// @returns the pid of bin run with args, with the replay proxy set.
+static pid_t spawn(
+	const fs::path& bin, const std::vector<std::string>& args,
+	const std::string& proxy
+) {
+	pid_t pid = ::fork();
+	if (pid != 0)
+		return pid;
+
+	// The child.
+	::setenv(scraper::REPLAY_PROXY_ENV, proxy.c_str(), 1);
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(bin.c_str()));
+	for (const auto& a : args)
+		argv.push_back(const_cast<char*>(a.c_str()));
+	argv.push_back(nullptr);
+
+	::execv(bin.c_str(), argv.data());
+	std::perror("execv");
+	std::_Exit(127);
+}
+
+static run_result run(
+	const fs::path& bin, const std::vector<std::string>& args,
+	const std::string& proxy
+) {
+	const auto start = ch::steady_clock::now();
+	pid_t pid = spawn(bin, args, proxy);
+
+	int status = 0;
+	rusage ru{};
+	::wait4(pid, &status, 0, &ru);
+
+	const ch::duration<double> secs = ch::steady_clock::now() - start;
+	return {secs.count(), ru.ru_maxrss, status};
+}
+
+// Waits until something listens on port.
+static bool wait_for_port(unsigned port)
+{
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<std::uint16_t>(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (int i = 0; i < 200; ++i)
+	{
+		int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		bool ok = 0 == ::connect(
+			fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)
+		);
+		::close(fd);
+		if (ok)
+			return true;
+		std::this_thread::sleep_for(ch::milliseconds(50));
+	}
+	return false;
+}
+
+static unsigned long long num_docs(const fs::path& db)
+{
+	class index i(db);
+	return i.num_documents();
+}
+
+static void report(
+	const char* name, const run_result& r, unsigned long long docs
+) {
+	std::cout
+		<< name << ": " << docs << " docs in " << r.secs << "s, "
+		<< static_cast<double>(docs) / r.secs << " docs/s, peak RSS "
+		<< r.max_rss / 1024 << " MiB";
+	if (r.status != 0)
+		std::cout << " (exit status " << r.status << ")";
+	std::cout << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 2)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " bin_dir [--pages=<n>] [--port=<n>] [--keep]"
+			<< " [replay_server options]"
+			<< "\nbin_dir has replay_server, indexer, and updater. The"
+			<< " options other than\nthe above are passed to replay_server,"
+			<< " e.g. --latency-ms=50 --429-rate=0.01."
+			<< std::endl;
+		return -1;
+	}
+
+	const fs::path bin_dir(argv[1]);
+	const unsigned pages = opts.contains("pages") ?
+		static_cast<unsigned>(std::stoul(opts["pages"])) : DEF_PAGES;
+	const unsigned port = opts.contains("port") ?
+		static_cast<unsigned>(std::stoul(opts["port"])) : DEF_PORT;
+	const bool keep = opts.contains("keep");
+	const std::string proxy = "http://127.0.0.1:" + std::to_string(port);
+
+	std::vector<std::string> server_args{std::to_string(port)};
+	for (const auto& [k, v] : opts)
+		if (k != "pages" && k != "port" && k != "keep")
+			server_args.push_back("--" + k + (v.empty() ? "" : "=" + v));
+
+	const auto dir = fs::temp_directory_path() /
+		("crawl_bench." + std::to_string(::getpid()));
+	fs::create_directories(dir);
+	const auto db = dir / "db";
+	const auto stages = dir / "stages.txt";
+
+	pid_t server = spawn(bin_dir / "replay_server", server_args, "");
+	if (!wait_for_port(port))
+	{
+		std::cerr << "replay_server did not start.\n";
+		::kill(server, SIGTERM);
+		return -1;
+	}
+
+	// 1. The indexer, from its start queue.
+	auto r = run(bin_dir / "indexer", {
+		db.string(), (dir / "queue").string(), "0", std::to_string(pages),
+		"--stage-stats=" + stages.string()
+	}, proxy);
+	const auto docs = num_docs(db);
+	report("indexer", r, docs);
+
+	std::cout << "stage      count    p50 ms    p99 ms   total s\n";
+	std::ifstream ifs(stages);
+	std::string stage;
+	unsigned long long count;
+	double p50, p99, total;
+	while (ifs >> stage >> count >> p50 >> p99 >> total)
+	{
+		std::printf(
+			"%-8s %7llu %9.2f %9.2f %9.2f\n",
+			stage.c_str(), count, p50, p99, total
+		);
+	}
+	std::fflush(stdout);
+
+	// 2. The updater, from the feeds.
+	r = run(bin_dir / "updater", {
+		db.string(), std::to_string(pages), "100000"
+	}, proxy);
+	report("updater", r, num_docs(db) - docs);
+
+	::kill(server, SIGTERM);
+	::waitpid(server, nullptr, 0);
+	if (!keep)
+		fs::remove_all(dir);
+	else
+		std::cout << "Kept " << dir << "\n";
+
+	return 0;
+}
@@ -9,57 +9,112 @@
  */
 
 #include <iostream>
+#include <map>
+#include <string>
 #include <unordered_map>
 
 #include <boost/url.hpp>
 #include <xapian.h>
 
 #include "../index.h"
+#include "../utility.h"
 
 // Count the docs of different hosts and output the distribution.
-std::unordered_map<std::string, unsigned> host_to_count;
+struct host_counter
+{
+	std::unordered_map<std::string, unsigned> host_to_count;
+	unsigned num_doc = 0;
+
+	void operator()(const index::scanned_doc& doc)
+	{
+		urls::url u(index::url_from_doc(doc));
+		++host_to_count[std::string(u.encoded_host())];
+		++num_doc;
+	}
+
+	void merge(host_counter&& other)
+	{
+		for (const auto& [host, cnt] : other.host_to_count)
+			host_to_count[host] += cnt;
+		num_doc += other.num_doc;
+	}
+};
 
-bool count_doc_host(Xapian::Document& doc)
+// Prints the distribution of the hosts.
+template <typename M>
+static void print_hosts(const M& host_to_count, unsigned num_doc)
 {
-	urls::url u(index::url_from_doc(doc));
+	for (const auto& [host, cnt] : host_to_count)
+	{
+		std::cout 
+			<< "Host: " << host << ": "
+			<< cnt 
+			<< " (" 
+			<< 100.f * float(cnt)/float(num_doc)
+			<< "%)\n";
+	}
+}
 
-	auto host = std::string(u.encoded_host());
+// Reads the counters kept in the db instead of going through the docs.
+static int fast_dist(const char* dbpath)
+{
+	auto st = index::stats_of(xp::Database(dbpath));
+	if (!st)
+	{
+		std::cerr 
+			<< "The db does not keep the statistics. "
+			<< "Run with --rebuild-stats first.\n";
+		return -1;
+	}
 
-	if (host_to_count.contains(host))
-		++host_to_count[host];
-	else
-		host_to_count[host] = 1;
+	unsigned num_doc = 0;
+	for (const auto& [host, cnt] : st->hosts)
+		num_doc += cnt;
+	std::cout << "Num total doc = " << num_doc << '\n';
+	print_hosts(st->hosts, num_doc);
 
-	// always return false to indicate it's read-only.
-	return false;
+	// YYYYMMDD -> YYYY-MM
+	std::map<std::string, unsigned> months;
+	for (const auto& [day, cnt] : st->days)
+		months[day.substr(0, 4) + "-" + day.substr(4, 2)] += cnt;
+	for (const auto& [month, cnt] : months)
+		std::cout << "Month: " << month << ": " << cnt << '\n';
+
+	return 0;
 }
 
 int main(int argc, char* argv[])
 {
-	if (argc != 2)
+	auto opts = extract_opts(argc, argv);
+	if (argc != 2 && argc != 3)
 	{
 		std::cerr
 			<< "Usage:\n"
-			<< argv[0] << " <db_path>\n";
+			<< argv[0] << " <db_path> [<num_threads>]"
+			<< " [--fast] [--rebuild-stats]\n"
+			<< "<num_threads> defaults to the number of cores.\n"
+			<< "--fast reads the statistics kept in the db instead.\n"
+			<< "--rebuild-stats recounts them, for dbs that don't keep them.\n";
 		return -1;
 	}
 
-	class index db(argv[1]);
-	auto num_doc = db.num_documents(); 
-	std::cout << "Num total doc = " << num_doc << '\n';
-
-	// Do the counting using the update func.
-	db.upd_all(count_doc_host);
-
-	for (const auto& [host, cnt] : host_to_count)
+	if (opts.contains("rebuild-stats"))
 	{
-		std::cout 
-			<< "Host: " << host << ": "
-			<< cnt 
-			<< " (" 
-			<< 100.f * float(cnt)/float(num_doc)
-			<< "%)\n";
+		class index db(argv[1]);
+		db.rebuild_stats();
 	}
+	if (opts.contains("fast"))
+		return fast_dist(argv[1]);
+
+	unsigned nthreads = argc == 3 ? std::stoul(argv[2]) : 0;
+
+	// Only the url is needed.
+	index::scan_projection proj;
+	proj.data = true;
+	auto res = index::scan(argv[1], proj, host_counter{}, nthreads);
+
+	std::cout << "Num total doc = " << res.num_doc << '\n';
+	print_hosts(res.host_to_count, res.num_doc);
 
 	return 0;
 }
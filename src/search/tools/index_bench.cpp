@@ -0,0 +1,379 @@
+/**
+ * This file implements a benchmark of indexing, which generates news-like
+ * documents and adds them to new dbs with index::add_document(), without
+ * crawling anything.
+ *
+ * The documents are the same for the same options:
+ * - Their words follow a Zipfian distribution over a synthetic vocabulary,
+ *   whose frequent words are also the short ones, as in English.
+ * - Their dates are spread over the two years before 2026.
+ * - Their urls are like the articles of the hosts crawled.
+ *
+ * It sweeps the flush thresholds and the profiles given. Each combination is
+ * run in its own process, so that its peak memory is its own, and reports the
+ * throughput, the time of the commits, the size of the db, and the peak
+ * memory. With --keep, the dbs are kept, e.g. for search_bench.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#include "../index.h"
+#include "../utility.h"
+
+namespace ch = std::chrono;
+
+constexpr unsigned long long DEF_DOCS = 10000ull;
+constexpr unsigned DEF_VOCAB = 50000u;
+constexpr double DEF_ZIPF_S = 1.07;
+constexpr unsigned DEF_COMMIT_EVERY = 10000u;
+
+/**
+ * Generates the documents. Two generators of the same arguments generate the
+ * same documents.
+ */
+class doc_generator
+{
+public:
+	struct doc
+	{
+		urls::url u;
+		std::string title, text;
+		ch::year_month_day date;
+	};
+
+	doc_generator(unsigned vocab, double s, std::uint64_t seed = 42):
+		rng(seed)
+	{
+		words.reserve(vocab);
+		cdf.reserve(vocab);
+		double sum = 0.;
+		for (unsigned i = 0; i < vocab; ++i)
+		{
+			words.push_back(make_word(i));
+			sum += 1. / std::pow(double(i + 1), s);
+			cdf.push_back(sum);
+		}
+		for (auto& c : cdf)
+			c /= sum;
+	}
+
+	doc next()
+	{
+		doc d;
+		const auto n = num++;
+
+		const auto title_len = std::uniform_int_distribution<>(5, 12)(rng);
+		std::string slug;
+		for (int i = 0; i < title_len; ++i)
+		{
+			const auto& w = word();
+			if (i)
+			{
+				d.title += ' ';
+				slug += '-';
+			}
+			d.title += w;
+			slug += w;
+		}
+		d.title[0] = char(std::toupper(d.title[0]));
+		slug += '-' + std::to_string(n);
+
+		const auto text_len = std::uniform_int_distribution<>(150, 900)(rng);
+		for (int i = 0; i < text_len; ++i)
+		{
+			if (i)
+				d.text += i % 20 == 0 ? ". " : " ";
+			d.text += word();
+		}
+		d.text += '.';
+
+		const ch::sys_days day = ch::sys_days(LAST_DAY) - ch::days(
+			std::uniform_int_distribution<>(0, 729)(rng)
+		);
+		d.date = ch::year_month_day(day);
+		d.u = urls::url(make_url(n, d.date, slug));
+		return d;
+	}
+
+private:
+	static constexpr ch::year_month_day LAST_DAY{
+		ch::year(2025), ch::month(12), ch::day(31)
+	};
+	static constexpr const char* SYLLABLES[] = {
+		"ba", "be", "bi", "bo", "ca", "co", "da", "de", "di", "fa", "fe", "fi",
+		"ga", "go", "ha", "he", "ka", "ki", "la", "le", "li", "lo", "ma", "me",
+		"mi", "mo", "na", "ne", "ni", "no", "pa", "pe", "ra", "re", "ri", "ro",
+		"sa", "se", "ta", "te", "to", "va", "ve", "wa", "za"
+	};
+	static constexpr unsigned NUM_SYLLABLES =
+		sizeof(SYLLABLES) / sizeof(SYLLABLES[0]);
+
+	std::mt19937_64 rng;
+	std::vector<std::string> words;
+	// The cumulative probabilities of words.
+	std::vector<double> cdf;
+	unsigned long long num = 0;
+
+	// The syllables of the digits of i, so that smaller i are shorter, and
+	// different i are different words.
+	static std::string make_word(unsigned i)
+	{
+		std::string w;
+		do
+		{
+			w += SYLLABLES[i % NUM_SYLLABLES];
+			i /= NUM_SYLLABLES;
+		} while (i);
+		return w;
+	}
+
+	const std::string& word()
+	{
+		const double p = std::uniform_real_distribution<>(0., 1.)(rng);
+		auto it = std::lower_bound(cdf.begin(), cdf.end(), p);
+		if (it == cdf.end())
+			--it;
+		return words[size_t(it - cdf.begin())];
+	}
+
+	std::string make_url(
+		unsigned long long n, const ch::year_month_day& d,
+		const std::string& slug
+	) const {
+		char ymd[16];
+		std::snprintf(
+			ymd, sizeof(ymd), "%04d/%02u/%02u", int(d.year()),
+			unsigned(d.month()), unsigned(d.day())
+		);
+		switch (n % 4)
+		{
+		case 0:
+			return "https://www.cnbc.com/" + std::string(ymd) + "/" +
+				slug + ".html";
+		case 1:
+			return "https://hbr.org/" + std::string(ymd, 7) + "/" + slug;
+		case 2:
+		{
+			char id[24];
+			std::snprintf(id, sizeof(id), "%016llx", n * 2654435761ull);
+			return "https://www.ft.com/content/" + std::string(id);
+		}
+		default:
+			return "https://edition.cnn.com/" + std::string(ymd) +
+				"/business/" + slug;
+		}
+	}
+};
+
+struct run_config
+{
+	std::string profile;
+	unsigned long long flush_threshold;
+};
+
+// Written by a run to its parent. Times in seconds.
+struct run_result
+{
+	unsigned long long docs = 0;
+	double add_secs = 0., commit_secs = 0.;
+	unsigned commits = 0;
+	double commit_p50 = 0., commit_max = 0.;
+	std::uintmax_t db_bytes = 0;
+};
+
+static std::uintmax_t dir_size(const fs::path& dir)
+{
+	std::uintmax_t ret = 0;
+	for (const auto& e : fs::recursive_directory_iterator(dir))
+		if (e.is_regular_file())
+			ret += e.file_size();
+	return ret;
+}
+
+static run_result run(
+	const run_config& c, const fs::path& db_path,
+	unsigned long long num_docs, unsigned vocab, double s,
+	unsigned commit_every, bool store_text
+) {
+	// Read when the db is opened.
+	setenv(
+		"XAPIAN_FLUSH_THRESHOLD", std::to_string(c.flush_threshold).c_str(), 1
+	);
+
+	run_result r;
+	std::vector<double> commits;
+	doc_generator gen(vocab, s);
+	{
+		index::open_params par(db_path);
+		par.profile = c.profile;
+		par.store_text = store_text;
+		class index db(par);
+
+		auto commit = [&] {
+			const auto start = ch::steady_clock::now();
+			db.synchronize();
+			const ch::duration<double> secs = ch::steady_clock::now() - start;
+			commits.push_back(secs.count());
+			r.commit_secs += secs.count();
+		};
+
+		for (r.docs = 0; r.docs < num_docs; )
+		{
+			// Generating the document is not timed.
+			auto d = gen.next();
+			const auto start = ch::steady_clock::now();
+			db.add_document(d.u, d.title, d.date, d.text);
+			const ch::duration<double> secs = ch::steady_clock::now() - start;
+			r.add_secs += secs.count();
+
+			if (++r.docs % commit_every == 0)
+				commit();
+		}
+		if (r.docs % commit_every != 0)
+			commit();
+	}
+
+	std::sort(commits.begin(), commits.end());
+	r.commits = static_cast<unsigned>(commits.size());
+	if (!commits.empty())
+	{
+		r.commit_p50 = commits[commits.size() / 2];
+		r.commit_max = commits.back();
+	}
+	r.db_bytes = dir_size(db_path);
+	return r;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 1)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " [--docs=<n>] [--flush-thresholds=<n>,...]"
+			<< " [--profiles=<name>,...] [--commit-every=<docs>]"
+			<< " [--store-text] [--vocab=<words>] [--zipf-s=<s>]"
+			<< " [--keep=<dir>]"
+			<< "\nIndexes the same documents for each flush threshold and"
+			<< " profile. With --keep,\nthe dbs are kept in"
+			<< " dir/<profile>-<threshold>."
+			<< std::endl;
+		return -1;
+	}
+
+	const unsigned long long num_docs = opts.contains("docs") ?
+		std::stoull(opts["docs"]) : DEF_DOCS;
+	const unsigned vocab = opts.contains("vocab") ?
+		static_cast<unsigned>(std::stoul(opts["vocab"])) : DEF_VOCAB;
+	const double s = opts.contains("zipf-s") ?
+		std::stod(opts["zipf-s"]) : DEF_ZIPF_S;
+	const unsigned commit_every = opts.contains("commit-every") ?
+		std::max(1u, static_cast<unsigned>(std::stoul(opts["commit-every"]))) :
+		DEF_COMMIT_EVERY;
+	const bool store_text = opts.contains("store-text");
+
+	const auto thresholds = split_opt_list(
+		opts.contains("flush-thresholds") ?
+			opts["flush-thresholds"] : std::to_string(commit_every)
+	);
+	const auto profiles = split_opt_list(
+		opts.contains("profiles") ? opts["profiles"] : "default"
+	);
+
+	const bool keep = opts.contains("keep");
+	const fs::path dir = keep ? fs::path(opts["keep"]) :
+		fs::temp_directory_path() /
+			("index_bench." + std::to_string(::getpid()));
+	fs::create_directories(dir);
+
+	std::cout
+		<< num_docs << " docs, vocabulary " << vocab << ", s=" << s
+		<< ", commit every " << commit_every << " docs"
+		<< (store_text ? ", text stored" : "") << "\n"
+		<< "profile   threshold    docs/s  commits  commit p50 s"
+		<< "  commit max s  commit total s   db MiB  peak RSS MiB\n";
+	std::fflush(stdout);
+
+	for (const auto& p : profiles)
+		for (const auto& t : thresholds)
+		{
+			const run_config c{p, std::stoull(t)};
+			const auto db_path = dir / (p + "-" + t);
+			fs::remove_all(db_path);
+
+			int fds[2];
+			if (::pipe(fds) != 0)
+			{
+				std::perror("pipe");
+				return -1;
+			}
+			pid_t pid = ::fork();
+			if (pid == 0)
+			{
+				::close(fds[0]);
+				int ret = 0;
+				try
+				{
+					auto r = run(
+						c, db_path, num_docs, vocab, s,
+						commit_every, store_text
+					);
+					if (::write(fds[1], &r, sizeof(r)) != sizeof(r))
+						ret = 1;
+				}
+				catch (const std::exception& e)
+				{
+					std::cerr << e.what() << '\n';
+					ret = 1;
+				}
+				std::_Exit(ret);
+			}
+			::close(fds[1]);
+
+			run_result r;
+			const bool got = ::read(fds[0], &r, sizeof(r)) == sizeof(r);
+			::close(fds[0]);
+			int status = 0;
+			rusage ru{};
+			::wait4(pid, &status, 0, &ru);
+			if (!got || status != 0)
+			{
+				std::cout << p << " " << t << ": failed\n";
+				continue;
+			}
+
+			std::printf(
+				"%-9s %9s %9.0f %8u %13.3f %13.3f %15.2f %8.1f %13ld\n",
+				p.c_str(), t.c_str(),
+				double(r.docs) / (r.add_secs + r.commit_secs), r.commits,
+				r.commit_p50, r.commit_max, r.commit_secs,
+				double(r.db_bytes) / (1024. * 1024.), ru.ru_maxrss / 1024
+			);
+			std::fflush(stdout);
+		}
+
+	if (!keep)
+		fs::remove_all(dir);
+	return 0;
+}
@@ -8,16 +8,35 @@
  * @author Guanyuming He
  */
 
+#include "../corpus.h"
+#include "../metrics.h"
+#include "../trace.h"
+#include "../url_canon.h"
 #include "../utility.h"
 #include "indexing_common.h"
 
 #include <execinfo.h>
 #include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <memory>
 
+// Destroyed after i, so that the last save has the final commit.
+std::unique_ptr<metrics_exporter> exporter;
 std::unique_ptr<indexer> i;
+// Destroyed before i, which does not scrape when it is.
+std::unique_ptr<corpus_archiver> archive;
+
+// The commit cadence with --wal.
+constexpr unsigned DEF_WAL_COMMIT_EVERY = 50000u;
+constexpr ch::seconds DEF_WAL_COMMIT_INTERVAL{300};
+// The checkpoint cadence. Each checkpoint commits, so without --wal, it
+// matches Xapian's own flush threshold, and with it, the commit cadence.
+constexpr unsigned DEF_CKPT_EVERY = 10000u;
+constexpr ch::seconds DEF_CKPT_INTERVAL{600};
+constexpr ch::seconds DEF_METRICS_INTERVAL{15};
 
 void segfault_handler(int sig) {
 	// Get void*'s for all entries on the stack
@@ -28,13 +47,11 @@ void segfault_handler(int sig) {
 	fprintf(stderr, "Error: signal %d:\n", sig);
 	backtrace_symbols_fd(array, size, STDERR_FILENO);
 
-	// Before exiting, commit to database lest it corrupt.
-	// Resetting i will call indexer's dtor, which in turn calls 
-	// index's, which writes to the database.
-	if (i.get())
-		i.reset(nullptr);
-
-	std::exit(-1);
+	// Do not commit from here: almost nothing is safe to call in a signal
+	// handler, least of all a Xapian commit of a possibly corrupted process.
+	// The db itself is never corrupted by a crash, and with --wal, the pages
+	// indexed since the last commit are replayed from the log next time.
+	std::_Exit(-1);
 }
 
 int main(int argc, char* argv[])
@@ -43,16 +60,128 @@ int main(int argc, char* argv[])
 	
 	global_init();
 
+	auto opts = extract_opts(argc, argv);
 	if (argc < 3 || argc > 5)
 	{
 		std::cerr 
 			<< "Usage:\n "
 			<< argv[0] << " db_path queue_path"
 		    << " [load_queue:bool] [index_limit]"
+			<< " [--store-text] [--profile=default|single|compact]"
+			<< " [--wal] [--commit-every=<docs>] [--commit-interval=<secs>]"
+			<< " [--checkpoint-every=<docs>] [--checkpoint-interval=<secs>]"
+			<< " [--archive=<dir>] [--stage-stats=<file>]"
+			<< " [--metrics-prom=<file>] [--metrics-json=<file>]"
+			<< " [--metrics-interval=<secs>]"
+			<< " [--log-file=<file>] [--log-level=0|1|2]"
+			<< " [--trace=<file>] [--trace-sample=<rate>]"
+			<< " [--near-dups=off|link|skip] [--url-rules=<file>]"
+			<< " [--filter-rules=<file>]"
+			<< "\n--wal logs the pages before indexing them, so that"
+			<< " commits can be rare\nwithout losing pages in a crash."
+			<< " Then, it commits every 50000 docs or 300s\nby default."
+			<< "\nThe queue is checkpointed with the db every 10000 docs or"
+			<< " 600s by default,\nor as often as it commits with --wal."
+			<< " Loading the queue resumes from the\nlast checkpoint."
+			<< "\n--archive keeps the fetched pages in the corpus in dir,"
+			<< " for reindex."
+			<< "\n--metrics-prom and --metrics-json write the metrics of"
+			<< " the crawl every 15s\nby default, e.g. for the textfile"
+			<< " collector of node_exporter."
+			<< "\n--log-file writes the log there instead of stdout,"
+			<< " rotated every 64MiB.\n--log-level is 0 for none, 1 for"
+			<< " the default, and 2 for where each\nmessage is logged."
+			<< "\n--trace writes the spans of the pages as a Chrome trace,"
+			<< " for ui.perfetto.dev.\n--trace-sample is the fraction of"
+			<< " the pages traced, 1 by default."
+			<< "\n--near-dups is what to do with a page whose text is nearly"
+			<< " that of a recent one,\ne.g. a syndicated story: link it to"
+			<< " the first (default), or skip it."
+			<< "\n--url-rules are the url rules of a new db (see rekey)."
+			<< "\n--filter-rules replaces the rules of the urls recursed and"
+			<< " indexed\n(see url_rules.h)."
 			<< std::endl;
 		return -1;
 	}
 
+	load_filter_rules(opts);
+	// Rather than finding it out after the whole crawl.
+	if (opts.contains("trace") && !std::ofstream(opts["trace"]))
+	{
+		std::cerr << "Cannot write the trace to " << opts["trace"] << ".\n";
+		return -1;
+	}
+
+	try
+	{
+		load_log_level(opts);
+	}
+	catch (const std::logic_error&)
+	{
+		std::cerr << "Invalid --log-level. Run without args for usage.\n";
+		return -1;
+	}
+	if (opts.contains("log-file"))
+		logger::global().open({opts["log-file"]});
+
+	index::open_params db_par(argv[1]);
+	db_par.store_text = opts.contains("store-text");
+	if (opts.contains("profile"))
+		db_par.profile = opts["profile"];
+	if (opts.contains("near-dups"))
+		db_par.near_dups = index::near_dup_policy_from_name(opts["near-dups"]);
+	if (opts.contains("url-rules"))
+		db_par.url_rules = url_canon::read_rules(opts["url-rules"]);
+	db_par.use_wal = opts.contains("wal");
+	if (db_par.use_wal)
+	{
+		db_par.commit_every = DEF_WAL_COMMIT_EVERY;
+		db_par.commit_interval = DEF_WAL_COMMIT_INTERVAL;
+	}
+	if (opts.contains("commit-every"))
+		db_par.commit_every = std::stoul(opts["commit-every"]);
+	if (opts.contains("commit-interval"))
+		db_par.commit_interval = ch::seconds(
+			std::stoul(opts["commit-interval"])
+		);
+	// Xapian must not commit by itself before the index does, so its
+	// threshold is set above the cadence, unless the user has set it.
+	// It is read when the db is opened.
+	if (db_par.commit_every != 0)
+		setenv(
+			"XAPIAN_FLUSH_THRESHOLD",
+			std::to_string(db_par.commit_every + 1).c_str(),
+			0
+		);
+
+	unsigned ckpt_every = DEF_CKPT_EVERY;
+	ch::seconds ckpt_interval = DEF_CKPT_INTERVAL;
+	if (db_par.use_wal)
+	{
+		ckpt_every = db_par.commit_every;
+		ckpt_interval = db_par.commit_interval;
+	}
+	if (opts.contains("checkpoint-every"))
+		ckpt_every = std::stoul(opts["checkpoint-every"]);
+	if (opts.contains("checkpoint-interval"))
+		ckpt_interval = ch::seconds(std::stoul(opts["checkpoint-interval"]));
+
+	if (opts.contains("archive"))
+	{
+		archive = std::make_unique<corpus_archiver>(opts["archive"]);
+		scraper::set_archive(archive.get());
+	}
+
+	if (opts.contains("metrics-prom") || opts.contains("metrics-json"))
+		exporter = std::make_unique<metrics_exporter>(
+			metrics_registry::global(),
+			opts.contains("metrics-prom") ? opts["metrics-prom"] : "",
+			opts.contains("metrics-json") ? opts["metrics-json"] : "",
+			opts.contains("metrics-interval") ?
+				ch::seconds(std::stoul(opts["metrics-interval"])) :
+				DEF_METRICS_INTERVAL
+		);
+
 	bool load_queue;
 	size_t index_limit{std::numeric_limits<size_t>::max()};
 
@@ -73,7 +202,7 @@ int main(int argc, char* argv[])
 	if (load_queue) // don't use start_queue.
 	{		
 		i = std::make_unique<indexer>(
-			fs::path(argv[1]), fs::path(argv[2]),
+			db_par, fs::path(argv[2]),
 			&index_filter, &recurse_filter,
 			&wp_index_filter, &wp_recurse_filter,
 			index_limit
@@ -109,7 +238,7 @@ int main(int argc, char* argv[])
 		}
 
 		i = std::make_unique<indexer>(
-			fs::path(argv[1]), fs::path(argv[2]),
+			db_par, fs::path(argv[2]),
 			std::move(start_queue),
 			&index_filter, &recurse_filter,
 			&wp_index_filter, &wp_recurse_filter,
@@ -118,6 +247,10 @@ int main(int argc, char* argv[])
 	}
 
 
+	i->set_checkpoint_cadence(ckpt_every, ckpt_interval);
+	if (opts.contains("stage-stats"))
+		i->set_stage_stats_path(opts["stage-stats"]);
+
 	// Register for SIGINT and start indexing.
 	std::signal(
 		SIGINT, 
@@ -125,8 +258,27 @@ int main(int argc, char* argv[])
 			if (sig == SIGINT) i->interrupt();
 		}
 	);	
+	if (opts.contains("trace"))
+		tracer::global().start(
+			opts.contains("trace-sample") ?
+				std::stod(opts["trace-sample"]) : 1.
+		);
 	std::cout << "Indexing started. Press Ctrl+C to interrupt.\n";
 	i->start_indexing();
+	// The indexer is yet to take its last checkpoint, which a failure to
+	// write the trace must not prevent.
+	if (opts.contains("trace"))
+		try
+		{
+			tracer::global().stop_and_write(opts["trace"]);
+		}
+		catch (const std::runtime_error& e)
+		{
+			util_log(e.what());
+		}
+	// Write the pages left.
+	scraper::set_archive(nullptr);
+	archive.reset();
 
 	global_uninit();
 
@@ -19,258 +19,164 @@
  */
 
 #include "../indexer.h"
+#include "../logger.h"
+#include "../url_rules.h"
 #include "../webpage.h"
 
-#include <regex>
+#include <map>
+#include <stdexcept>
 #include <string>
-#include <string_view>
-#include <unordered_map>
 
 /**
+ * The filter rules of the sites I index (see url_rules.h for the format),
+ * unless --filter-rules gives a file of others, so that a site can be added
+ * without rebuilding.
+ *
  * In general, the condition of recursing is more loose than that of indexing.
  * If a document is indexed, then naturally we would want to also recurse it 
- * to find related ones.
- *
- * @returns (b1, b2).
- * Recurse iff b1; index iff b2.
+ * to find related ones, hence both.
  */
-using path_filter_func_t = 
-std::pair<bool, bool>
-(const std::string_view);
+static constexpr const char* DEFAULT_FILTER_RULES = R"(
+[hbr.org]
+recurse prefix=/topic
+recurse prefix=/the-latest
+# It has an odd structure of /yyyy/mm
+both minlen=9 digit@1 digit@2 digit@6 slug
+
+[www.cnbc.com]
+recurse prefix=/business
+recurse prefix=/investing
+recurse prefix=/markets
+both date slug
+
+# Its articles are not recursed, as /content is too general.
+[www.ft.com]
+recurse empty
+recurse prefix=/companies
+recurse prefix=/markets
+index prefix=/content
+
+[edition.cnn.com]
+recurse empty
+recurse prefix=/business
+both date slug contains=/business/
+
+[www.economist.com]
+recurse empty
+recurse prefix=/topics
+both date slug
+
+[fortune.com]
+recurse prefix=/the-latest
+recurse prefix=/section
+both prefix=/article
+both slug
+
+[www.theguardian.com]
+recurse prefix=/business
+recurse prefix=/money
+recurse prefix=/uk/business
+recurse prefix=/uk/money
+recurse date
+index prefix=/business date
+index prefix=/money date
+index prefix=/uk/business date
+index prefix=/uk/money date
+
+[www.theatlantic.com]
+recurse prefix=/economy
+index prefix=/economy date
+
+[www.ibtimes.com]
+recurse prefix=/economy-markets
+both slug
+
+[www.forbes.com]
+recurse prefix=/business
+both prefix=/sites
+
+[www.nytimes.com]
+recurse prefix=/section contains=business
+recurse prefix=/section contains=market
+both date contains=business
+both date contains=market
+
+[www.inc.com]
+recurse prefix=/section
+both slug
+
+[www.entrepreneur.com]
+recurse prefix=/business-news
+both slug
+
+[www.foxbusiness.com]
+recurse
+both slug
+
+# It needs me to enable JS
+[www.reuters.com]
+recurse prefix=/business
+recurse prefix=/markets
+recurse date slug
+index prefix=/business date slug
+index prefix=/markets date slug
+
+# Bloomberg blocked me
+[www.bloomberg.com]
+recurse empty
+recurse prefix=/uk
+recurse prefix=/economics
+recurse prefix=/markets
+recurse prefix=/deals
+both prefix=/news/articles
+
+# wsj blocks me if I don't enable JS and cookies.
+[www.wsj.com]
+recurse empty
+recurse prefix=/business
+recurse prefix=/economy
+both slug
+
+# Don't index this website, according to Sean.
+#[www.businessinsider.com]
+#recurse prefix=/business
+#both slug
+)";
+static url_rules filter_rules(DEFAULT_FILTER_RULES);
 
-// At least three words in a 
-// word-word-word-... pattern
-// This is common it news article addresses.
-static const std::string words_sep_dash_pattern("[A-Za-z](-[A-Za-z]+){2,}");
-static const std::regex words_sep_dash_re(words_sep_dash_pattern);
-static bool has_words_separated_by_dash(const std::string_view p)
-{
-	return std::regex_search(
-		p.begin(), p.end(), 
-		words_sep_dash_re
-	);
-}
 /**
- * @returns true iff the path has date encoded in it.
- * 
- * The test cases for this function are done in regex testing websites
- * like regex101.com.
- * Test cases (must accept):
- * 2025-02-01
- * 2025-29-07
- * 08-12-2025
- * 12-09-2025
- * 2025/11/03
- * 2025/03/15
- * 11/20/2025
- * 30/01/2025
- * (must not accept)
- * -1/-2/2025
- * 1/1/1
- * 2021/2022/2023
+ * Replaces filter_rules with those of the file of --filter-rules, if given.
+ * @throws std::runtime_error if they cannot be read or are invalid.
  */
-static const std::string date_in_path_pattern(
-	R"((^|\/)\d{4}[-/]\d{1,2}[-/]\d{1,2}($|\/)|(^|\/)\d{1,2}[-/]\d{1,2}[-/]\d{4}($|\/))"
-);
-static const std::regex date_in_path_regex(date_in_path_pattern);
-static bool has_dates(const std::string_view p)
+static void load_filter_rules(std::map<std::string, std::string>& opts)
 {
-	return std::regex_search(
-		p.begin(), p.end(),
-		date_in_path_regex
-	);
+	if (opts.contains("filter-rules"))
+		filter_rules = url_rules::from_file(opts["filter-rules"]);
 }
+
 /**
- * For my indexer, my url filter rule is:
- * for the host, executes a function which
- * returns (b_recurse, b_index), given input path of the url.
+ * Sets the level of the global logger to --log-level, if given.
+ * It is range checked as SEARCH_LOG_LEVEL is.
+ * @throws std::logic_error if it is not a number of log_levels.
  */
-static const std::unordered_map<std::string, path_filter_func_t*> 
-filtermap {
-	{std::string("hbr.org"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.starts_with("/topic") ||
-				p.starts_with("/the-latest");
-			bool b2 = 
-				// it has an odd structure of /yyyy/mm
-				p.size() > 8 &&
-				std::isdigit(p.at(1)) &&
-				std::isdigit(p.at(2)) &&
-				std::isdigit(p.at(6)) &&
-				has_words_separated_by_dash(p);
-			return {b1||b2, b2};
-	}},
-	{std::string("www.cnbc.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.starts_with("/business") ||
-				p.starts_with("/investing") ||
-				p.starts_with("/markets");
-			bool b2 = 
-				has_dates(p) &&
-				has_words_separated_by_dash(p);
-			return {b1||b2, b2};
-	}},
-	{std::string("www.ft.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.empty() ||
-				p.starts_with("/companies") ||
-				p.starts_with("/markets");
-			bool b2 = 
-				p.starts_with("/content");
-			// here I don't use b1||b2 for the first because b2 is too general.
-			return {b1, b2};
-	}},
-	{std::string("edition.cnn.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.empty() ||
-				p.starts_with("/business");
-			bool b2 = 
-				has_dates(p) && 
-				has_words_separated_by_dash(p) &&
-				p.contains("/business/");
-			return {b1||b2, b2};
-	}},
-	{std::string("www.economist.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.empty() ||
-				p.starts_with("/topics");
-			bool b2 = 
-				has_dates(p) &&
-				has_words_separated_by_dash(p);
-			return {b1||b2, b2};
-	}},
-	{std::string("fortune.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.starts_with("/the-latest") ||
-				p.starts_with("/section");
-			bool b2 = 
-				p.starts_with("/article") ||
-				has_words_separated_by_dash(p);
-			return {b1||b2, b2};
-	}},
-	{std::string("www.theguardian.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = 
-				p.starts_with("/business") ||
-				p.starts_with("/money") || 
-				p.starts_with("/uk/business") ||
-				p.starts_with("/uk/money");
-			bool b2 = has_dates(p);
-			return {b1||b2, b1&&b2};
-	}},
-	{std::string("www.theatlantic.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/economy"); 
-			bool b2 = has_dates(p);
-			return {b1, b1&&b2};
-	}},
-	{std::string("www.ibtimes.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/economy-markets");
-			bool b2 = has_words_separated_by_dash(p);
-			return {b1||b2, b2};
-	}},
-	{std::string("www.forbes.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/business");
-			bool b2 = p.starts_with("/sites");
-			return {b1||b2, b2};
-	}},
-	{std::string("www.nytimes.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/section");
-			bool b2 = has_dates(p);
-			bool b3 = 
-				p.contains("business")
-				|| p.contains("market");
-			return {(b1||b2) && b3, b2&&b3};
-	}},
-	{std::string("www.inc.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/section");
-			bool b2 = has_words_separated_by_dash(p);
-		return {b1||b2, b2};
-	}},
-	{std::string("www.entrepreneur.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = p.starts_with("/business-news");
-			bool b2 = has_words_separated_by_dash(p);
-		return {b1||b2, b2};
-	}},
-	{std::string("www.foxbusiness.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = true;
-			bool b2 = has_words_separated_by_dash(p);
-		return {b1||b2, b2};
-	}},
-	// It needs me to enable JS
-	{std::string("www.reuters.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.starts_with("/business") ||
-				p.starts_with("/markets");
-			bool b2 = 
-				has_dates(p) &&
-				has_words_separated_by_dash(p);
-			return {b1||b2, b1&&b2};
-	}},
-	// Bloomberg blocked me
-	{std::string("www.bloomberg.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> { 
-			bool b1 = 
-				p.empty() ||
-				p.starts_with("/uk") ||
-				p.starts_with("/economics") ||
-				p.starts_with("/markets") || 
-				p.starts_with("/deals");
-			bool b2 = p.starts_with("news/articles");
-			return {b1||b2, b2};
-	}},
-	// wsj blocks me if I don't enable JS and cookies.
-	{std::string("www.wsj.com"), 
-		[](const std::string_view p) -> std::pair<bool,bool> {
-			bool b1 = 
-				p.empty() ||
-				p.starts_with("/business") ||
-				p.starts_with("/economy");
-			bool b2 = 
-				has_words_separated_by_dash(p);
-			// here I don't use b1||b2 for the first because b2 is too general.
-			return {b1||b2, b2};
-	}},
-	// Don't index this website, according to Sean.
-	//{std::string("www.businessinsider.com"), 
-	//	[](const std::string_view p) -> std::pair<bool,bool> {
-	//		bool b1 = p.starts_with("/business");
-	//		bool b2 = has_words_separated_by_dash(p);
-	//		return {b1||b2, b2};
-	//}},
-};
+static void load_log_level(std::map<std::string, std::string>& opts)
+{
+	if (!opts.contains("log-level"))
+		return;
+	const int v = std::stoi(opts["log-level"]);
+	if (v < int(log_levels::NO_LOG) || v > int(log_levels::VERBOSE_2))
+		throw std::out_of_range("--log-level");
+	logger::global().set_level(log_levels(v));
+}
 
 static bool index_filter(urls::url& u)
 {
-	std::string key{u.encoded_host()};
-	if (!filtermap.contains(key))
-		return false;
-
-	auto val {filtermap.at(key)};
-	return val(u.encoded_path()).second;
+	return filter_rules.match(u).index;
 }
 
 static bool recurse_filter(urls::url& u)
 {
-	std::string key{u.encoded_host()};
-	if (!filtermap.contains(key))
-		return false;
-
-	auto val {filtermap.at(key)};
-	return val(u.encoded_path()).first;
+	return filter_rules.match(u).recurse;
 }
 
 static bool wp_index_filter(webpage& pg)
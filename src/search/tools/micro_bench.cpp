@@ -0,0 +1,387 @@
+/**
+ * This file implements microbenchmarks of the hot components of search_eng:
+ * HTML parsing, link extraction, url hashing, the crawl filters, date
+ * parsing, adding documents, and querying.
+ *
+ * All inputs are fixed fixtures built in this file, so that the numbers only
+ * change when the code does. Each case runs in batches until a minimum time
+ * passes, and the results are written as JSON, one object per case, for
+ * comparing runs.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include <xapian.h>
+
+#include "../../sha-2/sha-256.h"
+#include "../date_util.h"
+#include "../index.h"
+#include "../searcher.h"
+#include "../url2html.h"
+#include "../url_canon.h"
+#include "../utility.h"
+#include "../webpage.h"
+#include "indexing_common.h"
+
+namespace ch = std::chrono;
+
+constexpr unsigned DEF_MIN_TIME_MS = 500u;
+// Samples are taken per batch, so that the clock is not read per op.
+constexpr unsigned NUM_BATCHES = 50u;
+constexpr unsigned DB_DOCS = 2000u;
+
+// Keeps the results alive, so that the compiler does not remove the work.
+static volatile std::uint64_t sink;
+
+struct result
+{
+	std::string name;
+	unsigned long long iters = 0;
+	double mean_ns = 0., p50_ns = 0., p99_ns = 0.;
+};
+
+/**
+ * Runs f, which returns something to sink, until min_time passes and at least
+ * NUM_BATCHES batches are done. The batch size is calibrated so that a batch
+ * takes about min_time / NUM_BATCHES.
+ */
+template <typename F>
+static result run_case(
+	const std::string& name, ch::nanoseconds min_time, F&& f
+) {
+	const auto batch_time = min_time / NUM_BATCHES;
+
+	unsigned long long batch = 1;
+	for (;;)
+	{
+		const auto start = ch::steady_clock::now();
+		for (unsigned long long i = 0; i < batch; ++i)
+			sink = sink + f();
+		if (
+			ch::steady_clock::now() - start >= batch_time / 4 ||
+			batch >= 1ull << 24
+		)
+			break;
+		batch *= 2;
+	}
+	batch = std::max(1ull, batch * 4);
+
+	result r{name};
+	std::vector<double> samples;
+	const auto end = ch::steady_clock::now() + min_time;
+	double total_ns = 0.;
+	while (samples.size() < NUM_BATCHES || ch::steady_clock::now() < end)
+	{
+		const auto start = ch::steady_clock::now();
+		for (unsigned long long i = 0; i < batch; ++i)
+			sink = sink + f();
+		const ch::duration<double, std::nano> ns =
+			ch::steady_clock::now() - start;
+
+		samples.push_back(ns.count() / double(batch));
+		total_ns += ns.count();
+		r.iters += batch;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	r.mean_ns = total_ns / double(r.iters);
+	r.p50_ns = samples[samples.size() / 2];
+	r.p99_ns = samples[samples.size() * 99 / 100];
+	return r;
+}
+
+/************************* Fixtures *************************/
+
+static const char* const WORDS[] = {
+	"market", "shares", "investors", "company", "growth", "bank", "rates",
+	"inflation", "quarter", "earnings", "stocks", "economy", "trade",
+	"policy", "revenue", "analysts", "energy", "prices", "global", "deal"
+};
+constexpr size_t NUM_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+
+// A deterministic paragraph of n words, starting from the seed-th.
+static std::string words(size_t seed, size_t n)
+{
+	std::string ret;
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (i) ret += ' ';
+		ret += WORDS[(seed * 7 + i * 13 + i / 5) % NUM_WORDS];
+	}
+	return ret;
+}
+
+// A news article of about 30KiB with a navigation bar, like the ones crawled.
+static std::string fixture_html()
+{
+	std::string h =
+		"<!DOCTYPE html><html><head><meta charset=\"utf-8\">"
+		"<title>Markets rally as rates hold steady</title>"
+		"<meta property=\"article:published_time\" "
+		"content=\"2025-03-14T09:30:00Z\"></head><body><nav><ul>";
+	for (size_t i = 0; i < 80; ++i)
+		h += "<li><a href=\"/business/section-" + std::to_string(i) + "\">" +
+			words(i, 2) + "</a></li>";
+	h += "</ul></nav><article><h1>Markets rally as rates hold steady</h1>";
+	for (size_t i = 0; i < 40; ++i)
+	{
+		h += "<p>" + words(i, 60);
+		if (i % 4 == 0)
+			h += " <a href=\"https://www.cnbc.com/2025/03/" +
+				std::to_string(10 + i % 18) + "/" + words(i, 4) + ".html\">" +
+				words(i + 1, 3) + "</a>";
+		h += ".</p>";
+	}
+	h += "</article><footer>";
+	for (size_t i = 0; i < 20; ++i)
+		h += "<a href=\"https://www.cnbc.com/about-" + std::to_string(i) +
+			"\">About</a>";
+	h += "</footer></body></html>";
+
+	// The spaces in the hrefs above are replaced by dashes.
+	bool in_href = false;
+	for (size_t i = 0; i < h.size(); ++i)
+	{
+		if (h.compare(i, 6, "href=\"") == 0)
+		{
+			in_href = true;
+			i += 5;
+		}
+		else if (in_href && h[i] == '"')
+			in_href = false;
+		else if (in_href && h[i] == ' ')
+			h[i] = '-';
+	}
+	return h;
+}
+
+static const char* const URLS[] = {
+	"https://www.cnbc.com/2025/03/14/markets-rally-as-rates-hold.html",
+	"https://www.cnbc.com/business/",
+	"https://hbr.org/2025/03/how-to-lead-through-uncertainty",
+	"https://hbr.org/topic/subject/strategy",
+	"https://www.ft.com/content/0a1b2c3d-4e5f-6789-abcd-ef0123456789",
+	"https://edition.cnn.com/2025/03/14/business/oil-prices-fall",
+	"https://www.example.com/not/crawled/at-all",
+	"https://www.cnbc.com/video/2025/03/14/short-clip.html"
+};
+constexpr size_t NUM_URLS = sizeof(URLS) / sizeof(URLS[0]);
+
+static const char* const DATES[] = {
+	"2025-03-14", "2025-03-14T09:30:00Z", "14 March 2025", "March 14, 2025",
+	"Fri, 14 Mar 2025 09:30:00 GMT", "2025/03/14", "not a date at all"
+};
+constexpr size_t NUM_DATES = sizeof(DATES) / sizeof(DATES[0]);
+
+static std::vector<std::string> load_queries(const fs::path& p)
+{
+	std::vector<std::string> ret;
+	std::ifstream ifs(p);
+	std::string line;
+	while (std::getline(ifs, line))
+		if (!line.empty())
+			ret.push_back(line);
+	if (ret.empty())
+		ret = {"market", "interest rates", "oil prices", "bank earnings"};
+	return ret;
+}
+
+/************************* Output *************************/
+
+static void write_json(std::ostream& os, const std::vector<result>& rs)
+{
+	os << "[\n";
+	for (size_t i = 0; i < rs.size(); ++i)
+	{
+		const auto& r = rs[i];
+		os
+			<< "  {\"name\": \"" << r.name << "\", \"iterations\": "
+			<< r.iters << ", \"mean_ns\": " << r.mean_ns
+			<< ", \"p50_ns\": " << r.p50_ns << ", \"p99_ns\": " << r.p99_ns
+			<< "}" << (i + 1 < rs.size() ? "," : "") << "\n";
+	}
+	os << "]\n";
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 1)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " [--out=<file>] [--filter=<substr>]"
+			<< " [--min-time-ms=<n>] [--queries=<file>]"
+			<< "\nRuns the cases whose names contain the filter, and writes"
+			<< " the results as JSON\nto the file, or stdout."
+			<< "\n--queries defaults to misc/100_queries.txt."
+			<< std::endl;
+		return -1;
+	}
+
+	const ch::nanoseconds min_time = ch::milliseconds(
+		opts.contains("min-time-ms") ?
+			std::stoul(opts["min-time-ms"]) : DEF_MIN_TIME_MS
+	);
+	const std::string filter = opts.contains("filter") ? opts["filter"] : "";
+	const auto queries = load_queries(
+		opts.contains("queries") ? opts["queries"] : "misc/100_queries.txt"
+	);
+
+	global_init();
+
+	std::vector<result> results;
+	auto add = [&](const std::string& name, auto&& f) {
+		if (name.find(filter) == std::string::npos)
+			return;
+		std::cerr << name << "..." << std::endl;
+		results.push_back(run_case(name, min_time, f));
+	};
+
+	const std::string page = fixture_html();
+	const auto* buf = reinterpret_cast<const lxb_char_t*>(page.data());
+	parser p;
+
+	add("parser::parse", [&] {
+		std::string text;
+		html h(p.parse(buf, page.size(), &text),
+			std::map<std::string, std::string>{}, std::move(text));
+		return std::uint64_t(h.text.size());
+	});
+
+	std::string text;
+	html h(p.parse(buf, page.size(), &text),
+		std::map<std::string, std::string>{{"date", "Fri, 14 Mar 2025"}},
+		std::move(text));
+	add("html::get_urls", [&] {
+		return std::uint64_t(h.get_urls().size());
+	});
+
+	{
+		std::string t;
+		webpage pg(
+			urls::url(URLS[0]),
+			html(p.parse(buf, page.size(), &t),
+				std::map<std::string, std::string>{{"date", ""}},
+				std::move(t))
+		);
+		add("webpage::get_urls", [&] {
+			return std::uint64_t(pg.get_urls().size());
+		});
+	}
+
+	std::vector<urls::url> us;
+	for (auto* u : URLS)
+		us.emplace_back(u);
+	size_t ui = 0;
+
+	add("url_get_essential", [&] {
+		return std::uint64_t(url_get_essential(us[ui++ % NUM_URLS]).size());
+	});
+	std::string key;
+	const url_canon canon;
+	add("url_canon::key", [&] {
+		canon.key(us[ui++ % NUM_URLS], key);
+		return std::uint64_t(key.size());
+	});
+	add("index::url2hashid", [&] {
+		return std::uint64_t(
+			index::url2hashid(canon, us[ui++ % NUM_URLS]).size()
+		);
+	});
+	add("calc_sha_256/4KiB", [&] {
+		std::uint8_t hash[SIZE_OF_SHA_256_HASH];
+		calc_sha_256(hash, page.data(), 4096);
+		return std::uint64_t(hash[0]);
+	});
+
+	add("index_filter", [&] {
+		return std::uint64_t(index_filter(us[ui++ % NUM_URLS]));
+	});
+	add("recurse_filter", [&] {
+		return std::uint64_t(recurse_filter(us[ui++ % NUM_URLS]));
+	});
+	add("has_dates", [&] {
+		return std::uint64_t(has_dates(us[ui++ % NUM_URLS].encoded_path()));
+	});
+	add("has_words_separated_by_dash", [&] {
+		return std::uint64_t(has_words_separated_by_dash(
+			us[ui++ % NUM_URLS].encoded_path()
+		));
+	});
+
+	size_t di = 0;
+	add("try_parse_date_str", [&] {
+		return std::uint64_t(
+			try_parse_date_str(DATES[di++ % NUM_DATES]).has_value()
+		);
+	});
+
+	const auto dir = fs::temp_directory_path() /
+		("micro_bench." + std::to_string(::getpid()));
+	fs::create_directories(dir);
+	const ch::year_month_day date{ch::year(2025), ch::month(3), ch::day(14)};
+	const std::string title = "Markets rally as rates hold steady";
+	const std::string body = words(0, 600);
+	// Adds the n-th synthetic article to db.
+	auto add_nth = [&](class index& db, unsigned long long n) {
+		urls::url u(
+			"https://www.cnbc.com/2025/03/14/article-" +
+			std::to_string(n) + ".html"
+		);
+		db.add_document(u, title, date, words(n, 12) + " " + body);
+	};
+
+	{
+		class index db(dir / "add");
+		unsigned long long n = 0;
+		add("index::add_document", [&] {
+			add_nth(db, n);
+			return std::uint64_t(++n);
+		});
+	}
+	{
+		// Unlike the one above, the size of this db does not depend on the
+		// time taken.
+		class index db(dir / "query");
+		for (unsigned n = 0; n < DB_DOCS; ++n)
+			add_nth(db, n);
+		db.synchronize();
+
+		searcher s(db);
+		size_t qi = 0;
+		add("searcher::query", [&] {
+			return std::uint64_t(
+				s.query(queries[qi++ % queries.size()]).mset.size()
+			);
+		});
+	}
+	fs::remove_all(dir);
+
+	global_uninit();
+
+	if (opts.contains("out"))
+	{
+		std::ofstream ofs(opts["out"]);
+		write_json(ofs, results);
+	}
+	else
+		write_json(std::cout, results);
+
+	return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * This file implements a tool that rebuilds a database of the old DOUBLE
+ * schema into a new one of the SINGLE schema (see index.h), and measures the
+ * difference between them.
+ *
+ * No page needs to be fetched again: the unprefixed terms of a DOUBLE db are
+ * duplicates of its prefixed ones, so they are simply dropped from each
+ * document.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <xapian.h>
+
+#include "../index.h"
+#include "../searcher.h"
+#include "../text_store.h"
+
+namespace ch = std::chrono;
+
+static std::uintmax_t dir_size(const fs::path& dir)
+{
+	std::uintmax_t ret = 0;
+	for (const auto& e : fs::recursive_directory_iterator(dir))
+		if (e.is_regular_file())
+			ret += e.file_size();
+	return ret;
+}
+
+// @returns the number of postings, i.e. sum of all terms' termfreq.
+static unsigned long long num_postings(const xp::Database& db)
+{
+	unsigned long long ret = 0;
+	for (auto t = db.allterms_begin(); t != db.allterms_end(); ++t)
+		ret += t.get_termfreq();
+	return ret;
+}
+
+// @returns mean latency in microseconds of running all queries on db.
+static double mean_query_latency(
+	const fs::path& db, const std::vector<std::string>& queries
+) {
+	searcher s(db);
+	// Warm up the cache first, so that the two dbs are compared fairly.
+	for (const auto& q : queries)
+		s.query(q, {16});
+
+	auto start = ch::steady_clock::now();
+	for (const auto& q : queries)
+		s.query(q, {16});
+	ch::duration<double, std::micro> elapsed =
+		ch::steady_clock::now() - start;
+
+	return elapsed.count() / double(queries.size());
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3 && argc != 4)
+	{
+		std::cerr
+			<< "Usage:\n"
+			<< argv[0] << " <src_db> <dst_db> [<queries_file>]\n"
+			<< "<src_db> must be of the default profile.\n"
+			<< "<dst_db> must not exist.\n"
+			<< "If <queries_file> is given, the query latency of the two"
+			<< " is compared.\n";
+		return -1;
+	}
+
+	fs::path src_path(argv[1]), dst_path(argv[2]);
+	if (fs::exists(dst_path))
+	{
+		std::cerr << dst_path << " already exists.\n";
+		return -1;
+	}
+
+	xp::Database src(src_path.string());
+	if (index::profile_of(src).name != "default")
+	{
+		std::cerr << src_path << " is not of the default profile.\n";
+		return -1;
+	}
+
+	xp::WritableDatabase dst(dst_path.string(), xp::DB_CREATE);
+
+	// Copy the metadata first, and then overwrite the schema and the
+	// profile. The single profile differs from the default only in the
+	// schema.
+	for (auto k = src.metadata_keys_begin(); k != src.metadata_keys_end(); ++k)
+		dst.set_metadata(*k, src.get_metadata(*k));
+	dst.set_metadata(
+		index::SCHEMA_KEY, index::schema_name(index::schema::SINGLE)
+	);
+	dst.set_metadata(index::PROFILE_KEY, "single");
+
+	std::cout << "Migrating " << src.get_doccount() << " documents...\n";
+	auto start = ch::steady_clock::now();
+
+	unsigned num_done = 0;
+	std::vector<std::string> to_rm;
+	for (auto i = src.postlist_begin(""); i != src.postlist_end(""); ++i)
+	{
+		auto doc = src.get_document(*i);
+
+		// Do not remove while iterating.
+		to_rm.clear();
+		for (auto t = doc.termlist_begin(); t != doc.termlist_end(); ++t)
+		{
+			std::string term = *t;
+			if (index::is_free_text_term(term))
+				to_rm.emplace_back(std::move(term));
+		}
+		for (const auto& t : to_rm)
+			doc.remove_term(t);
+
+		// Keep the docids, so that nothing refering to them breaks.
+		dst.replace_document(*i, doc);
+
+		if (++num_done % 10000 == 0)
+			std::cout << num_done << " done.\n";
+	}
+	dst.commit();
+
+	ch::duration<double> elapsed = ch::steady_clock::now() - start;
+	std::cout
+		<< "Migrated " << num_done << " documents in "
+		<< elapsed.count() << "s ("
+		<< double(num_done) / elapsed.count() << " docs/s).\n";
+	dst.close();
+
+	// A db built by replacing documents one by one has partly filled
+	// blocks. Compact it, so that the sizes are comparable.
+	{
+		auto tmp_path = dst_path;
+		tmp_path += ".compact";
+		xp::Database(dst_path.string()).compact(tmp_path.string());
+		fs::remove_all(dst_path);
+		fs::rename(tmp_path, dst_path);
+	}
+
+	// The locations in TEXT_SLOT stay valid if the store is copied as is,
+	// as TEXT_GEN_KEY is.
+	if (text_store::exists(src_path))
+		text_store::copy(src_path, dst_path, index::text_gen_of(src));
+
+	// Measure the difference.
+	xp::Database new_db(dst_path.string());
+	auto src_size = dir_size(src_path), dst_size = dir_size(dst_path);
+	auto src_postings = num_postings(src), dst_postings = num_postings(new_db);
+	std::cout
+		<< "\n             double        single\n"
+		<< "size(B)      " << src_size << "  " << dst_size
+		<< " (" << 100. * double(dst_size) / double(src_size) << "%)\n"
+		<< "postings     " << src_postings << "  " << dst_postings
+		<< " (" << 100. * double(dst_postings) / double(src_postings)
+		<< "%)\n";
+
+	if (argc == 4)
+	{
+		std::vector<std::string> queries;
+		std::ifstream ifs(argv[3]);
+		std::string line;
+		while (std::getline(ifs, line))
+			if (!line.empty())
+				queries.push_back(line);
+
+		if (!queries.empty())
+			std::cout
+				<< "latency(us)  " << mean_query_latency(src_path, queries)
+				<< "  " << mean_query_latency(dst_path, queries) << '\n';
+	}
+
+	return 0;
+}
@@ -0,0 +1,333 @@
+/**
+ * This file implements a tool that builds a new database from a page corpus
+ * (see corpus.h), instead of crawling the web again.
+ *
+ * It is for when the tokenization, the schema, the filters, or the date
+ * extraction change. The work is split into:
+ * 1. One thread reading the pages from the corpus.
+ * 2. Many threads parsing them and generating their terms, each with its own
+ * parser and term generator.
+ * 3. The main thread adding the documents to the db, the only part that must
+ * be done by one thread.
+ *
+ * The db is built with a large flush threshold, and compacted at the end.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <xapian.h>
+
+#include "../bounded_queue.h"
+#include "../corpus.h"
+#include "../index.h"
+#include "../text_store.h"
+#include "../trace.h"
+#include "../url_canon.h"
+#include "../utility.h"
+#include "indexing_common.h"
+
+namespace ch = std::chrono;
+
+// Documents are flushed every this many, unless set otherwise.
+constexpr unsigned DEF_FLUSH_THRESHOLD = 100000u;
+// Items each queue holds per worker.
+constexpr size_t QUEUE_CAPACITY_PER_THREAD = 64;
+
+struct seq_page
+{
+	// Order in the corpus, so that the later of two pages of a url wins.
+	std::uint64_t seq;
+	stored_page page;
+};
+
+struct seq_doc
+{
+	std::uint64_t seq;
+	index::prepared_doc doc;
+	// If its page is traced, so that the writer traces adding it too.
+	bool traced = false;
+};
+
+// @returns true if the page should be indexed, as the indexer would.
+static bool parse_page(
+	const url2html& conv, const class index& db, xp::TermGenerator& tg,
+	stored_page& p, bool use_htmldate, index::prepared_doc& out
+) {
+	// Only successful fetches. 0 is unknown, as for corpora without it.
+	if (p.status != 0 && (p.status < 200 || p.status >= 300))
+		return false;
+
+	auto parsed = urls::parse_uri(p.url);
+	if (!parsed.has_value())
+		return false;
+	urls::url u(*parsed);
+	if (!index_filter(u))
+		return false;
+
+	webpage pg(
+		urls::url(u),
+		conv.convert(u, p.body, std::move(p.headers), use_htmldate)
+	);
+	if (!wp_index_filter(pg))
+		return false;
+	// Keyed by its canonical url, as the indexer does.
+	if (auto c = pg.get_canonical_url(db.get_url_canon()); c && index_filter(*c))
+		u = std::move(*c);
+
+	const auto title = pg.get_title();
+	const auto text = pg.get_text();
+	// Same as index::add_document().
+	if (title.empty() && text.empty())
+		return false;
+
+	out = db.make_document(tg, u, title, pg.get_date(), text);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 3)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " corpus_dir db_path"
+			<< " [--threads=<n>] [--profile=default|single|compact]"
+			<< " [--store-text] [--no-htmldate] [--flush-threshold=<docs>]"
+			<< " [--trace=<file>] [--trace-sample=<rate>]"
+			<< " [--near-dups=off|link|skip] [--url-rules=<file>]"
+			<< " [--filter-rules=<file>]"
+			<< "\ndb_path must not exist. It is built in db_path.build first,"
+			<< " and then\ncompacted into db_path."
+			<< "\n--no-htmldate takes the dates only from the headers,"
+			<< " which is much faster,\nas htmldate runs on one thread at"
+			<< " a time."
+			<< "\n--trace writes the spans of the pages as a Chrome trace,"
+			<< " for ui.perfetto.dev.\n--trace-sample is the fraction of"
+			<< " the pages traced, 1 by default."
+			<< "\n--near-dups is what to do with a page whose text is nearly"
+			<< " that of an earlier one,\ne.g. a syndicated story: link it to"
+			<< " the first (default), or skip it."
+			<< "\n--url-rules are the url rules of the db (see rekey)."
+			<< "\n--filter-rules replaces the rules of the urls indexed"
+			<< " (see url_rules.h)."
+			<< std::endl;
+		return -1;
+	}
+	load_filter_rules(opts);
+	// Rather than finding it out after the whole corpus.
+	if (opts.contains("trace") && !std::ofstream(opts["trace"]))
+	{
+		std::cerr << "Cannot write the trace to " << opts["trace"] << ".\n";
+		return -1;
+	}
+
+	const fs::path corpus_dir(argv[1]);
+	const fs::path db_path(argv[2]);
+	auto build_path = db_path;
+	build_path += ".build";
+	if (fs::exists(db_path) || fs::exists(build_path))
+	{
+		std::cerr << db_path << " or " << build_path << " exists.\n";
+		return -1;
+	}
+
+	unsigned nthreads = opts.contains("threads") ?
+		static_cast<unsigned>(std::stoul(opts["threads"])) :
+		std::max(1u, std::thread::hardware_concurrency());
+	const bool use_htmldate = !opts.contains("no-htmldate");
+
+	// Read when the db is opened. All documents are new, so there is nothing
+	// to gain from flushing them early.
+	setenv(
+		"XAPIAN_FLUSH_THRESHOLD",
+		opts.contains("flush-threshold") ?
+			opts["flush-threshold"].c_str() :
+			std::to_string(DEF_FLUSH_THRESHOLD).c_str(),
+		1
+	);
+
+	global_init();
+
+	corpus_reader r(corpus_dir);
+	if (opts.contains("trace"))
+		tracer::global().start(
+			opts.contains("trace-sample") ?
+				std::stod(opts["trace-sample"]) : 1.
+		);
+	const auto start = ch::steady_clock::now();
+	unsigned long long num_read = 0, num_added = 0;
+	{
+		index::open_params par(build_path);
+		par.store_text = opts.contains("store-text");
+		if (opts.contains("profile"))
+			par.profile = opts["profile"];
+		if (opts.contains("near-dups"))
+			par.near_dups = index::near_dup_policy_from_name(opts["near-dups"]);
+		if (opts.contains("url-rules"))
+			par.url_rules = url_canon::read_rules(opts["url-rules"]);
+		class index db(par);
+
+		bounded_queue<seq_page> pages(QUEUE_CAPACITY_PER_THREAD * nthreads);
+		bounded_queue<seq_doc> docs(QUEUE_CAPACITY_PER_THREAD * nthreads);
+
+		// The first failure of any thread. It closes both queues, so that
+		// all the others stop, and is rethrown once they are joined.
+		std::mutex error_m;
+		std::exception_ptr error;
+		auto fail = [&](std::exception_ptr e) {
+			{
+				std::lock_guard lock(error_m);
+				if (!error)
+					error = std::move(e);
+			}
+			pages.close();
+			docs.close();
+		};
+
+		// htmldate is called from the workers.
+		url2html::release_gil();
+
+		std::thread reader([&] {
+			try
+			{
+				stored_page p;
+				std::uint64_t seq = 0;
+				while (r.next(p))
+					if (!pages.push({seq++, std::move(p)}))
+						break;
+				num_read = seq;
+			}
+			catch (...)
+			{
+				fail(std::current_exception());
+			}
+			pages.close();
+		});
+
+		std::atomic<unsigned> num_running{nthreads};
+		std::vector<std::thread> workers;
+		for (unsigned t = 0; t < nthreads; ++t)
+			workers.emplace_back([&] {
+				try
+				{
+					url2html conv;
+					auto tg = db.make_term_generator();
+					while (auto p = pages.pop())
+					{
+						seq_doc d{p->seq, {}};
+						trace_page traced(p->page.url);
+						try
+						{
+							if (!parse_page(
+								conv, db, tg, p->page, use_htmldate, d.doc
+							))
+								continue;
+						}
+						catch (const std::exception& e)
+						{
+							util_log(p->page.url + ": " + e.what());
+							continue;
+						}
+						d.traced = tracer::page_sampled;
+						docs.push(std::move(d));
+					}
+				}
+				catch (...)
+				{
+					fail(std::current_exception());
+				}
+				if (--num_running == 0)
+					docs.close();
+			});
+
+		// The urls in a fresh db are known, so most documents are simply
+		// added. A url seen again is replaced only by a later page of it.
+		std::unordered_map<std::string, std::uint64_t> seqs;
+		try
+		{
+			while (auto d = docs.pop())
+			{
+				auto [it, is_new] = seqs.try_emplace(d->doc.hashid, d->seq);
+				if (!is_new)
+				{
+					if (it->second > d->seq)
+						continue;
+					it->second = d->seq;
+				}
+
+				// The sampling is per thread, and the page was sampled, or
+				// not, on its worker.
+				tracer::page_sampled = d->traced;
+				const bool added = db.add_document(std::move(d->doc), is_new);
+				tracer::page_sampled = false;
+				if (added && ++num_added % 10000 == 0)
+					util_log(std::to_string(num_added) + " docs added.");
+			}
+		}
+		catch (...)
+		{
+			tracer::page_sampled = false;
+			fail(std::current_exception());
+		}
+
+		reader.join();
+		for (auto& w : workers)
+			w.join();
+		url2html::reacquire_gil();
+		if (error)
+			std::rethrow_exception(error);
+
+		db.synchronize();
+	}
+	global_uninit();
+	if (opts.contains("trace"))
+		try
+		{
+			tracer::global().stop_and_write(opts["trace"]);
+		}
+		catch (const std::runtime_error& e)
+		{
+			util_log(e.what());
+		}
+
+	const ch::duration<double> secs = ch::steady_clock::now() - start;
+	std::cout
+		<< num_read << " pages read, " << num_added << " docs added in "
+		<< secs.count() << "s ("
+		<< static_cast<double>(num_read) / secs.count() << " pages/s).\n"
+		<< "Compacting..." << std::endl;
+
+	// The compacted copy is smaller and faster to search.
+	const auto gen = index::text_gen_of(xp::Database(build_path.string()));
+	xp::Database(build_path.string()).compact(db_path.string());
+	if (text_store::exists(build_path))
+		fs::rename(
+			text_store::path_of(build_path, gen),
+			text_store::path_of(db_path, gen)
+		);
+	if (fs::exists(build_path / text_store::DICT_FILE_NAME))
+		fs::rename(
+			build_path / text_store::DICT_FILE_NAME,
+			db_path / text_store::DICT_FILE_NAME
+		);
+	fs::remove_all(build_path);
+
+	std::cout << "Done." << std::endl;
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * This file implements a tool that identifies the documents of a database by
+ * the keys of url_canon (see url_canon.h), e.g. for a db created before it,
+ * whose documents are identified by url_get_essential(), or to change the url
+ * rules of a db.
+ *
+ * Documents whose urls now have the same key are the same page, and only the
+ * first of them is kept.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../index.h"
+#include "../url_canon.h"
+#include "../utility.h"
+
+namespace ch = std::chrono;
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 2)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " db_path [--url-rules=<file>]"
+			<< "\n--url-rules replaces the url rules of the db with those in"
+			<< " file, one per line:\n  <host or *> keep|drop [<param>...]"
+			<< "\nkeep keeps the query of the urls of the host, without the"
+			<< " params and the\ntracking parameters, e.g. utm_*. The"
+			<< " default is \"* drop\"."
+			<< "\nStop the indexer and the updater first."
+			<< std::endl;
+		return -1;
+	}
+
+	std::optional<std::string> rules;
+	if (opts.contains("url-rules"))
+		rules = url_canon::read_rules(opts["url-rules"]);
+
+	class index db(argv[1]);
+	std::cout
+		<< "Rekeying " << db.num_documents() << " documents..."
+		<< std::endl;
+	const auto start = ch::steady_clock::now();
+	const auto res = db.rekey_urls(rules);
+	const ch::duration<double> secs = ch::steady_clock::now() - start;
+
+	std::cout
+		<< res.num_rekeyed << " rekeyed, " << res.num_merged
+		<< " merged as duplicates in " << secs.count() << "s.\n"
+		<< "The url rules are now:\n"
+		<< db.get_metadata(index::URL_RULES_KEY);
+	return 0;
+}
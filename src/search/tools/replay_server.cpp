@@ -0,0 +1,424 @@
+/**
+ * This file implements a stand-in for the web: an HTTP server on localhost,
+ * which the scrapers are pointed at with scraper::REPLAY_PROXY_ENV, so that
+ * crawling can be measured without fetching any real page.
+ *
+ * It acts as an HTTP proxy, and serves each url requested either
+ * 1. from a recorded corpus (see corpus.h), or
+ * 2. as a synthetic page generated from the url: an article with links to
+ * more articles on its host, in the url patterns the filters of
+ * indexing_common.h accept, or an RSS feed of them if the url looks like one.
+ *
+ * The web is not as nice, so latency, bandwidth, server errors, and 429s can
+ * be injected.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+#include "../corpus.h"
+#include "../utility.h"
+
+namespace ch = std::chrono;
+
+struct server_opts
+{
+	ch::milliseconds latency{0};
+	// Added to the latency, uniformly in [0, jitter].
+	ch::milliseconds jitter{0};
+	// KiB/s of each response. 0 for unlimited.
+	unsigned bandwidth = 0;
+	// Probabilities of a 500, and of a 429.
+	double error_rate = 0.0;
+	double throttle_rate = 0.0;
+	// Links in each synthetic page.
+	unsigned num_links = 20;
+	unsigned seed = 0;
+};
+
+struct request
+{
+	std::string target;
+	std::string host;
+	bool keep_alive = true;
+};
+
+static server_opts opts;
+static std::unique_ptr<corpus_lookup> recorded;
+
+static const char* const words[] {
+	"market", "growth", "inflation", "rates", "company", "earnings", "bank",
+	"investors", "shares", "profit", "economy", "trade", "tariffs", "jobs",
+	"startup", "funding", "merger", "deal", "revenue", "quarter", "stocks",
+	"bonds", "retail", "energy", "prices", "consumer", "strategy", "leaders",
+	"supply", "chain", "policy", "central", "forecast", "demand", "labor",
+	"wages", "housing", "credit", "debt", "exports",
+};
+constexpr size_t NUM_WORDS = sizeof(words) / sizeof(words[0]);
+
+// Feeds whose articles are on another host.
+static const std::map<std::string, std::string> feed_sites {
+	{"rss.nytimes.com", "www.nytimes.com"},
+	{"feeds.a.dj.com", "www.wsj.com"},
+	{"moxie.foxbusiness.com", "www.foxbusiness.com"},
+};
+
+static std::string http_date(std::time_t t)
+{
+	std::tm tm;
+	gmtime_r(&t, &tm);
+	char buf[64];
+	std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+static std::string words_of(std::mt19937_64& rng, unsigned n, char sep)
+{
+	std::string ret;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		if (i != 0)
+			ret.push_back(sep);
+		ret.append(words[rng() % NUM_WORDS]);
+	}
+	return ret;
+}
+
+// @returns a path of an article, e.g. /business/2025/07/14/a-b-c-123.
+static std::string article_path(std::mt19937_64& rng)
+{
+	const ch::year_month_day d{
+		ch::sys_days(ch::year(2025) / 1 / 1) + ch::days(rng() % 365)
+	};
+	char date[16];
+	std::snprintf(
+		date, sizeof(date), "%d/%02u/%02u",
+		static_cast<int>(d.year()), static_cast<unsigned>(d.month()),
+		static_cast<unsigned>(d.day())
+	);
+	return std::string("/business/") + date + "/" + words_of(rng, 3, '-') +
+		"-" + std::to_string(rng() % 1000000);
+}
+
+static std::string synth_article(const std::string& host, std::uint64_t h)
+{
+	std::mt19937_64 rng(h);
+	const auto title = words_of(rng, 6, ' ');
+	const ch::year_month_day d{
+		ch::sys_days(ch::year(2025) / 1 / 1) + ch::days(h % 365)
+	};
+	char date[16];
+	std::snprintf(
+		date, sizeof(date), "%d-%02u-%02u",
+		static_cast<int>(d.year()), static_cast<unsigned>(d.month()),
+		static_cast<unsigned>(d.day())
+	);
+
+	std::string ret;
+	ret.reserve(16 * 1024);
+	ret += "<!DOCTYPE html><html><head><title>" + title + "</title>";
+	ret += "<meta property=\"article:published_time\" content=\"";
+	ret += date;
+	ret += "\"></head><body><article><h1>" + title + "</h1>";
+	for (int i = 0; i < 8; ++i)
+		ret += "<p>" + words_of(rng, 60, ' ') + ".</p>";
+	ret += "</article><nav>";
+	for (unsigned i = 0; i < opts.num_links; ++i)
+	{
+		const auto path = article_path(rng);
+		ret += "<a href=\"https://" + host + path + "\">" +
+			words_of(rng, 4, ' ') + "</a>";
+	}
+	ret += "</nav></body></html>";
+	return ret;
+}
+
+static std::string synth_feed(const std::string& host, std::uint64_t h)
+{
+	std::mt19937_64 rng(h);
+	auto site = feed_sites.contains(host) ? feed_sites.at(host) : host;
+	const auto now = std::time(nullptr);
+
+	std::string ret =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+		"<rss version=\"2.0\"><channel><title>" + host + "</title>";
+	for (unsigned i = 0; i < opts.num_links; ++i)
+	{
+		ret += "<item><title>" + words_of(rng, 6, ' ') + "</title>";
+		ret += "<link>https://" + site + article_path(rng) + "</link>";
+		ret += "<pubDate>" + http_date(now - 3600 * i) + "</pubDate>";
+		ret += "<description>" + words_of(rng, 20, ' ') +
+			"</description></item>";
+	}
+	ret += "</channel></rss>";
+	return ret;
+}
+
+static bool looks_like_feed(std::string_view path)
+{
+	return path.contains("rss") || path.contains("feed") ||
+		path.ends_with(".xml");
+}
+
+/**
+ * Reads a request from fd into r, with buf keeping what is read past it.
+ * Bodies are not expected, as the scrapers only GET.
+ * @returns false if the connection is closed or the request is bad.
+ */
+static bool read_request(int fd, std::string& buf, request& r)
+{
+	size_t end;
+	while ((end = buf.find("\r\n\r\n")) == std::string::npos)
+	{
+		char chunk[4096];
+		auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+		if (n <= 0 || buf.size() > 64 * 1024)
+			return false;
+		buf.append(chunk, static_cast<size_t>(n));
+	}
+
+	const std::string head = buf.substr(0, end);
+	buf.erase(0, end + 4);
+
+	// GET <target> HTTP/1.x
+	const auto line_end = head.find("\r\n");
+	const std::string line = head.substr(0, line_end);
+	const auto sp1 = line.find(' ');
+	const auto sp2 = line.rfind(' ');
+	if (sp1 == std::string::npos || sp2 <= sp1)
+		return false;
+	r.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+	r.keep_alive = line.substr(sp2 + 1) == "HTTP/1.1";
+	r.host.clear();
+
+	size_t pos = line_end;
+	while (pos != std::string::npos && pos + 2 < head.size())
+	{
+		const auto next = head.find("\r\n", pos + 2);
+		auto field = head.substr(pos + 2, next - pos - 2);
+		const auto colon = field.find(':');
+		if (colon != std::string::npos)
+		{
+			auto name = field.substr(0, colon);
+			auto value = field.substr(colon + 1);
+			value.erase(0, value.find_first_not_of(' '));
+			for (auto& c : name)
+				c = static_cast<char>(std::tolower(c));
+
+			if (name == "host")
+				r.host = value;
+			else if (
+				(name == "connection" || name == "proxy-connection") &&
+				(value == "close" || value == "Close")
+			)
+				r.keep_alive = false;
+		}
+		pos = next;
+	}
+	return true;
+}
+
+// Sends all of data, at most at opts.bandwidth.
+static bool send_all(int fd, std::string_view data)
+{
+	const size_t chunk = opts.bandwidth == 0 ?
+		data.size() : std::max<size_t>(1024, opts.bandwidth * 1024 / 10);
+	while (!data.empty())
+	{
+		const auto start = ch::steady_clock::now();
+		const auto len = std::min(chunk, data.size());
+		size_t sent = 0;
+		while (sent < len)
+		{
+			auto n = ::send(fd, data.data() + sent, len - sent, MSG_NOSIGNAL);
+			if (n <= 0)
+				return false;
+			sent += static_cast<size_t>(n);
+		}
+		data.remove_prefix(len);
+
+		if (opts.bandwidth != 0)
+			std::this_thread::sleep_until(
+				start + ch::microseconds(len * 1000000 / opts.bandwidth / 1024)
+			);
+	}
+	return true;
+}
+
+static bool respond(
+	int fd, unsigned status, const char* reason,
+	const std::map<std::string, std::string>& headers,
+	const std::string& body, bool keep_alive
+) {
+	std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason +
+		"\r\n";
+	for (const auto& [k, v] : headers)
+		head += k + ": " + v + "\r\n";
+	head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	head += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+	head += "\r\n";
+
+	return send_all(fd, head) && send_all(fd, body);
+}
+
+static void serve(int fd, std::uint64_t conn_seed)
+{
+	std::mt19937_64 rng(conn_seed);
+	std::uniform_real_distribution<double> coin(0.0, 1.0);
+	std::string buf;
+	request r;
+
+	while (read_request(fd, buf, r))
+	{
+		// An absolute target when used as a proxy.
+		std::string rest;
+		if (r.target.starts_with("http://"))
+			rest = r.target.substr(7);
+		else
+			rest = r.host + r.target;
+		const auto slash = rest.find('/');
+		const auto host = rest.substr(0, slash);
+		const auto path = slash == std::string::npos ?
+			std::string("/") : rest.substr(slash);
+
+		auto wait = opts.latency;
+		if (opts.jitter.count() > 0)
+			wait += ch::milliseconds(rng() % (opts.jitter.count() + 1));
+		std::this_thread::sleep_for(wait);
+
+		std::map<std::string, std::string> headers {
+			{"Date", http_date(std::time(nullptr))}
+		};
+		bool ok;
+		if (coin(rng) < opts.error_rate)
+			ok = respond(fd, 500, "Internal Server Error", headers, "",
+				r.keep_alive);
+		else if (coin(rng) < opts.throttle_rate)
+		{
+			headers["Retry-After"] = "1";
+			ok = respond(fd, 429, "Too Many Requests", headers, "",
+				r.keep_alive);
+		}
+		else if (recorded)
+		{
+			// The scrapers turn https into http for the proxy.
+			auto p = recorded->find("https://" + host + path);
+			if (!p)
+				p = recorded->find("http://" + host + path);
+
+			if (p)
+			{
+				for (const auto& [k, v] : p->headers)
+					headers[k] = v;
+				ok = respond(fd, p->status ? p->status : 200, "OK", headers,
+					p->body, r.keep_alive);
+			}
+			else
+				ok = respond(fd, 404, "Not Found", headers, "", r.keep_alive);
+		}
+		else
+		{
+			const auto h = corpus::url_hash(host + path);
+			const bool feed = looks_like_feed(path);
+			headers["Content-Type"] = feed ?
+				"application/rss+xml; charset=utf-8" :
+				"text/html; charset=utf-8";
+			ok = respond(fd, 200, "OK", headers,
+				feed ? synth_feed(host, h) : synth_article(host, h),
+				r.keep_alive);
+		}
+
+		if (!ok || !r.keep_alive)
+			break;
+	}
+
+	::close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+	auto o = extract_opts(argc, argv);
+	if (argc != 2)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " port [--corpus=<dir>]"
+			<< " [--latency-ms=<n>] [--jitter-ms=<n>] [--bandwidth-kbps=<n>]"
+			<< " [--error-rate=<p>] [--429-rate=<p>] [--links=<n>]"
+			<< " [--seed=<n>]"
+			<< "\nServes the corpus, or synthetic pages without it, to"
+			<< " scrapers run with\nSEARCH_REPLAY_PROXY=http://127.0.0.1:port."
+			<< std::endl;
+		return -1;
+	}
+
+	if (o.contains("latency-ms"))
+		opts.latency = ch::milliseconds(std::stoul(o["latency-ms"]));
+	if (o.contains("jitter-ms"))
+		opts.jitter = ch::milliseconds(std::stoul(o["jitter-ms"]));
+	if (o.contains("bandwidth-kbps"))
+		opts.bandwidth = static_cast<unsigned>(std::stoul(o["bandwidth-kbps"]));
+	if (o.contains("error-rate"))
+		opts.error_rate = std::stod(o["error-rate"]);
+	if (o.contains("429-rate"))
+		opts.throttle_rate = std::stod(o["429-rate"]);
+	if (o.contains("links"))
+		opts.num_links = static_cast<unsigned>(std::stoul(o["links"]));
+	if (o.contains("seed"))
+		opts.seed = static_cast<unsigned>(std::stoul(o["seed"]));
+	if (o.contains("corpus"))
+	{
+		recorded = std::make_unique<corpus_lookup>(o["corpus"]);
+		std::cout << recorded->size() << " pages loaded." << std::endl;
+	}
+
+	const auto port = static_cast<std::uint16_t>(std::stoul(argv[1]));
+	int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (
+		sock < 0 ||
+		0 != ::bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+		0 != ::listen(sock, 1024)
+	) {
+		std::perror("Cannot listen");
+		return -1;
+	}
+	std::cout << "Listening on 127.0.0.1:" << port << std::endl;
+
+	std::uint64_t num_conns = 0;
+	while (true)
+	{
+		int fd = ::accept(sock, nullptr, nullptr);
+		if (fd < 0)
+			continue;
+		std::thread(serve, fd, opts.seed * 1000003ull + num_conns++).detach();
+	}
+}
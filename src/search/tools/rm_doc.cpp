@@ -11,45 +11,43 @@
 #include <iostream>
 #include <random>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/url.hpp>
 #include <xapian.h>
 
 #include "../index.h"
 
-std::random_device devrand;
-std::mt19937 pseudorand(devrand());
-std::uniform_real_distribution<float> prob(0.f, 1.f);
-
 std::unordered_map<std::string, float> domain_rm_prob{
 	{"www.businessinsider.com", .95f},
 };
 
-bool rm_func(xp::Document& doc)
+// Collects the docs to rm. Each thread has its own.
+struct rm_collector
 {
-	static unsigned num_rmed = 0;
+	std::vector<xp::docid> to_rm;
 
-	urls::url u(index::url_from_doc(doc));
+	void operator()(const index::scanned_doc& doc)
+	{
+		// Each thread needs its own generator.
+		thread_local std::mt19937 pseudorand(std::random_device{}());
+		std::uniform_real_distribution<float> prob(0.f, 1.f);
 
-	std::string key{u.encoded_host()};
-	if (!domain_rm_prob.contains(key))
-		return false;
+		urls::url u(index::url_from_doc(doc));
 
-	auto val{domain_rm_prob.at(key)};
-	if (prob(pseudorand) < val)
-	{
-		++num_rmed;
-		if (num_rmed % 500 == 1)
-		{
-			std::cout
-				<< std::to_string(num_rmed) 
-				<< "th removed.\n";
-		}
-		return true;
+		std::string key{u.encoded_host()};
+		if (!domain_rm_prob.contains(key))
+			return;
+
+		if (prob(pseudorand) < domain_rm_prob.at(key))
+			to_rm.push_back(doc.id);
 	}
 
-	return false;
-}
+	void merge(rm_collector&& other)
+	{
+		to_rm.insert(to_rm.end(), other.to_rm.begin(), other.to_rm.end());
+	}
+};
 
 int main(int argc, char* argv[])
 {
@@ -62,16 +60,32 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	class index db(argv[1]);
-
 	if (std::string("purge") == argv[2])
 	{
-		// Purge the database based on rm_func.
+		// Find them with read-only handles first, so that the db is locked
+		// only for the removal.
 		std::cout << "Purging...\n";
-		db.rm_if(rm_func);
+		index::scan_projection proj;
+		proj.data = true;
+		auto res = index::scan(argv[1], proj, rm_collector{});
+
+		class index db(argv[1]);
+		unsigned num_rmed = 0;
+		for (auto id : res.to_rm)
+		{
+			db.rm_document(id);
+			if (++num_rmed % 500 == 1)
+			{
+				std::cout
+					<< std::to_string(num_rmed) 
+					<< "th removed.\n";
+			}
+		}
 		return 0;
 	}
 
+	class index db(argv[1]);
+
 	// Don't purge. remove a specific url.
 	urls::url u(argv[2]);
 	if (!db.get_document(u).has_value())
@@ -0,0 +1,255 @@
+/**
+ * This file implements a benchmark of the searcher, which runs the queries of
+ * a file (misc/100_queries.txt by default) in process, and reports their
+ * latency, the throughput, and the sizes of the results.
+ *
+ * Unlike misc/search_eng_profiling.py, which times the searcher program, it
+ * does not count starting a process and opening the db, so the numbers are
+ * those of the matcher.
+ *
+ * Warm runs do a pass over the queries first, and then time the repeats,
+ * on the given number of threads. Cold runs drop the db files from the page
+ * cache and reopen the db before each query, on one thread.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <xapian.h>
+
+#include "../searcher.h"
+#include "../utility.h"
+
+namespace ch = std::chrono;
+
+constexpr unsigned DEF_REPEATS = 5u;
+
+struct sample
+{
+	double ms;
+	unsigned mset_size;
+	unsigned long long estimated;
+};
+
+static std::vector<std::string> load_queries(const fs::path& p)
+{
+	std::vector<std::string> ret;
+	std::ifstream ifs(p);
+	std::string line;
+	while (std::getline(ifs, line))
+		if (!line.empty())
+			ret.push_back(line);
+	return ret;
+}
+
+static std::uintmax_t dir_size(const fs::path& dir)
+{
+	std::uintmax_t ret = 0;
+	for (const auto& e : fs::recursive_directory_iterator(dir))
+		if (e.is_regular_file())
+			ret += e.file_size();
+	return ret;
+}
+
+/**
+ * Asks the kernel to drop the cached pages of the files in dir. It only
+ * drops the clean pages of files this process can open, which are all of
+ * them for a db that is not being written.
+ *
+ * @returns false if it failed for any file.
+ */
+static bool drop_cache(const fs::path& dir)
+{
+	bool ok = true;
+	for (const auto& e : fs::recursive_directory_iterator(dir))
+	{
+		if (!e.is_regular_file())
+			continue;
+		int fd = ::open(e.path().c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			ok = false;
+			continue;
+		}
+		ok &= 0 == ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(fd);
+	}
+	return ok;
+}
+
+static sample time_query(
+	searcher& s, const std::string& q, const searcher::query_params& par
+) {
+	const auto start = ch::steady_clock::now();
+	auto r = s.query(q, par);
+	const ch::duration<double, std::milli> ms =
+		ch::steady_clock::now() - start;
+	return {ms.count(), r.mset.size(), r.mset.get_matches_estimated()};
+}
+
+static void report(
+	const std::string& name, std::vector<sample>& ss, double wall_secs
+) {
+	if (ss.empty())
+	{
+		std::cout << name << ": no samples\n";
+		return;
+	}
+
+	std::sort(ss.begin(), ss.end(), [](const auto& a, const auto& b) {
+		return a.ms < b.ms;
+	});
+	double mset = 0., estimated = 0.;
+	for (const auto& s : ss)
+	{
+		mset += s.mset_size;
+		estimated += double(s.estimated);
+	}
+	const auto n = ss.size();
+
+	std::printf(
+		"%-24s %6zu %8.3f %8.3f %8.3f %8.3f %9.1f %7.1f %10.0f\n",
+		name.c_str(), n, ss[n / 2].ms, ss[n * 90 / 100].ms,
+		ss[n * 99 / 100].ms, ss.back().ms, double(n) / wall_secs,
+		mset / double(n), estimated / double(n)
+	);
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = extract_opts(argc, argv);
+	if (argc != 2)
+	{
+		std::cerr
+			<< "Usage:\n "
+			<< argv[0] << " db_path [--queries=<file>] [--repeats=<n>]"
+			<< " [--threads=<n>] [--cold] [--max-results=<n>]"
+			<< " [--date-ranges=<b>..<e>,...] [--collapse]"
+			<< "\n--queries defaults to misc/100_queries.txt."
+			<< "\n--date-ranges runs the queries again restricted to each"
+			<< " range, e.g.\n2025-01-01..2025-03-31."
+			<< "\n--cold drops the db from the page cache before each query,"
+			<< " and ignores\n--threads."
+			<< std::endl;
+		return -1;
+	}
+
+	const fs::path db_path(argv[1]);
+	const auto queries = load_queries(
+		opts.contains("queries") ? opts["queries"] : "misc/100_queries.txt"
+	);
+	if (queries.empty())
+	{
+		std::cerr << "No queries.\n";
+		return -1;
+	}
+	const unsigned repeats = opts.contains("repeats") ?
+		static_cast<unsigned>(std::stoul(opts["repeats"])) : DEF_REPEATS;
+	const bool cold = opts.contains("cold");
+	const unsigned nthreads = cold ? 1u : opts.contains("threads") ?
+		std::max(1u, static_cast<unsigned>(std::stoul(opts["threads"]))) : 1u;
+
+	searcher::query_params par;
+	if (opts.contains("max-results"))
+		par.max_num_results = std::stoul(opts["max-results"]);
+	if (opts.contains("collapse"))
+		par.collapse = true;
+
+	// "" is no range.
+	std::vector<std::string> ranges{""};
+	if (opts.contains("date-ranges"))
+		for (auto& r : split_opt_list(opts["date-ranges"]))
+			ranges.push_back(std::move(r));
+
+	std::cout
+		<< xp::Database(db_path.string()).get_doccount() << " docs, "
+		<< dir_size(db_path) / (1024 * 1024) << " MiB, "
+		<< queries.size() << " queries x " << repeats << " repeats, "
+		<< (cold ? "cold" : "warm") << ", " << nthreads << " thread(s)\n";
+	std::cout
+		<< "range                         n   p50 ms   p90 ms   p99 ms"
+		<< "   max ms       QPS    mset  estimated\n";
+
+	bool dropped = true;
+	for (const auto& range : ranges)
+	{
+		auto with_range = [&](const std::string& q) {
+			return range.empty() ? q : q + " " + range;
+		};
+
+		std::vector<sample> samples;
+		double wall_secs = 0.;
+		if (cold)
+		{
+			for (unsigned r = 0; r < repeats; ++r)
+				for (const auto& q : queries)
+				{
+					dropped &= drop_cache(db_path);
+					// A new searcher does not have Xapian's caches either.
+					searcher s(db_path);
+					samples.push_back(time_query(s, with_range(q), par));
+					wall_secs += samples.back().ms / 1000.;
+				}
+		}
+		else
+		{
+			// One searcher per thread, as a Xapian::Database is not meant
+			// to be used by many threads at once.
+			std::vector<std::unique_ptr<searcher>> ss;
+			for (unsigned t = 0; t < nthreads; ++t)
+				ss.push_back(std::make_unique<searcher>(db_path));
+			for (const auto& q : queries)
+				time_query(*ss[0], with_range(q), par);
+
+			const size_t total = size_t(repeats) * queries.size();
+			std::atomic<size_t> next{0};
+			std::vector<std::vector<sample>> per_thread(nthreads);
+			std::vector<std::thread> threads;
+
+			const auto start = ch::steady_clock::now();
+			for (unsigned t = 0; t < nthreads; ++t)
+				threads.emplace_back([&, t] {
+					for (size_t i; (i = next++) < total; )
+						per_thread[t].push_back(time_query(
+							*ss[t], with_range(queries[i % queries.size()]),
+							par
+						));
+				});
+			for (auto& th : threads)
+				th.join();
+			const ch::duration<double> secs =
+				ch::steady_clock::now() - start;
+			wall_secs = secs.count();
+
+			for (auto& v : per_thread)
+				samples.insert(samples.end(), v.begin(), v.end());
+		}
+
+		report(range.empty() ? "(none)" : range, samples, wall_secs);
+	}
+
+	if (cold && !dropped)
+		std::cerr
+			<< "Could not drop some db files from the page cache, so the"
+			<< " cold numbers may be\npartly warm.\n";
+
+	return 0;
+}
@@ -14,31 +14,73 @@
 #include "../utility.h"
 
 #include <iostream>
-#include <regex>
 #include <stdexcept>
 
-// I want to filter only English words from the main text.
-bool is_english_like(const std::string& term) 
-{
-	// Allow only lowercase alphabetic terms (min 2 chars)
-	static const std::regex word_re("[a-z]{2,}");
-	return std::regex_match(term, word_re);
-}
-
 int main(int argc, char* argv[])
 {
 	// Not needed.
 	// global_init();
 
+	auto opts = extract_opts(argc, argv);
 	if (argc < 3)
 	{
 		std::cerr 
 			<< "Usage:\n"
 			<< argv[0] << " db_path search_terms..."
+			<< " [--time-limit=<seconds>] [--check-at-least=<n>]"
+			<< " [--percent-cutoff=<0-100>] [--weight-cutoff=<w>]"
+			<< " [--order=relevance|date|blended] [--half-life=<days>]"
+			<< " [--freshness-weight=<w>] [--collapse]"
+			<< "\n--time-limit caps the time spent on --check-at-least, which"
+			<< " is how many\ndocuments are considered for the match count."
+			<< "\n--collapse returns one result per story, with the number of"
+			<< " similar ones\ncollapsed into it after its title."
 			<< std::endl;
 		return -1;
 	}
 
+	// Return at most 16 results.
+	searcher::query_params pars{16};
+	try
+	{
+		if (opts.contains("time-limit"))
+			pars.time_limit = std::stod(opts["time-limit"]);
+		if (opts.contains("check-at-least"))
+			pars.check_at_least = std::stoul(opts["check-at-least"]);
+		if (opts.contains("percent-cutoff"))
+			pars.percent_cutoff = std::stoi(opts["percent-cutoff"]);
+		if (opts.contains("weight-cutoff"))
+			pars.weight_cutoff = std::stod(opts["weight-cutoff"]);
+		if (opts.contains("order"))
+		{
+			using ordering = searcher::query_params::ordering;
+			const auto& o = opts["order"];
+			if (o == "relevance")
+				pars.order = ordering::RELEVANCE;
+			else if (o == "date")
+				pars.order = ordering::DATE;
+			else if (o == "blended")
+				pars.order = ordering::BLENDED;
+			else
+			{
+				std::cerr << "Unknown order: " << o << '\n';
+				return -1;
+			}
+		}
+		if (opts.contains("half-life"))
+			pars.half_life = std::stod(opts["half-life"]);
+		if (opts.contains("freshness-weight"))
+			pars.freshness_weight = std::stod(opts["freshness-weight"]);
+	}
+	catch (const std::logic_error&)
+	{
+		// std::invalid_argument or std::out_of_range of the conversions.
+		std::cerr << "Invalid option value. Run without args for usage.\n";
+		return -1;
+	}
+	if (opts.contains("collapse"))
+		pars.collapse = true;
+
 	searcher s(argv[1]);
 
 	std::string query_str;
@@ -53,51 +95,30 @@ int main(int argc, char* argv[])
 
 	try 
 	{
-		// Return at most 16 results.
-		xp::MSet result = s.query(query_str, {16});
+		auto [result, truncated] = s.query(query_str, pars);
 
-		std::cout << "Found " << result.size() << " results\n";
+		// Keep it on one line, as the pipeline trims the first two lines.
+		std::cout << "Found " << result.size() << " results";
+		if (truncated)
+			std::cout << " (counted until the time limit)";
+		std::cout << '\n';
 		for (auto i = result.begin(); i != result.end(); ++i)
 		{
 			auto doc = i.get_document();
-			std::cout << doc.get_data() << '\n';
+			std::cout << doc.get_data();
+			if (const auto n = i.get_collapse_count(); n != 0)
+				std::cout << " (+" << n << " similar)";
+			std::cout << '\n';
 
-			// Get a list of keywords from the document.
-			// I do not store the original text, because I don't
-			// want to use too much database space.
-			// I get all English words and evenly sample a few keywords from
-			// them.
-			std::vector<std::string> words;
-			// need at least 150 words.
-			words.reserve(150);
-			for (
-				auto it = doc.termlist_begin(); 
-				it != doc.termlist_end();
-				++it
-			) {
-				std::string term = *it;
-				// The main text are indexed using prefix XD
-				if (!term.starts_with("XD"))
-					continue;
-				term = term.substr(2);
-				if (term.empty())
-					continue;
-				// Given only english words.
-				if (!is_english_like(term))
-					continue;
-				
-				words.emplace_back(std::move(term));
-			}
-
-			// Evenly sample the list of words to get keywords
-			float step = words.size() > 150 ? 
-				float(words.size()) / 150.f :
-				1.f;
-			for (float i = 0.f; (size_t)i < words.size(); i+=step)
-			{
-				std::cout << words[(size_t)i] << ' ';
-			}
-			std::cout << "\n\n";
+			// Prefer a real snippet if the db keeps the texts.
+			// Otherwise, get a list of keywords from the document.
+			if (auto snip = s.snippet(result, doc))
+				std::cout << snip.value();
+			else
+				std::cout << index::keywords_from_doc(doc);
+			// Flushed per result, so that a caller that gives up early
+			// still reads the complete ones.
+			std::cout << "\n\n" << std::flush;
 		}
 	}
 	catch (const xp::Error& e)
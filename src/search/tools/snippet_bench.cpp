@@ -0,0 +1,164 @@
+/**
+ * This file implements a program that compares the cost of the three ways of
+ * showing a result's content in the searcher:
+ * 1. sampling keywords from the termlist (what it did originally),
+ * 2. reading the precomputed keywords,
+ * 3. generating a snippet from the compressed text store,
+ * and the size of the text store against the database.
+ *
+ * Copyright (C) Guanyuming He 2025
+ * The file is licensed under the GNU GPL v3.0
+ *
+ * @author Guanyuming He
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <xapian.h>
+
+#include "../index.h"
+#include "../searcher.h"
+#include "../text_store.h"
+
+namespace ch = std::chrono;
+
+struct timing
+{
+	explicit timing(const char* name) : name(name) {}
+
+	const char* name;
+	std::vector<double> us;
+	size_t out_bytes = 0;
+
+	void report() const
+	{
+		if (us.empty())
+		{
+			std::cout << name << ": no samples\n";
+			return;
+		}
+
+		auto sorted = us;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.;
+		for (auto t : sorted) sum += t;
+
+		std::cout
+			<< name << ": n=" << sorted.size()
+			<< " mean=" << sum / double(sorted.size()) << "us"
+			<< " p50=" << sorted[sorted.size() / 2] << "us"
+			<< " p99=" << sorted[sorted.size() * 99 / 100] << "us"
+			<< " avg_output=" << out_bytes / sorted.size() << "B\n";
+	}
+};
+
+// Times f() and adds its output size.
+template <typename F>
+void time_one(timing& t, F&& f)
+{
+	auto start = ch::steady_clock::now();
+	std::string out = f();
+	ch::duration<double, std::micro> elapsed =
+		ch::steady_clock::now() - start;
+
+	t.us.push_back(elapsed.count());
+	t.out_bytes += out.size();
+}
+
+static std::uintmax_t dir_size(const fs::path& dir)
+{
+	std::uintmax_t ret = 0;
+	for (const auto& e : fs::recursive_directory_iterator(dir))
+		if (e.is_regular_file())
+			ret += e.file_size();
+	return ret;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		std::cerr
+			<< "Usage:\n"
+			<< argv[0] << " <db_path> <queries_file>\n"
+			<< "where <queries_file> has one query per line, e.g. "
+			<< "src/misc/100_queries.txt\n";
+		return -1;
+	}
+
+	fs::path dbpath(argv[1]);
+	if (!text_store::exists(dbpath))
+	{
+		std::cerr << "The db has no text store. "
+			<< "Index it with --store-text first.\n";
+		return -1;
+	}
+
+	std::vector<std::string> queries;
+	{
+		std::ifstream ifs(argv[2]);
+		std::string line;
+		while (std::getline(ifs, line))
+			if (!line.empty())
+				queries.push_back(line);
+	}
+
+	searcher s(dbpath);
+	text_store ts(dbpath, false);
+
+	timing sampling{"termlist sampling"};
+	timing precomputed{"precomputed keywords"};
+	timing snippets{"text store snippet"};
+	size_t raw_text_bytes = 0, num_texts = 0;
+
+	for (const auto& q : queries)
+	{
+		// Same as the searcher program.
+		auto [mset, truncated] = s.query(q, {16});
+		for (auto i = mset.begin(); i != mset.end(); ++i)
+		{
+			auto doc = i.get_document();
+
+			time_one(sampling, [&] {
+				return index::sample_keywords(doc);
+			});
+			time_one(precomputed, [&] {
+				return index::keywords_from_doc(doc);
+			});
+
+			if (doc.get_value(index::TEXT_SLOT).empty())
+				continue;
+			time_one(snippets, [&] {
+				return s.snippet(mset, doc).value_or("");
+			});
+
+			raw_text_bytes += ts.get(doc.get_value(index::TEXT_SLOT)).size();
+			++num_texts;
+		}
+	}
+
+	std::cout << "Latency per result:\n";
+	sampling.report();
+	precomputed.report();
+	snippets.report();
+
+	auto store_size = ts.size_on_disk();
+	auto db_size = dir_size(dbpath) - store_size;
+	std::cout
+		<< "\nSize:\n"
+		<< "database (without the store): " << db_size << "B\n"
+		<< "text store: " << store_size << "B ("
+		<< 100. * double(store_size) / double(db_size)
+		<< "% of the database)\n";
+	if (num_texts != 0)
+		std::cout
+			<< "avg raw text of a result: "
+			<< raw_text_bytes / num_texts << "B\n";
+
+	return 0;
+}
@@ -51,15 +51,23 @@ bool replace_date_fun(xp::Document& doc)
 
 int main(int argc, char* argv[])
 {
-	if(argc != 2)
+	if(argc != 2 && argc != 3)
 	{
 		std::cerr 
 			<< "Usage: "
-			<< argv[0] << " db_path\n";
+			<< argv[0] << " db_path [dates]\n"
+			<< "dates adds the date bucket terms and DAYS_SLOT to the"
+			<< " documents"
+			<< " indexed before them.\n";
 		return -1;
 	}
 
 	class index i(argv[1]);
+	if (argc == 3 && std::string("dates") == argv[2])
+	{
+		i.add_missing_date_fields();
+		return 0;
+	}
 	i.upd_all(&replace_date_fun);
 
 	return 0;
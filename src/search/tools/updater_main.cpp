@@ -13,12 +13,15 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_set>
 
+#include "../corpus.h"
 #include "../index.h"
 #include "../indexer.h"
+#include "../metrics.h"
 #include "../url2rss.h"
 #include "../utility.h"
 #include "indexing_common.h"
@@ -46,7 +49,7 @@ static constexpr unsigned DEF_NUM_ADD = 1000;
  * 3. Then I call indexer::start_indexing()
  */
 void update_database(
-	const char* path, unsigned num_add
+	const index::open_params& db_par, unsigned num_add
 ) {
 	// These pages from RSS will only have a title and a link.
 	// I only need the links for indexing.
@@ -79,7 +82,7 @@ void update_database(
 	);
 
 	indexer idxer(
-		path, 
+		db_par, 
 		// It probably is not empty, after num_to_add is reached.
 		// But it is of little use to us now.
 		"./updater_que", 
@@ -95,6 +98,7 @@ void update_database(
 /*********************** THING 2 ***********************/
 // This is used if cmd arg does not have max_doc.
 static constexpr unsigned DEF_MAX_DOC = 100000;
+static constexpr ch::seconds DEF_METRICS_INTERVAL{15};
 /**
  * removes the oldest documents from the database,
  * until its size is within max_num_doc
@@ -110,19 +114,50 @@ int main(int argc, char* argv[])
 {
 	global_init();
 
+	auto opts = extract_opts(argc, argv);
 	if (argc < 2 || argc > 4)
 	{
 		std::cerr 
 		<< "Usage:\n"
-		<< argv[0] << "<db_path> [<num_to_add> [<max_num>]]\n"
+		<< argv[0] << "<db_path> [<num_to_add> [<max_num>]]"
+		" [--store-text] [--profile=default|single|compact]"
+		" [--archive=<dir>] [--metrics-prom=<file>] [--metrics-json=<file>]"
+		" [--log-file=<file>] [--log-level=0|1|2]"
+		" [--filter-rules=<file>]\n"
 		<< 
 		", where <num_to_add> is the max number of documents to update\n"
 		" from RSS feeds and <max_num> is the maximum number of documents\n"
 		" the database can have (i.e. the number to shrink the database\n"
 		" to). <num_to_add> defaults to 1000 and <max_num> defaults to \n"
-		"100000\n";
+		"100000\n"
+		"--store-text keeps the texts for snippets.\n"
+		"--profile sets how a new db indexes the texts (see index_profile.h).\n"
+		"--archive keeps the fetched pages in the corpus in dir (see"
+		" corpus.h).\n"
+		"--metrics-prom and --metrics-json write the metrics of the update"
+		" (see metrics.h).\n"
+		"--log-file, --log-level, and --filter-rules are as of the"
+		" indexer.\n";
 		return -1;
 	}
+	load_filter_rules(opts);
+
+	try
+	{
+		load_log_level(opts);
+	}
+	catch (const std::logic_error&)
+	{
+		std::cerr << "Invalid --log-level. Run without args for usage.\n";
+		return -1;
+	}
+	if (opts.contains("log-file"))
+		logger::global().open({opts["log-file"]});
+
+	index::open_params db_par(argv[1]);
+	db_par.store_text = opts.contains("store-text");
+	if (opts.contains("profile"))
+		db_par.profile = opts["profile"];
 
 	unsigned num_to_add = DEF_NUM_ADD;
 	unsigned max_num = DEF_MAX_DOC;
@@ -144,8 +179,27 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	update_database(argv[1], num_to_add);
+	std::unique_ptr<corpus_archiver> archive;
+	if (opts.contains("archive"))
+	{
+		archive = std::make_unique<corpus_archiver>(opts["archive"]);
+		scraper::set_archive(archive.get());
+	}
+
+	std::unique_ptr<metrics_exporter> exporter;
+	if (opts.contains("metrics-prom") || opts.contains("metrics-json"))
+		exporter = std::make_unique<metrics_exporter>(
+			metrics_registry::global(),
+			opts.contains("metrics-prom") ? opts["metrics-prom"] : "",
+			opts.contains("metrics-json") ? opts["metrics-json"] : "",
+			DEF_METRICS_INTERVAL
+		);
+
+	update_database(db_par, num_to_add);
+	scraper::set_archive(nullptr);
+	archive.reset();
 	shrink_database(argv[1], max_num);
+	exporter.reset();
 
 	global_uninit();
 
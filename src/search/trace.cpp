@@ -0,0 +1,171 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the tracing declared in trace.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+tracer& tracer::global()
+{
+	// Never destroyed, for the same reason as the logger.
+	static auto* t = new tracer;
+	return *t;
+}
+
+void tracer::start(double sample_rate)
+{
+	std::lock_guard lock(m);
+	for (auto& b : buffers)
+	{
+		std::lock_guard bl(b->m);
+		b->events.clear();
+		b->num_dropped = 0;
+	}
+	rate = std::clamp(sample_rate, 0., 1.);
+	num_pages = 0;
+	epoch = ch::steady_clock::now();
+	on.store(true, std::memory_order_release);
+}
+
+bool tracer::sample()
+{
+	// Page n is traced iff floor((n + 1) * rate) > floor(n * rate), which
+	// spreads them evenly.
+	const auto n = double(num_pages.fetch_add(1, std::memory_order_relaxed));
+	return std::floor((n + 1.) * rate) > std::floor(n * rate);
+}
+
+std::int64_t tracer::now_ns() const
+{
+	return ch::duration_cast<ch::nanoseconds>(
+		ch::steady_clock::now() - epoch
+	).count();
+}
+
+tracer::thread_buffer& tracer::local()
+{
+	static thread_local thread_buffer* b = nullptr;
+	if (!b)
+	{
+		std::lock_guard lock(m);
+		buffers.push_back(std::make_unique<thread_buffer>());
+		b = buffers.back().get();
+		b->tid = static_cast<unsigned>(buffers.size());
+	}
+	return *b;
+}
+
+void tracer::record(event&& e)
+{
+	auto& b = local();
+	std::lock_guard lock(b.m);
+	if (b.events.size() < MAX_EVENTS_PER_THREAD)
+		b.events.push_back(std::move(e));
+	else
+		++b.num_dropped;
+}
+
+// @returns s quoted as a JSON string.
+static std::string json_str(std::string_view s)
+{
+	std::string ret = "\"";
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+			ret += '\\';
+		if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char esc[8];
+			std::snprintf(esc, sizeof(esc), "\\u%04x", unsigned(c));
+			ret += esc;
+			continue;
+		}
+		ret += c;
+	}
+	return ret + '"';
+}
+
+void tracer::stop_and_write(const fs::path& p)
+{
+	on.store(false, std::memory_order_release);
+
+	std::ofstream ofs(p, std::ios::trunc);
+	if (!ofs)
+		throw std::runtime_error("Could not write the trace to " + p.string());
+
+	// Complete events ("ph": "X") with ts and dur in us.
+	ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	bool first = true;
+	std::lock_guard lock(m);
+	for (auto& b : buffers)
+	{
+		std::lock_guard bl(b->m);
+		if (b->events.empty())
+			continue;
+
+		ofs
+			<< (first ? "" : ",\n")
+			<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1,"
+			<< " \"tid\": " << b->tid << ", \"args\": {\"name\": \"thread "
+			<< b->tid << "\"}}";
+		first = false;
+
+		for (const auto& e : b->events)
+		{
+			char times[64];
+			std::snprintf(
+				times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f",
+				double(e.start_ns) / 1000., double(e.dur_ns) / 1000.
+			);
+			ofs
+				<< ",\n{\"name\": \"" << e.name
+				<< "\", \"cat\": \"crawl\", \"ph\": \"X\", " << times
+				<< ", \"pid\": 1, \"tid\": " << b->tid;
+			if (!e.url.empty())
+				ofs << ", \"args\": {\"url\": " << json_str(e.url) << '}';
+			ofs << '}';
+		}
+		if (b->num_dropped != 0)
+			ofs
+				<< ",\n{\"name\": \"" << b->num_dropped
+				<< " events dropped\", \"ph\": \"i\", \"s\": \"t\","
+				<< " \"ts\": 0, \"pid\": 1, \"tid\": " << b->tid << '}';
+		b->events.clear();
+	}
+	ofs << "\n]}\n";
+
+	if (!ofs.flush())
+		throw std::runtime_error("Could not write the trace to " + p.string());
+}
+
+trace_page::trace_page(std::string_view url)
+{
+	auto& t = tracer::global();
+	if (!t.enabled() || !t.sample())
+		return;
+
+	active = true;
+	tracer::page_sampled = true;
+	this->url = url;
+	start = t.now_ns();
+}
+
+trace_page::~trace_page()
+{
+	if (!active)
+		return;
+
+	auto& t = tracer::global();
+	t.record({"page", start, t.now_ns() - start, std::move(url)});
+	tracer::page_sampled = false;
+}
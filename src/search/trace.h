@@ -0,0 +1,154 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the tracing of pages through the crawl: how long each of
+ * fetch, parse, date, filter, links, index, and commit took for a page, and
+ * on which thread, written in Chrome's trace event format, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing show as a timeline.
+ *
+ * Only a sample of the pages is traced. When tracing is off, a span costs a
+ * read of a thread local bool.
+ *
+ * @author Guanyuming He
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ch = std::chrono;
+namespace fs = std::filesystem;
+
+class tracer final
+{
+public:
+	struct event
+	{
+		// A literal.
+		const char* name;
+		// Since start(), in ns.
+		std::int64_t start_ns;
+		std::int64_t dur_ns;
+		// The url of a page, or "".
+		std::string url;
+	};
+
+	// Events kept per thread. Those after are dropped.
+	static constexpr size_t MAX_EVENTS_PER_THREAD = 1u << 20;
+
+	static tracer& global();
+
+	tracer(const tracer&) = delete;
+	tracer& operator=(const tracer&) = delete;
+
+public:
+	/**
+	 * Starts tracing, forgetting the events before.
+	 * @param sample_rate in (0, 1], the fraction of the pages traced. They
+	 * are evenly spread, e.g. every 100th page for 0.01.
+	 */
+	void start(double sample_rate = 1.);
+	/**
+	 * Stops tracing, and writes the events to p as a JSON trace.
+	 * The threads that traced should be done with their pages.
+	 * @throws std::runtime_error if p cannot be written.
+	 */
+	void stop_and_write(const fs::path& p);
+
+	inline bool enabled() const
+	{ return on.load(std::memory_order_relaxed); }
+
+	// @returns whether to trace the next page.
+	bool sample();
+	std::int64_t now_ns() const;
+	void record(event&& e);
+
+	// If the page the thread is processing is traced.
+	static inline thread_local bool page_sampled = false;
+
+private:
+	tracer() = default;
+
+	struct thread_buffer
+	{
+		// Only contended when the events are written.
+		std::mutex m;
+		std::vector<event> events;
+		unsigned tid;
+		size_t num_dropped = 0;
+	};
+
+	std::atomic<bool> on{false};
+	double rate = 1.;
+	std::atomic<std::uint64_t> num_pages{0};
+	ch::steady_clock::time_point epoch{};
+
+	// Owned here, so that they outlive their threads until written.
+	std::mutex m;
+	std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+	thread_buffer& local();
+};
+
+/**
+ * Traces a page for its lifetime, if it is sampled, and so the spans in the
+ * same thread meanwhile. Not nestable.
+ */
+class trace_page final
+{
+public:
+	explicit trace_page(std::string_view url);
+	~trace_page();
+
+	trace_page(const trace_page&) = delete;
+	trace_page& operator=(const trace_page&) = delete;
+
+private:
+	bool active = false;
+	std::int64_t start = 0;
+	std::string url;
+};
+
+/**
+ * Records its lifetime as a span named name, if the page of the thread is
+ * traced. name must be a literal.
+ * With always, it is recorded whenever tracing is on, for work that is not
+ * of one page, e.g. a commit.
+ */
+class trace_span final
+{
+public:
+	explicit trace_span(const char* name, bool always = false):
+		name(name),
+		active(
+			tracer::page_sampled || (always && tracer::global().enabled())
+		)
+	{
+		if (active)
+			start = tracer::global().now_ns();
+	}
+	~trace_span()
+	{
+		if (active)
+		{
+			auto& t = tracer::global();
+			t.record({name, start, t.now_ns() - start, {}});
+		}
+	}
+
+	trace_span(const trace_span&) = delete;
+	trace_span& operator=(const trace_span&) = delete;
+
+private:
+	const char* name;
+	const bool active;
+	std::int64_t start = 0;
+};
@@ -8,6 +8,8 @@
  */
 
 #include "url2html.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <cctype>
 #include <lexbor/html/tokenizer.h>
@@ -23,6 +25,7 @@ extern "C" {
 #include <curl/easy.h>
 }
 
+#include <algorithm>
 #include <iomanip>
 #include <chrono>
 #include <ranges>
@@ -35,6 +38,19 @@ extern "C" {
 PyObject* url2html::htmldate_module;
 PyObject* url2html::find_date_func;
 
+// The state of the main thread while it does not hold the GIL.
+static PyThreadState* main_state = nullptr;
+
+namespace
+{
+	// Holds the GIL in its lifetime. Nesting is fine.
+	struct gil_guard
+	{
+		PyGILState_STATE s = PyGILState_Ensure();
+		~gil_guard() { PyGILState_Release(s); }
+	};
+}
+
 html::~html()
 {
 	lxb_html_document_destroy(handle);
@@ -131,6 +147,53 @@ std::vector<std::string> html::get_urls() const
     return urls;
 }
 
+std::optional<std::string> html::get_canonical() const
+{
+	auto* links = lxb_dom_collection_make(&handle->dom_document, 16);
+	if (!links)
+		throw std::runtime_error("Could not make lexbor collection.");
+
+	auto status = lxb_dom_elements_by_tag_name(
+		lxb_dom_interface_element(handle),
+		links,
+		(const lxb_char_t*)"link", 4
+	);
+	if (LXB_STATUS_OK != status)
+	{
+		lxb_dom_collection_destroy(links, true);
+		throw std::runtime_error("Can't get HTML link tags.");
+	}
+
+	std::optional<std::string> ret;
+	for (size_t i = 0; !ret && i < lxb_dom_collection_length(links); ++i)
+	{
+		auto* element = lxb_dom_collection_element(links, i);
+		size_t len;
+		auto* rel = lxb_dom_element_get_attribute(
+			element, (const lxb_char_t*)"rel", 3, &len
+		);
+		if (!rel)
+			continue;
+
+		// rel is a list of space separated, case-insensitive tokens.
+		std::string rels((const char*)rel, len);
+		std::ranges::transform(rels, rels.begin(), [](unsigned char c) {
+			return std::isspace(c) ? ' ' : char(std::tolower(c));
+		});
+		if (!(" " + rels + " ").contains(" canonical "))
+			continue;
+
+		auto* href = lxb_dom_element_get_attribute(
+			element, (const lxb_char_t*)"href", 4, &len
+		);
+		if (href && len != 0)
+			ret.emplace((const char*)href, len);
+	}
+
+	lxb_dom_collection_destroy(links, true);
+	return ret;
+}
+
 
 std::optional<ch::year_month_day>
 html::try_parse_header_date() const 
@@ -253,19 +316,53 @@ html url2html::convert(
 		{ "date", "" }
 	};
 
+	const auto start = ch::steady_clock::now();
 	std::string content{ s.transfer(url, headers) };	
+	auto fetched = ch::steady_clock::now();
+
+	auto ret = convert(url, content, std::move(headers));
+	last_times.fetch = fetched - start;
+
+	static auto& fetch_h = stage_histogram("fetch");
+	fetch_h.observe(last_times.fetch);
+	return ret;
+}
+
+html url2html::convert(
+	const urls::url& url, const std::string& content,
+	std::map<std::string, std::string> headers, bool use_htmldate
+) const
+{
 	// curl returns char array, but lxb expect unsigned char array.
 	// Anyway, if lxb only expected bytes, then it's fine.
+	const auto start = ch::steady_clock::now();
 	std::string text;
-	auto* doc =  p.parse(
-		reinterpret_cast<const lxb_char_t*>(content.c_str()),
-	   	content.size(),
-		&text
-	);
+	lxb_html_document_t* doc;
+	{
+		trace_span span("parse");
+		doc = p.parse(
+			reinterpret_cast<const lxb_char_t*>(content.c_str()),
+			content.size(),
+			&text
+		);
+	}
+	const auto parsed = ch::steady_clock::now();
 
-	auto date_from_html = date_outof_html(
-		content, url
-	);
+	std::optional<ch::year_month_day> date_from_html;
+	if (use_htmldate)
+	{
+		trace_span span("date");
+		date_from_html = date_outof_html(content, url);
+	}
+	last_times = {
+		ch::nanoseconds{0}, parsed - start, ch::steady_clock::now() - parsed
+	};
+
+	static auto& parse_h = stage_histogram("parse");
+	static auto& date_h = stage_histogram("date");
+	parse_h.observe(last_times.parse);
+	if (use_htmldate)
+		date_h.observe(last_times.date);
 	return html(
 		doc, 
 		std::move(headers), std::move(text),
@@ -286,6 +383,9 @@ url2html::date_outof_html(
 	)
 		return std::nullopt;
 
+	// Other threads may be calling it.
+	gil_guard gil;
+
 	PyObject* prop_args = nullptr;
 	PyObject* kw_args = nullptr;
 	
@@ -387,6 +487,17 @@ void url2html::global_init()
     }
 }
 
+void url2html::release_gil()
+{
+	main_state = PyEval_SaveThread();
+}
+
+void url2html::reacquire_gil()
+{
+	PyEval_RestoreThread(main_state);
+	main_state = nullptr;
+}
+
 void url2html::global_uninit()
 {
 	Py_DECREF(find_date_func);
@@ -98,6 +98,13 @@ public:
 	 */
 	std::vector<std::string> get_urls() const;
 
+	/**
+	 * @returns the href of the first <link rel="canonical">, as-is like
+	 * get_urls(), if there is one. The page says that it is a variant of
+	 * that url, e.g. an AMP or a mobile version.
+	 */
+	std::optional<std::string> get_canonical() const;
+
 private:
 	lxb_html_document_t* handle;
 	// May be passed through ctor.
@@ -210,10 +217,38 @@ public:
 	 * as I need its c_str().
 	 */
 	html convert(const urls::url& url) const;
+	/**
+	 * Converts the content fetched from url before, e.g. from a corpus.
+	 * Unlike the scraper, it needs no network, and so several threads can
+	 * each do it with their own url2html.
+	 *
+	 * @param headers as fetched. Only those named in convert(url) are used.
+	 * @param use_htmldate if false, the date is only from the headers, which
+	 * is much faster, as htmldate runs one at a time under Python's GIL.
+	 */
+	html convert(
+		const urls::url& url, const std::string& content,
+		std::map<std::string, std::string> headers, bool use_htmldate = true
+	) const;
+
+	// How long each stage of the last convert() took. Each is also observed
+	// in its stage_histogram() (see metrics.h).
+	struct stage_times
+	{
+		// 0 if the content was not fetched.
+		ch::nanoseconds fetch;
+		ch::nanoseconds parse;
+		// Of htmldate.
+		ch::nanoseconds date;
+	};
+	inline const stage_times& get_last_times() const
+	{ return last_times; }
 
 private:
 	scraper s;
 	parser p;
+	// Measuring is far cheaper than any of the stages.
+	mutable stage_times last_times{};
 
 public:
 	/**
@@ -235,6 +270,16 @@ public:
 	static void global_init();
 	static void global_uninit();
 
+	/**
+	 * After global_init(), the main thread holds Python's GIL, so no other
+	 * thread could call date_outof_html(). The main thread releases it with
+	 * release_gil() before starting them, after which each call takes the
+	 * GIL in turn, and takes it back with reacquire_gil() after they finish
+	 * and before global_uninit().
+	 */
+	static void release_gil();
+	static void reacquire_gil();
+
 private:
 	static constexpr const char* module_name = "htmldate";
 	static PyObject* htmldate_module;
@@ -0,0 +1,251 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the url canonicalization declared in url_canon.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "url_canon.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+const std::vector<std::string> url_canon::TRACKING_PARAMS {
+	"utm_*", "fbclid", "gclid", "dclid", "msclkid", "yclid", "igshid",
+	"mc_cid", "mc_eid", "_ga", "_gl", "ref", "ref_src", "cmpid", "icid",
+	"ncid", "ocid", "taid", "sr_share",
+};
+
+static inline char lower(char c)
+{
+	return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// @returns host lowercased, without its www.
+static std::string host_name(std::string_view host)
+{
+	std::string ret(host);
+	std::ranges::transform(ret, ret.begin(), lower);
+	if (ret.starts_with("www.") && ret.size() > 4)
+		ret.erase(0, 4);
+	return ret;
+}
+
+void url_canon::set_rule(std::string_view host, host_rule r)
+{
+	if (host == "*")
+		def_rule = std::move(r);
+	else
+		rules.insert_or_assign(host_name(host), std::move(r));
+}
+
+void url_canon::parse_rules(std::string_view text)
+{
+	url_canon parsed;
+
+	std::istringstream is{std::string(text)};
+	std::string line;
+	while (std::getline(is, line))
+	{
+		std::istringstream ls(line);
+		std::string host, action;
+		if (!(ls >> host) || host.starts_with('#'))
+			continue;
+		if (!(ls >> action) || (action != "keep" && action != "drop"))
+			throw std::runtime_error("Invalid url rule: " + line);
+
+		host_rule r{action == "keep", {}};
+		for (std::string p; ls >> p;)
+			r.strip.push_back(std::move(p));
+		parsed.set_rule(host, std::move(r));
+	}
+	*this = std::move(parsed);
+}
+
+std::string url_canon::read_rules(const fs::path& p)
+{
+	std::ifstream ifs(p);
+	if (!ifs)
+		throw std::runtime_error("Could not read url rules from " + p.string());
+	return std::string(
+		std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()
+	);
+}
+
+std::string url_canon::rules_text() const
+{
+	auto line = [](std::string_view host, const host_rule& r) {
+		std::string ret(host);
+		ret += r.keep_query ? " keep" : " drop";
+		for (const auto& p : r.strip)
+			ret += ' ' + p;
+		return ret + '\n';
+	};
+
+	std::vector<std::string_view> hosts;
+	for (const auto& [h, r] : rules)
+		hosts.push_back(h);
+	std::ranges::sort(hosts);
+
+	auto ret = line("*", def_rule);
+	for (auto h : hosts)
+		ret += line(h, rules.find(h)->second);
+	return ret;
+}
+
+const url_canon::host_rule& url_canon::rule_of(std::string_view host) const
+{
+	if (rules.empty())
+		return def_rule;
+
+	for (;;)
+	{
+		if (auto it = rules.find(host); it != rules.end())
+			return it->second;
+		const auto dot = host.find('.');
+		if (dot == std::string_view::npos)
+			return def_rule;
+		host.remove_prefix(dot + 1);
+	}
+}
+
+bool url_canon::stripped(std::string_view name, const host_rule& r)
+{
+	auto matches = [name](std::string_view p) {
+		if (p.ends_with('*'))
+			return name.starts_with(p.substr(0, p.size() - 1));
+		return name == p;
+	};
+	return std::ranges::any_of(TRACKING_PARAMS, matches) ||
+		std::ranges::any_of(r.strip, matches);
+}
+
+static inline int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = lower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+// Appends s to out, with the unreserved characters decoded, and the hex
+// digits of the others in upper case.
+static void append_normalized(std::string& out, std::string_view s)
+{
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		const int hi = i + 2 < s.size() && s[i] == '%' ?
+			hex_value(s[i + 1]) : -1;
+		const int lo = hi >= 0 ? hex_value(s[i + 2]) : -1;
+		if (lo < 0)
+		{
+			out += s[i];
+			continue;
+		}
+
+		const char c = char(hi * 16 + lo);
+		if (
+			(c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			(c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+			c == '~'
+		)
+			out += c;
+		else
+		{
+			constexpr const char* HEX = "0123456789ABCDEF";
+			out += '%';
+			out += HEX[hi];
+			out += HEX[lo];
+		}
+		i += 2;
+	}
+}
+
+void url_canon::key(urls::url_view u, std::string& out) const
+{
+	out.clear();
+
+	const std::string_view host = u.encoded_host();
+	for (char c : host)
+		out += lower(c);
+	if (out.starts_with("www.") && out.size() > 4)
+		out.erase(0, 4);
+	// Before out grows any more.
+	const host_rule& r = rule_of(out);
+
+	if (u.has_port())
+	{
+		const std::string_view port = u.port();
+		const bool is_default =
+			(u.scheme_id() == urls::scheme::http && port == "80") ||
+			(u.scheme_id() == urls::scheme::https && port == "443");
+		if (!port.empty() && !is_default)
+		{
+			out += ':';
+			out += port;
+		}
+	}
+
+	// Each segment is normalized first, so that %2E%2E is also a "..".
+	const size_t path_begin = out.size();
+	std::string_view path = u.encoded_path();
+	if (path.starts_with('/'))
+		path.remove_prefix(1);
+	while (!u.encoded_path().empty())
+	{
+		const auto slash = std::min(path.find('/'), path.size());
+		const size_t seg_begin = out.size();
+		out += '/';
+		append_normalized(out, path.substr(0, slash));
+
+		const std::string_view seg = std::string_view(out).substr(seg_begin);
+		if (seg == "/.")
+			out.resize(seg_begin);
+		else if (seg == "/..")
+		{
+			out.resize(seg_begin);
+			const auto prev = out.rfind('/');
+			if (prev != std::string::npos && prev >= path_begin)
+				out.resize(prev);
+		}
+
+		if (slash == path.size())
+			break;
+		path.remove_prefix(slash + 1);
+	}
+	if (out.size() > path_begin && out.back() == '/')
+		out.pop_back();
+
+	if (!r.keep_query || !u.has_query())
+		return;
+
+	thread_local std::vector<std::string_view> params;
+	params.clear();
+	std::string_view q = u.encoded_query();
+	while (!q.empty())
+	{
+		const auto amp = std::min(q.find('&'), q.size());
+		const auto p = q.substr(0, amp);
+		if (!p.empty() && !stripped(p.substr(0, p.find('=')), r))
+			params.push_back(p);
+		q.remove_prefix(std::min(amp + 1, q.size()));
+	}
+	if (params.empty())
+		return;
+
+	std::ranges::sort(params);
+	char sep = '?';
+	for (auto p : params)
+	{
+		out += sep;
+		append_normalized(out, p);
+		sep = '&';
+	}
+}
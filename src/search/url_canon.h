@@ -0,0 +1,108 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the canonicalization of urls into the keys that identify
+ * their pages, e.g. in index::url2hashid() and in the crawl queue.
+ *
+ * url_get_essential() only drops the query, the fragment, and a trailing
+ * slash, so that e.g. HTTPS://WWW.abc.com:443/a/./b and https://abc.com/a/b
+ * were different pages. Here, they have the same key.
+ *
+ * @author Guanyuming He
+ */
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/url.hpp>
+
+namespace fs = std::filesystem;
+namespace urls = boost::urls;
+
+class url_canon final
+{
+public:
+	/**
+	 * What of the query of a url identifies its page, for the urls of a
+	 * host.
+	 */
+	struct host_rule
+	{
+		// If false, the query is dropped, as most news sites only use it
+		// for tracking.
+		bool keep_query = false;
+		// Parameters dropped from a kept query. A trailing * matches any
+		// suffix, e.g. utm_*.
+		std::vector<std::string> strip{};
+	};
+
+	// Dropped from every kept query, in addition to those of a rule.
+	static const std::vector<std::string> TRACKING_PARAMS;
+
+	// Drops the query of all hosts.
+	url_canon() = default;
+
+	/**
+	 * Sets the rule of host, which also applies to its subdomains, unless
+	 * they have their own. "*" sets the default.
+	 */
+	void set_rule(std::string_view host, host_rule r);
+	/**
+	 * Replaces the rules with those in text, one per line:
+	 *   <host or *> keep|drop [<param>...]
+	 * Empty lines and those starting with # are ignored.
+	 * @throws std::runtime_error if a line is invalid, and then the rules
+	 * are unchanged.
+	 */
+	void parse_rules(std::string_view text);
+	/**
+	 * @returns the text of the rules file p.
+	 * @throws std::runtime_error if it cannot be read.
+	 */
+	static std::string read_rules(const fs::path& p);
+	// @returns the text of the rules, as parse_rules() reads.
+	std::string rules_text() const;
+
+	/**
+	 * Writes the key of u into out, replacing what it had:
+	 *   host[:port]path[?query]
+	 * 1. host is lowercased, without its www., and without the default port
+	 * of the scheme.
+	 * 2. path has its dot segments removed, its percent encoding
+	 * normalized, i.e. unreserved characters decoded and the hex digits
+	 * in upper case, and its trailing slash removed.
+	 * 3. query is kept only if the rule of the host says so, without the
+	 * tracking parameters, and sorted.
+	 * The scheme, the user info and the fragment are dropped.
+	 *
+	 * Allocates nothing once out and the thread's buffers are large enough.
+	 */
+	void key(urls::url_view u, std::string& out) const;
+	inline std::string key(urls::url_view u) const
+	{
+		std::string ret;
+		key(u, ret);
+		return ret;
+	}
+
+private:
+	struct str_hash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const
+		{ return std::hash<std::string_view>{}(s); }
+	};
+	std::unordered_map<std::string, host_rule, str_hash, std::equal_to<>>
+		rules;
+	host_rule def_rule{};
+
+	// @returns the rule of host, or of its closest parent domain.
+	const host_rule& rule_of(std::string_view host) const;
+	static bool stripped(std::string_view name, const host_rule& r);
+};
@@ -0,0 +1,327 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the url filter rules declared in url_rules.h
+ *
+ * @author Guanyuming He
+ */
+
+#include "url_rules.h"
+
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+
+static inline bool is_digit(char c)
+{ return c >= '0' && c <= '9'; }
+static inline bool is_alpha(char c)
+{ return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+
+bool has_dates(std::string_view p)
+{
+	// A date starts at the beginning or after a /, is three runs of digits
+	// separated by - or /, and ends at the end or before a /.
+	for (size_t i = 0; i < p.size(); ++i)
+	{
+		if (i != 0 && p[i - 1] != '/')
+			continue;
+
+		size_t lens[3];
+		size_t j = i;
+		bool ok = true;
+		for (unsigned k = 0; k < 3; ++k)
+		{
+			if (k != 0)
+			{
+				if (j == p.size() || (p[j] != '-' && p[j] != '/'))
+				{
+					ok = false;
+					break;
+				}
+				++j;
+			}
+			const size_t b = j;
+			while (j < p.size() && is_digit(p[j]))
+				++j;
+			lens[k] = j - b;
+		}
+		if (!ok || (j != p.size() && p[j] != '/'))
+			continue;
+
+		auto day_or_month = [](size_t l) { return l == 1 || l == 2; };
+		// yyyy-mm-dd or dd-mm-yyyy, in either order of day and month.
+		if (
+			(lens[0] == 4 && day_or_month(lens[1]) && day_or_month(lens[2])) ||
+			(day_or_month(lens[0]) && day_or_month(lens[1]) && lens[2] == 4)
+		)
+			return true;
+	}
+	return false;
+}
+
+bool has_words_separated_by_dash(std::string_view p)
+{
+	size_t i = 0;
+	while (i < p.size())
+	{
+		if (!is_alpha(p[i]))
+		{
+			++i;
+			continue;
+		}
+
+		// A letter, then at least two -word.
+		size_t j = i + 1;
+		unsigned num_words = 0;
+		while (j + 1 < p.size() && p[j] == '-' && is_alpha(p[j + 1]))
+		{
+			j += 2;
+			while (j < p.size() && is_alpha(p[j]))
+				++j;
+			if (++num_words == 2)
+				return true;
+		}
+		// Starting anywhere before j finds no more words.
+		i = j;
+	}
+	return false;
+}
+
+std::uint64_t url_rules::host_rules::bit_of(predicate&& p)
+{
+	for (size_t i = 0; i < preds.size(); ++i)
+		if (
+			preds[i].kind == p.kind && preds[i].arg == p.arg &&
+			preds[i].n == p.n
+		)
+			return std::uint64_t(1) << i;
+
+	if (preds.size() == MAX_PREDICATES)
+		throw std::runtime_error("too many predicates for the host.");
+	const auto bit = std::uint64_t(1) << preds.size();
+	if (p.kind == pred_kind::PREFIX)
+	{
+		add_prefix(p.arg, bit);
+		prefix_bits |= bit;
+	}
+	preds.push_back(std::move(p));
+	return bit;
+}
+
+void url_rules::host_rules::add_prefix(std::string_view s, std::uint64_t bit)
+{
+	std::uint32_t node = 0;
+	for (char c : s)
+	{
+		std::uint32_t child = trie[node].first_child;
+		while (child != 0 && trie[child].c != c)
+			child = trie[child].next_sibling;
+		if (child == 0)
+		{
+			child = static_cast<std::uint32_t>(trie.size());
+			trie.push_back({c, 0, trie[node].first_child, 0});
+			trie[node].first_child = child;
+		}
+		node = child;
+	}
+	trie[node].bits |= bit;
+}
+
+std::uint64_t url_rules::host_rules::prefixes_of(std::string_view path) const
+{
+	std::uint64_t ret = 0;
+	std::uint32_t node = 0;
+	for (char c : path)
+	{
+		std::uint32_t child = trie[node].first_child;
+		while (child != 0 && trie[child].c != c)
+			child = trie[child].next_sibling;
+		if (child == 0)
+			break;
+		node = child;
+		ret |= trie[node].bits;
+	}
+	return ret;
+}
+
+bool url_rules::host_rules::test(
+	const predicate& p, std::string_view path
+) const {
+	switch (p.kind)
+	{
+	case pred_kind::PREFIX:
+		return path.starts_with(p.arg);
+	case pred_kind::CONTAINS:
+		return path.contains(p.arg);
+	case pred_kind::EMPTY:
+		return path.empty();
+	case pred_kind::DATE:
+		return has_dates(path);
+	case pred_kind::SLUG:
+		return has_words_separated_by_dash(path);
+	case pred_kind::DIGIT_AT:
+		return p.n < path.size() && is_digit(path[p.n]);
+	case pred_kind::MIN_LEN:
+		return path.size() >= p.n;
+	}
+	return false;
+}
+
+// @returns the number in s, or nothing if s is not one.
+static std::optional<size_t> to_size(std::string_view s)
+{
+	size_t ret;
+	auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), ret);
+	if (ec != std::errc() || end != s.data() + s.size())
+		return std::nullopt;
+	return ret;
+}
+
+url_rules::url_rules(std::string_view text)
+{
+	host_rules* cur = nullptr;
+	size_t line_no = 0;
+	while (!text.empty())
+	{
+		++line_no;
+		const auto eol = text.find('\n');
+		std::string_view line = text.substr(0, eol);
+		text.remove_prefix(eol == text.npos ? text.size() : eol + 1);
+
+		auto invalid = [&](std::string_view why) {
+			return std::runtime_error(
+				"Invalid url filter rule on line " + std::to_string(line_no) +
+				": " + std::string(why)
+			);
+		};
+
+		std::vector<std::string_view> toks;
+		for (size_t i = 0; i < line.size();)
+		{
+			while (i < line.size() && std::isspace((unsigned char)line[i]))
+				++i;
+			const size_t b = i;
+			while (i < line.size() && !std::isspace((unsigned char)line[i]))
+				++i;
+			if (i > b)
+				toks.push_back(line.substr(b, i - b));
+		}
+		if (toks.empty() || toks[0].starts_with('#'))
+			continue;
+
+		if (toks[0].starts_with('['))
+		{
+			if (
+				toks.size() != 1 || toks[0].size() < 3 ||
+				!toks[0].ends_with(']')
+			)
+				throw invalid("expected [<host>].");
+			const auto host = toks[0].substr(1, toks[0].size() - 2);
+			auto it = hosts.find(host);
+			if (it == hosts.end())
+				it = hosts.emplace(std::string(host), host_rules{}).first;
+			cur = &it->second;
+			continue;
+		}
+
+		if (!cur)
+			throw invalid("a rule before any [<host>].");
+		clause c;
+		if (toks[0] == "recurse")
+			c.out = {true, false};
+		else if (toks[0] == "index")
+			c.out = {false, true};
+		else if (toks[0] == "both")
+			c.out = {true, true};
+		else
+			throw invalid("unknown outcome " + std::string(toks[0]) + '.');
+
+		for (size_t i = 1; i < toks.size(); ++i)
+		{
+			auto t = toks[i];
+			const bool neg = t.starts_with('!');
+			if (neg)
+				t.remove_prefix(1);
+
+			predicate p{pred_kind::EMPTY};
+			std::optional<size_t> n;
+			if (t.starts_with("prefix=") && t.size() > 7)
+				p = {pred_kind::PREFIX, std::string(t.substr(7))};
+			else if (t.starts_with("contains=") && t.size() > 9)
+				p = {pred_kind::CONTAINS, std::string(t.substr(9))};
+			else if (t == "empty")
+				p = {pred_kind::EMPTY};
+			else if (t == "date")
+				p = {pred_kind::DATE};
+			else if (t == "slug")
+				p = {pred_kind::SLUG};
+			else if (t.starts_with("digit@") && (n = to_size(t.substr(6))))
+				p = {pred_kind::DIGIT_AT, {}, *n};
+			else if (t.starts_with("minlen=") && (n = to_size(t.substr(7))))
+				p = {pred_kind::MIN_LEN, {}, *n};
+			else
+				throw invalid("unknown predicate " + std::string(toks[i]) + '.');
+
+			try
+			{
+				(neg ? c.none : c.all) |= cur->bit_of(std::move(p));
+			}
+			catch (const std::runtime_error& e)
+			{
+				throw invalid(e.what());
+			}
+		}
+		cur->clauses.push_back(c);
+	}
+}
+
+url_rules url_rules::from_file(const fs::path& p)
+{
+	std::ifstream ifs(p);
+	if (!ifs)
+		throw std::runtime_error(
+			"Could not read url filter rules from " + p.string()
+		);
+	return url_rules(std::string(
+		std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()
+	));
+}
+
+url_rules::verdict url_rules::match(
+	std::string_view host, std::string_view path
+) const {
+	auto it = hosts.find(host);
+	if (it == hosts.end())
+		return {};
+	const auto& h = it->second;
+
+	// The prefixes are found in one walk down the trie. Of the other
+	// predicates, only those of the clauses the prefixes leave open are
+	// tested.
+	std::uint64_t bits = h.prefixes_of(path);
+	std::uint64_t need = 0;
+	for (const auto& c : h.clauses)
+		if ((c.all & h.prefix_bits & ~bits) == 0 && (c.none & bits) == 0)
+			need |= (c.all | c.none) & ~h.prefix_bits;
+	while (need != 0)
+	{
+		const auto i = std::countr_zero(need);
+		need &= need - 1;
+		if (h.test(h.preds[i], path))
+			bits |= std::uint64_t(1) << i;
+	}
+
+	verdict ret;
+	for (const auto& c : h.clauses)
+		if ((bits & c.all) == c.all && (bits & c.none) == 0)
+		{
+			ret.recurse |= c.out.recurse;
+			ret.index |= c.out.index;
+		}
+	return ret;
+}
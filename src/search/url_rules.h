@@ -0,0 +1,144 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the url filter rules of the crawl, i.e. which urls are
+ * recursed and which are indexed, read from a text so that adding a site needs
+ * no rebuild.
+ *
+ * The rules of a host are compiled into a trie of their path prefixes and a
+ * few hand-written predicates, so that both outcomes for a url are decided in
+ * one pass over its path, without any regex.
+ *
+ * @author Guanyuming He
+ */
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/url.hpp>
+
+namespace fs = std::filesystem;
+namespace urls = boost::urls;
+
+/**
+ * @returns true iff the path has a date encoded in it, as a whole segment or
+ * across segments, e.g. 2025-02-01, 2025/11/03, 08-12-2025, or 30/01/2025,
+ * but not -1/-2/2025, 1/1/1, or 2021/2022/2023.
+ */
+bool has_dates(std::string_view p);
+/**
+ * @returns true iff the path has at least three words in a word-word-word
+ * pattern, common in the paths of news articles.
+ */
+bool has_words_separated_by_dash(std::string_view p);
+
+/**
+ * The rules, one per line:
+ *   [<host>]
+ *   recurse|index|both [<predicate>...]
+ * A rule applies to the urls of the host of the last [<host>] line, exactly
+ * as in the url, e.g. www.ft.com. Its outcome is taken iff all its
+ * predicates hold on the path of the url, and with none, always. A url is
+ * neither recursed nor indexed unless a rule says so, nor is that of a host
+ * without rules.
+ *
+ * The predicates, each negated by a leading !, are
+ *   prefix=<s>    the path starts with s.
+ *   contains=<s>  the path contains s.
+ *   empty         the path is empty.
+ *   date          has_dates().
+ *   slug          has_words_separated_by_dash().
+ *   digit@<n>     the n-th character, from 0, is a digit.
+ *   minlen=<n>    the path has at least n characters.
+ * Empty lines and those starting with # are ignored.
+ */
+class url_rules final
+{
+public:
+	struct verdict
+	{
+		bool recurse = false;
+		bool index = false;
+	};
+
+	// A host may have at most these many distinct predicates.
+	static constexpr unsigned MAX_PREDICATES = 64u;
+
+	// No url is recursed or indexed.
+	url_rules() = default;
+	/**
+	 * Compiles the rules in text.
+	 * @throws std::runtime_error if a line is invalid.
+	 */
+	explicit url_rules(std::string_view text);
+	/**
+	 * Compiles the rules in the file p.
+	 * @throws std::runtime_error if it cannot be read or a line is invalid.
+	 */
+	static url_rules from_file(const fs::path& p);
+
+	verdict match(std::string_view host, std::string_view path) const;
+	inline verdict match(urls::url_view u) const
+	{ return match(u.encoded_host(), u.encoded_path()); }
+
+	inline size_t num_hosts() const
+	{ return hosts.size(); }
+
+private:
+	enum class pred_kind : std::uint8_t
+	{
+		PREFIX, CONTAINS, EMPTY, DATE, SLUG, DIGIT_AT, MIN_LEN
+	};
+	struct predicate
+	{
+		pred_kind kind;
+		std::string arg{};
+		size_t n = 0;
+	};
+	// Of predicates, by their bits, as disjunctive normal form.
+	struct clause
+	{
+		std::uint64_t all = 0;
+		std::uint64_t none = 0;
+		verdict out{};
+	};
+	struct trie_node
+	{
+		char c = '\0';
+		std::uint32_t first_child = 0;
+		std::uint32_t next_sibling = 0;
+		// Of the prefixes ending here.
+		std::uint64_t bits = 0;
+	};
+	struct host_rules
+	{
+		std::vector<predicate> preds;
+		std::vector<clause> clauses;
+		// The root is 0; 0 as a child or a sibling is none.
+		std::vector<trie_node> trie{trie_node{}};
+		std::uint64_t prefix_bits = 0;
+
+		// @returns the bit of p, added if new.
+		std::uint64_t bit_of(predicate&& p);
+		void add_prefix(std::string_view s, std::uint64_t bit);
+		// @returns the bits of the prefixes path starts with.
+		std::uint64_t prefixes_of(std::string_view path) const;
+		bool test(const predicate& p, std::string_view path) const;
+	};
+
+	struct str_hash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view s) const
+		{ return std::hash<std::string_view>{}(s); }
+	};
+	std::unordered_map<std::string, host_rules, str_hash, std::equal_to<>>
+		hosts;
+};
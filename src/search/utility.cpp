@@ -21,3 +21,45 @@ void global_uninit()
 {
 	url2html::	global_uninit();
 }
+
+std::map<std::string, std::string> extract_opts(int& argc, char* argv[])
+{
+	std::map<std::string, std::string> opts;
+
+	// argv[0] is the program itself.
+	int num_pos = 1;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		if (!arg.starts_with("--") || arg.size() == 2)
+		{
+			argv[num_pos++] = argv[i];
+			continue;
+		}
+
+		arg.remove_prefix(2);
+		auto eq = arg.find('=');
+		if (eq == std::string_view::npos)
+			opts[std::string(arg)] = "";
+		else
+			opts[std::string(arg.substr(0, eq))] = 
+				std::string(arg.substr(eq+1));
+	}
+
+	argc = num_pos;
+	argv[argc] = nullptr;
+	return opts;
+}
+
+std::vector<std::string> split_opt_list(std::string_view v)
+{
+	std::vector<std::string> ret;
+	for (;;)
+	{
+		auto pos = v.find(',');
+		ret.emplace_back(v.substr(0, pos));
+		if (pos == std::string_view::npos)
+			return ret;
+		v.remove_prefix(pos + 1);
+	}
+}
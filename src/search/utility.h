@@ -8,13 +8,18 @@
  */
 
 #include <iostream>
+#include <map>
 #include <source_location>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 extern "C" {
 #include <lexbor/core/types.h>
 }
 
+#include "logger.h"
+
 #define NOT_IMPLEMENTED \
 	throw std::runtime_error("Not implemented");
 
@@ -33,31 +38,35 @@ void global_init();
  */
 void global_uninit();
 
-enum class log_levels : int 
-{
-	NO_LOG,
-	VERBOSE_1,
-	VERBOSE_2
-};
-
-constexpr log_levels log_level = log_levels::VERBOSE_1;
+/**
+ * Many of my tools take positional arguments only. To add optional settings
+ * to them without breaking the existing usages (e.g. the cron scripts), the
+ * settings are given as --key=value (or just --key) anywhere in argv.
+ *
+ * Removes all such options from argv, shifting the positional arguments to
+ * the front, and updates argc accordingly.
+ *
+ * @returns the options, key -> value. value is "" for --key.
+ */
+std::map<std::string, std::string> extract_opts(int& argc, char* argv[]);
+/**
+ * Splits the value of an option that is a list, e.g. --profiles=a,b,c.
+ * @returns the items separated by ',', which may be empty.
+ */
+std::vector<std::string> split_opt_list(std::string_view v);
 
-template <log_levels L = log_level>
-void util_log(
-	const std::string_view msg, 
+/**
+ * Logs msg at level l with the logger of the process (see logger.h), which
+ * writes it on its own thread.
+ * The message is built even if it is not logged. Where that matters, e.g.
+ * for every page, use UTIL_LOG() instead.
+ */
+inline void util_log(
+	const std::string_view msg,
+	log_levels l = log_levels::VERBOSE_1,
 	const std::source_location loc = std::source_location::current()
 ) {
-	// for debug log, it's better to use endl to force flushing.
-	if constexpr (L == log_levels::VERBOSE_1)
-	{
-		std::cout << msg << std::endl;
-	}
-	else if (L == log_levels::VERBOSE_2)
-	{
-		std::cout 
-			<< loc.file_name() << '('
-			<< loc.line() << ':'
-			<< loc.column() << ") :\n"
-			<< msg << std::endl;
-	}
+	auto& lg = logger::global();
+	if (lg.enabled(l))
+		lg.log(msg, {}, loc);
 }
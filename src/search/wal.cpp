@@ -0,0 +1,230 @@
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file implements the class wal.
+ *
+ * @author Guanyuming He
+ */
+
+#include "wal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+// Appends a size prefixed string to out.
+static void put_str(std::string& out, const std::string& s)
+{
+	auto size = static_cast<std::uint32_t>(s.size());
+	out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+	out.append(s);
+}
+
+// Reads a size prefixed string at pos of in, and advances pos.
+// @returns false if in is too short.
+static bool get_str(const std::string& in, size_t& pos, std::string& s)
+{
+	std::uint32_t size;
+	if (in.size() - pos < sizeof(size))
+		return false;
+	std::memcpy(&size, in.data() + pos, sizeof(size));
+	pos += sizeof(size);
+
+	if (in.size() - pos < size)
+		return false;
+	s.assign(in, pos, size);
+	pos += size;
+	return true;
+}
+
+wal::wal(const fs::path& dir, std::uint64_t committed_seq):
+	path(dir / FILE_NAME), next_seq(committed_seq + 1),
+	last_sync(std::chrono::steady_clock::now())
+{
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open the WAL: " + path.string());
+
+	// Continue from the last record, and cut off what follows it.
+	std::uint64_t last = 0;
+	auto valid_size = scan([&last](std::uint64_t seq, const std::string&) {
+		last = seq;
+	});
+	next_seq = std::max(next_seq, last + 1);
+
+	if (valid_size != fs::file_size(path))
+	{
+		if (0 != ::ftruncate(fd, static_cast<off_t>(valid_size)))
+		{
+			::close(fd);
+			throw std::runtime_error(
+				"Cannot cut off the torn tail of the WAL: " + path.string()
+			);
+		}
+		if (0 != ::fsync(fd))
+		{
+			::close(fd);
+			throw std::runtime_error("Cannot sync the WAL: " + path.string());
+		}
+	}
+}
+
+wal::~wal()
+{
+	if (fd >= 0)
+	{
+		try
+		{
+			sync();
+		}
+		catch (const std::runtime_error&)
+		{
+			// Nothing more can be done. The records are still in the
+			// file, if not durable.
+		}
+		::close(fd);
+	}
+}
+
+bool wal::exists(const fs::path& dir)
+{
+	return fs::exists(dir / FILE_NAME);
+}
+
+std::uint64_t wal::checksum(std::string_view payload)
+{
+	// FNV-1a. It only has to catch torn writes, not malice.
+	std::uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : payload)
+	{
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::uint64_t wal::append(const record& r)
+{
+	buf.clear();
+	buf.resize(sizeof(record_header));
+	put_str(buf, r.url);
+	put_str(buf, r.title);
+	put_str(buf, r.date);
+	put_str(buf, r.text);
+
+	const auto payload = std::string_view(buf).substr(sizeof(record_header));
+	record_header h {
+		next_seq,
+		static_cast<std::uint32_t>(payload.size()),
+		0u,
+		checksum(payload)
+	};
+	std::memcpy(buf.data(), &h, sizeof(h));
+
+	// A record left torn in the middle would make the next open cut off
+	// all those after it, so a failed append is cut off at once.
+	const auto end = ::lseek(fd, 0, SEEK_END);
+	if (end < 0)
+		throw std::runtime_error("Cannot write to the WAL.");
+	size_t written = 0;
+	while (written < buf.size())
+	{
+		auto n = ::write(fd, buf.data() + written, buf.size() - written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (written != 0 && 0 != ::ftruncate(fd, end))
+				throw std::runtime_error(
+					"Cannot write to the WAL, nor cut off the torn record."
+				);
+			throw std::runtime_error("Cannot write to the WAL.");
+		}
+		written += static_cast<size_t>(n);
+	}
+
+	// Taken even if the sync fails, as the record is in the file.
+	const auto seq = next_seq++;
+	if (
+		++num_unsynced >= GROUP_SIZE ||
+		std::chrono::steady_clock::now() - last_sync >= GROUP_INTERVAL
+	)
+		sync();
+
+	return seq;
+}
+
+void wal::sync()
+{
+	if (num_unsynced == 0)
+		return;
+
+	if (0 != ::fdatasync(fd))
+		throw std::runtime_error("Cannot sync the WAL.");
+	num_unsynced = 0;
+	last_sync = std::chrono::steady_clock::now();
+}
+
+std::uint64_t wal::scan(
+	const std::function<void(std::uint64_t, const std::string&)>& visit
+) const {
+	std::ifstream ifs(path, std::ios::binary);
+	std::uint64_t valid_size = 0;
+	std::string payload;
+
+	record_header h;
+	while (ifs.read(reinterpret_cast<char*>(&h), sizeof(h)))
+	{
+		// A torn header may claim anything.
+		if (h.payload_size > MAX_PAYLOAD_SIZE)
+			break;
+		payload.resize(h.payload_size);
+		if (!ifs.read(payload.data(), h.payload_size))
+			break;
+		if (h.checksum != checksum(payload))
+			break;
+
+		visit(h.seq, payload);
+		valid_size += sizeof(h) + h.payload_size;
+	}
+
+	return valid_size;
+}
+
+void wal::replay(
+	std::uint64_t after,
+	const std::function<void(const record&)>& visit
+) const {
+	record r;
+	scan([&](std::uint64_t seq, const std::string& payload) {
+		if (seq <= after)
+			return;
+
+		size_t pos = 0;
+		if (
+			get_str(payload, pos, r.url) &&
+			get_str(payload, pos, r.title) &&
+			get_str(payload, pos, r.date) &&
+			get_str(payload, pos, r.text)
+		)
+			visit(r);
+	});
+}
+
+void wal::reset()
+{
+	if (0 != ::ftruncate(fd, 0))
+		throw std::runtime_error("Cannot reset the WAL.");
+	if (0 != ::fsync(fd))
+		throw std::runtime_error("Cannot sync the WAL.");
+	num_unsynced = 0;
+	last_sync = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,157 @@
+#pragma once
+/**
+ * The file is licensed under the GNU GPL v3
+ * Copyright (C) Guanyuming He 2025
+ *
+ * The file defines the class wal, the write-ahead log of the pages added to
+ * an index.
+ *
+ * Xapian commits are expensive, so it is much faster to commit only every
+ * few ten thousand documents. Without a log, however, a crash then loses all
+ * the documents since the last commit. With it, each page is first appended
+ * here, and the log is made durable in groups, which costs far less than a
+ * commit. When the db is opened again, the pages logged after its last
+ * commit are added again.
+ *
+ * @author Guanyuming He
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+/**
+ * The log is a single append only file in the db's dir:
+ *   <record>*
+ *
+ *   record:
+ *   <uint64_t seq> <uint32_t payload size> <uint32_t 0>
+ *   <uint64_t checksum of the payload> <payload>
+ *
+ *   payload:
+ *   <uint32_t size> <url> <uint32_t size> <title>
+ *   <uint32_t size> <date YYYYMMDD> <uint32_t size> <text>
+ *
+ * Sequence numbers only increase, even across reset()s. The db records the
+ * seq of the last record its commit includes, so that a record is replayed
+ * iff its seq is greater.
+ *
+ * Only additions are logged. Replaying one is idempotent, as a document is
+ * replaced if it exists. The index commits the records before it deletes
+ * any document, so that none is replayed over a deletion.
+ */
+class wal final
+{
+public:
+	static constexpr const char* FILE_NAME = "wal";
+
+	// The log is fsynced every this many records, or every this long,
+	// whichever comes first. At most that many records are lost in a crash
+	// and need to be indexed again.
+	static constexpr unsigned GROUP_SIZE = 64u;
+	static constexpr std::chrono::milliseconds GROUP_INTERVAL{1000};
+
+	// No page is this large.
+	static constexpr std::uint32_t MAX_PAYLOAD_SIZE = 256u * 1024u * 1024u;
+
+	struct record
+	{
+		std::string url;
+		std::string title;
+		// YYYYMMDD, as in index::DATE_SLOT.
+		std::string date;
+		std::string text;
+	};
+
+public:
+	wal() = delete;
+	/**
+	 * Opens or creates the log in dir. A torn record at the end, left by a
+	 * crash in the middle of an append, is cut off.
+	 *
+	 * @param committed_seq seq of the last record the db has committed.
+	 * @throws std::runtime_error if the file cannot be opened or created.
+	 */
+	wal(const fs::path& dir, std::uint64_t committed_seq);
+	// Syncs.
+	~wal();
+
+	// Owns a file descriptor.
+	wal(const wal&) = delete;
+	wal& operator=(const wal&) = delete;
+
+	// @returns true iff a log is in dir.
+	static bool exists(const fs::path& dir);
+
+public:
+	/**
+	 * Appends r to the log, and syncs if a group is complete.
+	 * @returns seq of r.
+	 * @throws std::runtime_error if it cannot be written, and then no part
+	 * of r is left in the log, or if it cannot be synced.
+	 */
+	std::uint64_t append(const record& r);
+
+	/**
+	 * Makes every record appended durable.
+	 * @throws std::runtime_error if it fails.
+	 */
+	void sync();
+
+	/**
+	 * Visits the records in the log whose seq > after, in order.
+	 * Used to recover after a crash.
+	 */
+	void replay(
+		std::uint64_t after,
+		const std::function<void(const record&)>& visit
+	) const;
+
+	/**
+	 * Empties the log. Call it only after the db has committed all the
+	 * records in it.
+	 */
+	void reset();
+
+	// @returns seq of the last record appended, or of the last record
+	// committed if none is appended since.
+	inline std::uint64_t last_seq() const
+	{ return next_seq - 1; }
+
+private:
+	struct record_header
+	{
+		std::uint64_t seq;
+		std::uint32_t payload_size;
+		std::uint32_t reserved;
+		std::uint64_t checksum;
+	};
+
+	/**
+	 * Goes through all the complete records in the file in order.
+	 * @returns the size of the valid part of the file.
+	 */
+	std::uint64_t scan(
+		const std::function<void(std::uint64_t, const std::string&)>& visit
+	) const;
+
+	static std::uint64_t checksum(std::string_view payload);
+
+private:
+	const fs::path path;
+	int fd = -1;
+
+	std::uint64_t next_seq;
+
+	// Appended since the last sync.
+	unsigned num_unsynced = 0;
+	std::chrono::steady_clock::time_point last_sync;
+
+	// Reused for encoding to avoid reallocations.
+	std::string buf;
+};
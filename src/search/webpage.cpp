@@ -10,6 +10,7 @@
 
 #include "webpage.h"
 #include "url2html.h"
+#include "url_canon.h"
 
 #include <algorithm>
 #include <cctype>
@@ -55,6 +56,66 @@ std::vector<urls::url> webpage::get_urls() const
 	return ret;
 }
 
+// @returns host without a leading label of the usual variants of a site,
+// e.g. abc.com of www.abc.com, m.abc.com, and amp.abc.com.
+static std::string_view site_of(std::string_view host)
+{
+	for (std::string_view l : {"www.", "m.", "amp.", "mobile."})
+		if (host.starts_with(l) && host.size() > l.size())
+			return host.substr(l.size());
+	return host;
+}
+
+/**
+ * @returns true if a page on host may name a canonical url on c, i.e. c is
+ * its site or a subdomain of it.
+ * Not the parent domains, as they may be public suffixes, e.g. co.uk, shared
+ * by unrelated sites.
+ */
+static bool same_site(std::string_view host, std::string_view c)
+{
+	host = site_of(host);
+	c = site_of(c);
+	return c == host || (
+		c.size() > host.size() && c.ends_with(host) &&
+		c[c.size() - host.size() - 1] == '.'
+	);
+}
+
+std::optional<urls::url> webpage::get_canonical_url(
+	const url_canon& canon
+) const
+{
+	if (!html_tree)
+		return std::nullopt;
+
+	auto raw = html_tree->get_canonical();
+	if (!raw)
+		return std::nullopt;
+	std::erase_if(*raw, [](unsigned char x) { return std::isspace(x); });
+
+	urls::url ret(this->url);
+	try
+	{
+		if (ret.resolve(urls::url_view{boost::core::string_view{*raw}})
+			.has_error())
+			return std::nullopt;
+	}
+	catch (...)
+	{
+		return std::nullopt;
+	}
+
+	if (
+		(ret.scheme_id() != urls::scheme::http &&
+			ret.scheme_id() != urls::scheme::https) ||
+		!same_site(url.encoded_host(), ret.encoded_host()) ||
+		canon.key(ret) == canon.key(url)
+	)
+		return std::nullopt;
+	return ret;
+}
+
 bool webpage::load_html(const url2html& convertor)
 {
 	if (html_tree) return false;
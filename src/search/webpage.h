@@ -23,6 +23,8 @@ extern "C" {
 
 #include "url2html.h"
 
+class url_canon;
+
 /**
  * The class represents a webpage.
  * It has its url, title, date, and other metadata.
@@ -88,6 +90,18 @@ public:
 	// this->get_urls().size() <= html_tree->get_urls();
 	std::vector<urls::url> get_urls() const;
 
+	/**
+	 * @returns the canonical url of the page, resolved like get_urls(), if
+	 * the HTML names one that is not the page's own url.
+	 *
+	 * Any page can claim any url, so only an http(s) one of the same site is
+	 * taken, i.e. whose host is the page's or a subdomain of it, ignoring a
+	 * leading www., m., amp. or mobile.
+	 * Nor is one with the same key as the page's under canon, e.g. the url
+	 * rules of the db.
+	 */
+	std::optional<urls::url> get_canonical_url(const url_canon& canon) const;
+
 	/**
 	 * Loads the html from the URL only if it is not loaded.
 	 *
@@ -14,10 +14,26 @@
 #include <boost/test/unit_test.hpp>
 
 #include <xapian.h>
+#include <algorithm>
+#include <bit>
 #include <filesystem>
+#include <fstream>
+#include <map>
 #include <optional>
+#include <sstream>
 
+#include "../search/corpus.h"
 #include "../search/index.h"
+#include "../search/indexer.h"
+#include "../search/logger.h"
+#include "../search/metrics.h"
+#include "../search/near_dup.h"
+#include "../search/searcher.h"
+#include "../search/text_store.h"
+#include "../search/url_canon.h"
+#include "../search/url_rules.h"
+#include "../search/trace.h"
+#include "../search/wal.h"
 #include "../search/webpage.h"
 #include "../search/url2html.h"
 
@@ -312,6 +328,195 @@ BOOST_AUTO_TEST_CASE(add_multiple)
 	BOOST_TEST(data2.contains(title_str2));
 }
 
+BOOST_AUTO_TEST_CASE(add_stores_keywords)
+{
+	class index i(db_path);
+	
+	auto pg1 = create_mock_webpage(
+		"https://test-keywords/abc", 
+		"Keywords",
+		"Inflation inflation inflation rises as markets fall 2025"
+	);
+	i.add_document(pg1);
+
+	auto doc = i.get_document(pg1);
+	BOOST_TEST(doc.has_value());
+
+	auto kw = doc->get_value(index::KEYWORDS_SLOT);
+	BOOST_CHECK_EQUAL(kw, index::keywords_from_doc(doc.value()));
+	// The most frequent word comes first.
+	BOOST_TEST(kw.starts_with("inflation"));
+	BOOST_TEST(kw.contains("markets"));
+	// Only English words are keywords.
+	BOOST_TEST(!kw.contains("2025"));
+}
+
+BOOST_AUTO_TEST_CASE(add_stores_text)
+{
+	index::open_params par(db_path);
+	par.store_text = true;
+	class index i(par);
+	
+	auto pg1 = create_mock_webpage(
+		"https://test-store-text/abc", 
+		"Store text",
+		"Here is some content to be kept"
+	);
+	i.add_document(pg1);
+
+	auto doc = i.get_document(pg1);
+	BOOST_TEST(doc.has_value());
+
+	auto text = i.text_from_doc(doc.value());
+	BOOST_TEST(text.has_value());
+	BOOST_CHECK_EQUAL(text.value(), pg1.get_text());
+}
+
+BOOST_AUTO_TEST_CASE(text_store_reopen)
+{
+	fs::create_directories(db_path);
+	auto text = [](unsigned n) {
+		std::string ret;
+		for (unsigned k = 0; k < 8; ++k)
+			ret += "Shares of company " + std::to_string(n % 97 + k) +
+				" rose as investors weighed the rate decision " +
+				std::to_string(n) + ". ";
+		return ret;
+	};
+	const unsigned n = text_store::NUM_DICT_SAMPLES;
+
+	{
+		text_store w(db_path, true);
+		for (unsigned i = 0; i < n / 2; ++i)
+			w.put(text(i));
+	}
+	// Opened before the dictionary is trained.
+	text_store r(db_path, false);
+
+	std::string loc;
+	{
+		// The samples of before are read back.
+		text_store w(db_path, true);
+		for (unsigned i = n / 2; i < n; ++i)
+			w.put(text(i));
+		BOOST_REQUIRE(fs::exists(db_path / text_store::DICT_FILE_NAME));
+		loc = w.put(text(n));
+	}
+	BOOST_CHECK_EQUAL(r.get(loc), text(n));
+}
+
+BOOST_AUTO_TEST_CASE(add_no_store_text)
+{
+	class index i(db_path);
+	
+	auto pg1 = create_mock_webpage(
+		"https://test-store-text/abc", 
+		"No store text",
+		"Here is some content"
+	);
+	i.add_document(pg1);
+
+	auto doc = i.get_document(pg1);
+	BOOST_TEST(doc.has_value());
+	BOOST_TEST(!i.text_from_doc(doc.value()).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(add_single_schema)
+{
+	{
+		index::open_params par(db_path);
+		par.profile = "single";
+		class index i(par);
+		BOOST_CHECK(i.get_schema() == index::schema::SINGLE);
+
+		auto pg1 = create_mock_webpage(
+			"https://test-single-schema/abc", 
+			"Single schema",
+			"Here is some content"
+		);
+		i.add_document(pg1);
+
+		auto doc = i.get_document(pg1);
+		BOOST_TEST(doc.has_value());
+		// Only the prefixed terms are indexed.
+		for (auto t = doc->termlist_begin(); t != doc->termlist_end(); ++t)
+			BOOST_TEST(!index::is_free_text_term(*t));
+	}
+
+	// The profile of an existing db cannot be changed.
+	index::open_params par(db_path);
+	par.profile = "default";
+	BOOST_CHECK_THROW(class index i(par), std::runtime_error);
+
+	// It's kept if not specified.
+	class index i(db_path);
+	BOOST_CHECK(i.get_schema() == index::schema::SINGLE);
+	BOOST_CHECK_EQUAL(i.get_profile().name, "single");
+}
+
+BOOST_AUTO_TEST_CASE(add_compact_profile)
+{
+	index::open_params par(db_path);
+	par.profile = "compact";
+	class index i(par);
+	BOOST_CHECK(i.get_schema() == index::schema::SINGLE);
+
+	auto pg1 = create_mock_webpage(
+		"https://test-compact-profile/abc", 
+		"Compact profile",
+		"Here is a sentence with some content"
+	);
+	i.add_document(pg1);
+
+	auto doc = i.get_document(pg1);
+	BOOST_TEST(doc.has_value());
+
+	bool has_content = false;
+	for (auto t = doc->termlist_begin(); t != doc->termlist_end(); ++t)
+	{
+		std::string term = *t;
+		// Neither stopwords nor words too short are indexed.
+		BOOST_TEST(term != "XDis");
+		BOOST_TEST(term != "XDa");
+		// The text has no positions, while the title has.
+		if (term.starts_with("XD"))
+			BOOST_TEST(t.positionlist_count() == 0u);
+		if (term.starts_with("S"))
+			BOOST_TEST(t.positionlist_count() > 0u);
+
+		has_content = has_content || term == "XDcontent";
+	}
+	BOOST_TEST(has_content);
+
+	BOOST_CHECK_THROW(
+		index_profile::from_name("no such profile"), std::runtime_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(free_text_terms)
+{
+	BOOST_TEST(index::is_free_text_term("content"));
+	BOOST_TEST(index::is_free_text_term("Zcontent"));
+	BOOST_TEST(index::is_free_text_term("2025"));
+	BOOST_TEST(!index::is_free_text_term("XDcontent"));
+	BOOST_TEST(!index::is_free_text_term("ZXDcontent"));
+	BOOST_TEST(!index::is_free_text_term("Scontent"));
+	BOOST_TEST(!index::is_free_text_term("ZScontent"));
+}
+
+BOOST_AUTO_TEST_CASE(cut_text)
+{
+	auto p = index_profile::from_name("compact");
+	p.max_text_length = 5;
+
+	BOOST_TEST(p.cut_text("abc") == "abc");
+	BOOST_TEST(p.cut_text("ab cd ef") == "ab cd");
+	// Without a space, a UTF-8 char is not cut into half.
+	BOOST_TEST(p.cut_text("abcd\xC3\xA9") == "abcd");
+	BOOST_TEST(p.cut_text("\xE6\x97\xA5\xE6\x9C\xAC") == "\xE6\x97\xA5");
+	BOOST_TEST(p.cut_text("abcdef") == "abcde");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /**
@@ -401,6 +606,76 @@ BOOST_AUTO_TEST_CASE(shrink_oldest)
 	BOOST_CHECK(i.get_document(p3));
 }
 
+BOOST_AUTO_TEST_CASE(shrink_compacts_texts)
+{
+	index::open_params par(db_path);
+	par.store_text = true;
+	const urls::url u1("https://abc.org/one"), u2("https://abc.org/two"),
+		u3("https://abc.org/three");
+	{
+		class index i(par);
+		i.add_document(u1, "title", ch::year(2025)/1/1, "The first text.");
+		i.add_document(u2, "title", ch::year(2025)/2/1, "The second text.");
+		i.add_document(u3, "title", ch::year(2025)/3/1, "The third text.");
+		i.synchronize();
+		// Opened before the compaction.
+		text_store r(db_path, false);
+
+		i.shrink(1, index::shrink_policy::OLDEST);
+		BOOST_CHECK_EQUAL(i.get_metadata(index::TEXT_GEN_KEY), "1");
+		BOOST_CHECK(!fs::exists(db_path / text_store::FILE_NAME));
+
+		const auto doc = i.get_document(u3);
+		BOOST_REQUIRE(doc);
+		BOOST_CHECK_EQUAL(
+			i.text_from_doc(*doc).value_or(""), "The third text."
+		);
+		BOOST_CHECK_EQUAL(
+			r.get(doc->get_value(index::TEXT_SLOT)), "The third text."
+		);
+		// Too little garbage.
+		BOOST_CHECK(!i.compact_texts());
+	}
+
+	class index i(db_path);
+	i.add_document(u1, "title", ch::year(2025)/4/1, "The fourth text.");
+	BOOST_CHECK_EQUAL(
+		i.text_from_doc(*i.get_document(u1)).value_or(""), "The fourth text."
+	);
+	BOOST_CHECK_EQUAL(
+		i.text_from_doc(*i.get_document(u3)).value_or(""), "The third text."
+	);
+}
+
+BOOST_AUTO_TEST_CASE(copy_compacted_texts)
+{
+	index::open_params par(db_path);
+	par.store_text = true;
+	const urls::url u1("https://abc.org/one"), u2("https://abc.org/two");
+	{
+		class index i(par);
+		i.add_document(u1, "title", ch::year(2025)/1/1, "The first text.");
+		i.add_document(u2, "title", ch::year(2025)/2/1, "The second text.");
+		i.shrink(1, index::shrink_policy::OLDEST);
+	}
+
+	// As migrate_schema copies a db, whose metadata keep TEXT_GEN_KEY.
+	const auto dst_path = temp_dir / "copy_db";
+	{
+		xp::Database src(db_path.string());
+		BOOST_CHECK_EQUAL(index::text_gen_of(src), 1u);
+		src.compact(dst_path.string());
+		text_store::copy(db_path, dst_path, index::text_gen_of(src));
+	}
+	BOOST_CHECK(fs::exists(text_store::path_of(dst_path, 1)));
+	BOOST_CHECK(!fs::exists(text_store::path_of(dst_path, 0)));
+
+	class index i(dst_path);
+	BOOST_CHECK_EQUAL(
+		i.text_from_doc(*i.get_document(u2)).value_or(""), "The second text."
+	);
+}
+
 BOOST_AUTO_TEST_CASE(shrink_latest_multiple)
 {
 	class index i(db_path);
@@ -462,3 +737,1140 @@ BOOST_AUTO_TEST_CASE(shrink_oldest_multiple)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(ScanIndexSuite, DiskIndexFixture)
+
+// Counts the docs and keeps their urls and dates.
+struct scan_recorder
+{
+	std::vector<std::string> urls;
+	std::vector<std::string> dates;
+
+	void operator()(const index::scanned_doc& doc)
+	{
+		urls.push_back(index::url_from_doc(doc));
+		dates.push_back(doc.values.at(0));
+	}
+
+	void merge(scan_recorder&& other)
+	{
+		urls.insert(urls.end(), other.urls.begin(), other.urls.end());
+		dates.insert(dates.end(), other.dates.begin(), other.dates.end());
+	}
+};
+
+BOOST_AUTO_TEST_CASE(scan_all)
+{
+	const unsigned num_docs = 10;
+	{
+		class index i(db_path);
+		for (unsigned n = 1; n <= num_docs; ++n)
+		{
+			webpage p(
+				"https://abc.org/" + std::to_string(n), "title", 
+				ch::year_month_day(
+					ch::year{2025}, ch::month{n}, ch::day{1}
+				)
+			);
+			i.add_document(p);
+		}
+		// A hole in the docids.
+		i.rm_document(urls::url("https://abc.org/5"));
+		i.synchronize();
+	}
+
+	index::scan_projection proj;
+	proj.data = true;
+	proj.slots.push_back(index::DATE_SLOT);
+
+	// More threads than docs should also work.
+	for (unsigned nthreads : {1u, 3u, 16u})
+	{
+		auto res = index::scan(db_path, proj, scan_recorder{}, nthreads);
+		BOOST_CHECK_EQUAL(res.urls.size(), num_docs - 1);
+		BOOST_CHECK_EQUAL(res.dates.size(), num_docs - 1);
+
+		// Merged in the order of docids.
+		BOOST_CHECK_EQUAL(res.urls.front(), "https://abc.org/1");
+		BOOST_CHECK_EQUAL(res.dates.front(), "20250101");
+		BOOST_CHECK_EQUAL(res.urls.back(), "https://abc.org/10");
+		BOOST_CHECK(
+			std::find(res.urls.begin(), res.urls.end(), "https://abc.org/5")
+			== res.urls.end()
+		);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(StatsIndexSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(stats_kept)
+{
+	class index i(db_path);
+	webpage p1(
+		"https://abc.org/one", "title", 
+		ch::year_month_day(ch::year{2025}, ch::month{1}, ch::day{1})
+	);
+	webpage p2(
+		"https://abc.org/two", "title", 
+		ch::year_month_day(ch::year{2025}, ch::month{2}, ch::day{1})
+	);
+	webpage p3(
+		"https://def.org/three", "title", 
+		ch::year_month_day(ch::year{2025}, ch::month{2}, ch::day{1})
+	);
+	i.add_document(p1);
+	i.add_document(p2);
+	i.add_document(p3);
+	// Replacing one must not count it twice.
+	i.add_document(p3);
+
+	auto st = i.stats();
+	BOOST_REQUIRE(st.has_value());
+	BOOST_CHECK_EQUAL(st->hosts.at("abc.org"), 2u);
+	BOOST_CHECK_EQUAL(st->hosts.at("def.org"), 1u);
+	BOOST_CHECK_EQUAL(st->days.at("20250101"), 1u);
+	BOOST_CHECK_EQUAL(st->days.at("20250201"), 2u);
+
+	i.rm_document(p3.url);
+	st = i.stats();
+	BOOST_CHECK(!st->hosts.contains("def.org"));
+	BOOST_CHECK_EQUAL(st->days.at("20250201"), 1u);
+
+	i.shrink(1, index::shrink_policy::OLDEST);
+	BOOST_CHECK(i.get_document(p2));
+	st = i.stats();
+	BOOST_CHECK_EQUAL(st->hosts.at("abc.org"), 1u);
+	BOOST_CHECK(!st->days.contains("20250101"));
+
+	// Recounting from the docs gives the same.
+	i.rebuild_stats();
+	auto rebuilt = i.stats();
+	BOOST_CHECK(rebuilt->hosts == st->hosts);
+	BOOST_CHECK(rebuilt->days == st->days);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(DateTermsIndexSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(date_range_by_terms)
+{
+	const std::vector<ch::year_month_day> dates{
+		ch::year{2024}/ch::December/ch::day{31},
+		ch::year{2025}/ch::January/ch::day{1},
+		ch::year{2025}/ch::March/ch::day{15},
+		ch::year{2025}/ch::July/ch::day{14},
+		ch::year{2026}/ch::January/ch::day{1},
+	};
+	{
+		class index i(db_path);
+		for (size_t n = 0; n < dates.size(); ++n)
+			i.add_document(webpage(
+				"https://abc.org/" + std::to_string(n), "title", dates[n]
+			));
+		i.synchronize();
+	}
+
+	xp::Database db(db_path.string());
+	BOOST_TEST(index::has_date_terms(db));
+	BOOST_CHECK_EQUAL(db.get_termfreq("XY2025"), 3u);
+	BOOST_CHECK_EQUAL(db.get_termfreq("XM202507"), 1u);
+	BOOST_CHECK_EQUAL(db.get_termfreq("XDAY20250714"), 1u);
+
+	auto count = [&](
+		const ch::year_month_day& b, const ch::year_month_day& e
+	) {
+		xp::Enquire enq(db);
+		enq.set_query(index::date_range_query(b, e));
+		return enq.get_mset(0, 100).size();
+	};
+	// A whole year.
+	BOOST_CHECK_EQUAL(count(
+		ch::year{2025}/ch::January/ch::day{1},
+		ch::year{2025}/ch::December/ch::day{31}
+	), 3u);
+	// Partial months on both edges.
+	BOOST_CHECK_EQUAL(count(
+		ch::year{2024}/ch::December/ch::day{31},
+		ch::year{2025}/ch::July/ch::day{13}
+	), 3u);
+	// Within a month.
+	BOOST_CHECK_EQUAL(count(
+		ch::year{2025}/ch::March/ch::day{16},
+		ch::year{2025}/ch::March/ch::day{31}
+	), 0u);
+	BOOST_CHECK_EQUAL(count(
+		ch::year{2025}/ch::July/ch::day{14},
+		ch::year{2026}/ch::January/ch::day{1}
+	), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(days_value)
+{
+	const auto date = ch::year{2025}/ch::July/ch::day{14};
+	class index i(db_path);
+	webpage p("https://abc.org/days", "title", date);
+	i.add_document(p);
+
+	auto doc = i.get_document(p);
+	BOOST_REQUIRE(doc.has_value());
+	BOOST_CHECK_EQUAL(
+		xp::sortable_unserialise(doc->get_value(index::DAYS_SLOT)),
+		double(ch::sys_days(date).time_since_epoch().count())
+	);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(QueryParamsSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(cutoffs_and_counts)
+{
+	const ch::year_month_day date{ch::year(2025), ch::month(7), ch::day(1)};
+	{
+		class index i(db_path);
+		// 1 to 10 have both words, 11 to 40 only one.
+		for (unsigned n = 1; n <= 40; ++n)
+			i.add_document(
+				urls::url("https://abc.com/" + std::to_string(n)), "Fruit",
+				date,
+				n <= 10 ? "apple banana cherry" : "apple grape lemon melon"
+			);
+		i.synchronize();
+	}
+	searcher s(db_path);
+
+	// Without a time limit, nothing is ever truncated, and the count is
+	// exact once all matches are considered.
+	searcher::query_params par;
+	par.max_num_results = 1;
+	par.check_at_least = 100;
+	par.time_limit = 0.;
+	auto [mset, truncated] = s.query("apple banana", par);
+	BOOST_CHECK(!truncated);
+	BOOST_CHECK_EQUAL(mset.size(), 1);
+	BOOST_CHECK_EQUAL(mset.get_matches_lower_bound(), 40);
+	BOOST_CHECK_EQUAL(mset.get_matches_upper_bound(), 40);
+
+	par = {};
+	par.max_num_results = 100;
+	const auto all = s.query("apple banana", par).mset;
+	BOOST_REQUIRE_EQUAL(all.size(), 40);
+
+	// Those with one of the two words are at most half as relevant.
+	par.percent_cutoff = 60;
+	auto cut = s.query("apple banana", par).mset;
+	BOOST_CHECK_EQUAL(cut.size(), 10);
+	for (auto it = cut.begin(); it != cut.end(); ++it)
+		BOOST_CHECK_LE(*it, 10u);
+
+	// Between the weights of the two kinds.
+	par.percent_cutoff = 0;
+	double lowest = all.begin().get_weight();
+	for (auto it = all.begin(); it != all.end(); ++it)
+		lowest = std::min(lowest, it.get_weight());
+	par.weight_cutoff = (all.begin().get_weight() + lowest) / 2.;
+	cut = s.query("apple banana", par).mset;
+	BOOST_CHECK_EQUAL(cut.size(), 10);
+	for (auto it = cut.begin(); it != cut.end(); ++it)
+		BOOST_CHECK_GE(it.get_weight(), *par.weight_cutoff);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(FreshnessSuite, DiskIndexFixture)
+
+// @returns the docids in mset, in order.
+static std::vector<xp::docid> docids_of(const xp::MSet& mset)
+{
+	std::vector<xp::docid> ret;
+	for (auto it = mset.begin(); it != mset.end(); ++it)
+		ret.push_back(*it);
+	return ret;
+}
+
+BOOST_AUTO_TEST_CASE(freshness_weights)
+{
+	const ch::sys_days now = ch::year{2025}/ch::July/ch::day{14};
+	{
+		class index i(db_path);
+		// Docids 1 to 4.
+		for (auto d : {now, now - ch::days(7), now - ch::days(14), now + ch::days(3)})
+			i.add_document(webpage(
+				"https://abc.org/" + std::to_string(d.time_since_epoch().count()),
+				"title", ch::year_month_day(d)
+			));
+		i.synchronize();
+	}
+
+	xp::Database db(db_path.string());
+	const auto now_days = double(now.time_since_epoch().count());
+	freshness_source src(now_days, 7., 2.);
+	src.init(db);
+	// The latest document is in the future, so it bounds the weight at max.
+	BOOST_CHECK_CLOSE(src.get_maxweight(), 2., 1e-9);
+
+	xp::Enquire enq(db);
+	enq.set_query(xp::Query(&src));
+	auto mset = enq.get_mset(0, 10);
+	BOOST_REQUIRE_EQUAL(mset.size(), 4);
+	std::map<xp::docid, double> weights;
+	for (auto it = mset.begin(); it != mset.end(); ++it)
+		weights[*it] = it.get_weight();
+	BOOST_CHECK_CLOSE(weights[1], 2., 1e-9);
+	BOOST_CHECK_CLOSE(weights[2], 1., 1e-9);
+	BOOST_CHECK_CLOSE(weights[3], .5, 1e-9);
+	BOOST_CHECK_CLOSE(weights[4], 2., 1e-9);
+
+	// All old, then the bound is the weight of the latest.
+	freshness_source later(now_days + 10., 7., 2.);
+	later.init(db);
+	// A week old.
+	BOOST_CHECK_CLOSE(later.get_maxweight(), 1., 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(orderings)
+{
+	const ch::sys_days today =
+		ch::floor<ch::days>(ch::system_clock::now());
+	const ch::sys_days old = ch::year{2020}/ch::January/ch::day{1};
+	{
+		class index i(db_path);
+		// 1: the most relevant, but old.
+		i.add_document(
+			urls::url("https://a.com/1"), "Fruit", ch::year_month_day(old),
+			"apple apple apple apple banana"
+		);
+		// 2: less relevant, of today.
+		i.add_document(
+			urls::url("https://b.com/2"), "Fruit", ch::year_month_day(today),
+			"apple banana cherry grape lemon"
+		);
+		// 3: in between, older than 1.
+		i.add_document(
+			urls::url("https://c.com/3"), "Fruit",
+			ch::year_month_day(old - ch::days(1)),
+			"apple apple banana cherry grape"
+		);
+		// 4: of today too, and more relevant than 2.
+		i.add_document(
+			urls::url("https://d.com/4"), "Fruit", ch::year_month_day(today),
+			"apple apple apple banana cherry"
+		);
+		// 5: of today, but does not match.
+		i.add_document(
+			urls::url("https://e.com/5"), "Fruit", ch::year_month_day(today),
+			"banana cherry grape lemon melon"
+		);
+		i.synchronize();
+	}
+
+	searcher s(db_path);
+	searcher::query_params par;
+
+	par.order = searcher::query_params::ordering::RELEVANCE;
+	BOOST_TEST(
+		docids_of(s.query("apple", par).mset) ==
+		std::vector<xp::docid>({1, 4, 3, 2}),
+		boost::test_tools::per_element()
+	);
+
+	// Latest first, the ties by relevance.
+	par.order = searcher::query_params::ordering::DATE;
+	BOOST_TEST(
+		docids_of(s.query("apple", par).mset) ==
+		std::vector<xp::docid>({4, 2, 1, 3}),
+		boost::test_tools::per_element()
+	);
+
+	// Today's documents outweigh any relevance with a large freshness
+	// weight, while the old ones get next to nothing and keep their order.
+	// The documents not matching are not brought in.
+	par.order = searcher::query_params::ordering::BLENDED;
+	par.freshness_weight = 100.;
+	BOOST_TEST(
+		docids_of(s.query("apple", par).mset) ==
+		std::vector<xp::docid>({4, 2, 1, 3}),
+		boost::test_tools::per_element()
+	);
+
+	// Without weight, it is just relevance.
+	par.freshness_weight = 0.;
+	BOOST_TEST(
+		docids_of(s.query("apple", par).mset) ==
+		std::vector<xp::docid>({1, 4, 3, 2}),
+		boost::test_tools::per_element()
+	);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(WalIndexSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(wal_replay)
+{
+	{
+		index::open_params par(db_path);
+		par.use_wal = true;
+		class index i(par);
+	}
+	BOOST_TEST(wal::exists(db_path));
+
+	// Log a page as if the indexer crashed before committing it,
+	// in the middle of logging another.
+	{
+		wal log(db_path, 0);
+		log.append({
+			"https://abc.org/lost", "Lost", "20250714", "some lost content"
+		});
+	}
+	{
+		std::ofstream ofs(
+			db_path / wal::FILE_NAME, std::ios::binary | std::ios::app
+		);
+		ofs << "torn";
+	}
+
+	// The log is used as it exists.
+	class index i(db_path);
+	BOOST_CHECK_EQUAL(i.num_documents(), 1);
+	BOOST_CHECK(i.get_document(urls::url("https://abc.org/lost")));
+	// Emptied once committed.
+	BOOST_CHECK_EQUAL(fs::file_size(db_path / wal::FILE_NAME), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(wal_committed_before_rm)
+{
+	const urls::url u("https://abc.org/gone");
+	index::open_params par(db_path);
+	par.use_wal = true;
+	par.commit_every = 1000;
+	class index i(par);
+	i.add_document(u, "Gone", ch::year(2025)/7/14, "some content");
+	BOOST_CHECK_GT(fs::file_size(db_path / wal::FILE_NAME), 0u);
+
+	// Otherwise, a crash now would add it again on replay.
+	i.rm_document(u);
+	BOOST_CHECK_EQUAL(fs::file_size(db_path / wal::FILE_NAME), 0u);
+	BOOST_CHECK(!i.get_document(u));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(CheckpointIndexSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(checkpoint_meta)
+{
+	{
+		class index i(db_path);
+		BOOST_CHECK_EQUAL(i.get_metadata("ckpt_id"), "");
+		i.add_document(
+			urls::url("https://abc.org/a"), "A",
+			ch::year_month_day{ch::year(2025), ch::July, ch::day(14)},
+			"some content"
+		);
+		i.checkpoint({{"ckpt_id", "1"}, {"ckpt_num_indexed", "1"}});
+	}
+
+	class index i(db_path);
+	BOOST_CHECK_EQUAL(i.get_metadata("ckpt_id"), "1");
+	BOOST_CHECK_EQUAL(i.get_metadata("ckpt_num_indexed"), "1");
+	BOOST_CHECK_EQUAL(i.num_documents(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(IndexerCheckpointSuite, DiskIndexFixture)
+
+static bool accept_url(urls::url&) { return true; }
+static bool accept_page(webpage&) { return true; }
+
+BOOST_AUTO_TEST_CASE(resume_from_checkpoint)
+{
+	const auto q_path = temp_dir / "que";
+	{
+		indexer idx(
+			db_path, q_path,
+			indexer::uque_t{
+				urls::url("https://a.com/1"), urls::url("https://b.com/2")
+			},
+			&accept_url, &accept_url, &accept_page, &accept_page
+		);
+		idx.checkpoint();
+		// And another when it stops.
+	}
+	// Only the last snapshot is kept, with the db.
+	BOOST_TEST(!fs::exists(db_path / "que.1"));
+	BOOST_TEST(fs::exists(db_path / "que.2"));
+	BOOST_TEST(!fs::exists(temp_dir / "que.2"));
+	BOOST_TEST(!fs::exists(fs::current_path() / "que.2"));
+
+	// Without the queue saved at exit, only the checkpoint can restore it.
+	fs::remove(q_path);
+	{
+		indexer idx(
+			db_path, q_path,
+			&accept_url, &accept_url, &accept_page, &accept_page
+		);
+	}
+	BOOST_TEST(!fs::exists(db_path / "que.2"));
+	BOOST_TEST(fs::exists(db_path / "que.3"));
+
+	// The queue it saved at exit is the one it resumed with.
+	std::ifstream ifs(q_path, std::ios::binary);
+	std::vector<std::string> q;
+	std::uint32_t size = 0;
+	ifs.read(reinterpret_cast<char*>(&size), sizeof(size));
+	for (std::uint32_t i = 0; i < size; ++i)
+	{
+		std::uint32_t len = 0;
+		ifs.read(reinterpret_cast<char*>(&len), sizeof(len));
+		std::string s(len, '\0');
+		ifs.read(s.data(), len);
+		q.push_back(std::move(s));
+	}
+	BOOST_REQUIRE(ifs);
+	BOOST_TEST(
+		q == std::vector<std::string>({"https://a.com/1", "https://b.com/2"}),
+		boost::test_tools::per_element()
+	);
+
+	xp::Database db(db_path.string());
+	BOOST_CHECK_EQUAL(db.get_metadata(indexer::CKPT_ID_KEY), "3");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(CorpusIndexSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(corpus_round_trip)
+{
+	const auto dir = temp_dir / "corpus";
+	{
+		corpus_writer w(dir);
+		w.write({"https://abc.org/a", 200, {{"date", "Mon, 14 Jul 2025"}}, "A"});
+		w.write({"https://abc.org/b", 404, {}, ""});
+	}
+	{
+		// A new writer writes to a new segment.
+		corpus_writer w(dir);
+		w.write({"https://abc.org/c", 200, {}, "C"});
+	}
+	// Tear the last record.
+	const auto last = corpus::segments(dir).back();
+	fs::resize_file(last, fs::file_size(last) - 1);
+
+	corpus_reader r(dir);
+	stored_page p;
+	BOOST_REQUIRE(r.next(p));
+	BOOST_CHECK_EQUAL(p.url, "https://abc.org/a");
+	BOOST_CHECK_EQUAL(p.status, 200u);
+	BOOST_CHECK_EQUAL(p.headers.at("date"), "Mon, 14 Jul 2025");
+	BOOST_CHECK_EQUAL(p.body, "A");
+	BOOST_REQUIRE(r.next(p));
+	BOOST_CHECK_EQUAL(p.status, 404u);
+	BOOST_CHECK(!r.next(p));
+}
+
+BOOST_AUTO_TEST_CASE(archive_find)
+{
+	const auto dir = temp_dir / "archive";
+	corpus_options opts;
+	// Every page goes to a new segment.
+	opts.segment_size = 1;
+	{
+		corpus_archiver a(dir, opts);
+		a.put({"https://abc.org/a", 200, {}, std::string(1000, 'a')});
+		a.put({"https://abc.org/b", 200, {}, "B"});
+		a.flush();
+		a.put({"https://abc.org/a", 200, {}, "A again"});
+	}
+	BOOST_CHECK_GE(corpus::segments(dir).size(), 3u);
+
+	auto b = corpus::find(dir, "https://abc.org/b");
+	BOOST_REQUIRE(b);
+	BOOST_CHECK_EQUAL(b->body, "B");
+	// The latest one.
+	auto a = corpus::find(dir, "https://abc.org/a");
+	BOOST_REQUIRE(a);
+	BOOST_CHECK_EQUAL(a->body, "A again");
+	BOOST_CHECK(!corpus::find(dir, "https://abc.org/c"));
+
+	// Compressed pages are read as they were.
+	corpus_reader r(dir);
+	stored_page p;
+	BOOST_REQUIRE(r.next(p));
+	BOOST_CHECK_EQUAL(p.body, std::string(1000, 'a'));
+}
+
+BOOST_AUTO_TEST_CASE(add_prepared)
+{
+	class index i(db_path);
+	auto tg = i.make_term_generator();
+	const urls::url u("https://abc.org/a");
+	const ch::year_month_day d{ch::year(2025), ch::July, ch::day(14)};
+
+	i.add_document(i.make_document(tg, u, "A", d, "some content"), true);
+	BOOST_CHECK_EQUAL(i.num_documents(), 1);
+	// Replaced, not added again.
+	i.add_document(i.make_document(tg, u, "A", d, "other content"));
+	BOOST_CHECK_EQUAL(i.num_documents(), 1);
+	BOOST_CHECK(i.get_document(u));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(MetricsSuite)
+
+BOOST_AUTO_TEST_CASE(histogram_and_export)
+{
+	// Every bucket holds the values between the maxima of its neighbours.
+	for (unsigned b = 1; b < 200; ++b)
+	{
+		BOOST_CHECK_EQUAL(
+			metric_histogram::bucket_of(metric_histogram::bucket_max(b)), b
+		);
+		BOOST_CHECK_EQUAL(
+			metric_histogram::bucket_of(metric_histogram::bucket_max(b-1) + 1),
+			b
+		);
+	}
+
+	metrics_registry r;
+	auto& h = r.histogram("t_seconds", "Test.", "stage=\"a\"");
+	for (int i = 1; i <= 100; ++i)
+		h.observe(ch::milliseconds(i));
+	BOOST_CHECK_EQUAL(h.count(), 100u);
+	// Within 1/8.
+	BOOST_CHECK_CLOSE(h.quantile_seconds(0.5), 0.050, 12.5);
+	BOOST_CHECK_CLOSE(h.quantile_seconds(0.99), 0.099, 12.5);
+	BOOST_CHECK_CLOSE(h.max_seconds(), 0.1, 1e-6);
+
+	r.counter("t_total", "Test.").inc(3);
+	// The same metric.
+	r.counter("t_total", "Test.").inc();
+	BOOST_CHECK_THROW(r.gauge("t_total", "Test."), std::logic_error);
+
+	std::ostringstream prom, json;
+	r.write_prometheus(prom);
+	r.write_json(json);
+	BOOST_CHECK(
+		prom.str().find("# TYPE t_seconds histogram") != std::string::npos
+	);
+	BOOST_CHECK(
+		prom.str().find("t_seconds_bucket{stage=\"a\",le=\"+Inf\"} 100") !=
+		std::string::npos
+	);
+	BOOST_CHECK(prom.str().find("t_total 4\n") != std::string::npos);
+	BOOST_CHECK(json.str().find("\"t_total\": 4") != std::string::npos);
+	BOOST_CHECK(
+		json.str().find("\"t_seconds{stage=\\\"a\\\"}\": {\"count\": 100") !=
+		std::string::npos
+	);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(LoggerSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(fields_and_rotation)
+{
+	auto& l = logger::global();
+	const auto path = temp_dir / "log";
+	l.open({path, 256, 2});
+	l.set_level(log_levels::VERBOSE_1);
+
+	UTIL_LOG(log_levels::VERBOSE_1, "first", {"url", "https://abc.org/a"},
+		{"stage", "has space"}, {"n", 3});
+	// Not evaluated.
+	bool evaluated = false;
+	UTIL_LOG(log_levels::VERBOSE_2, [&] { evaluated = true; return ""; }());
+	BOOST_CHECK(!evaluated);
+	l.flush();
+	{
+		std::ifstream ifs(path);
+		std::string line;
+		BOOST_REQUIRE(std::getline(ifs, line));
+		BOOST_CHECK(line.ends_with(
+			" first url=https://abc.org/a stage=\"has space\" n=3"
+		));
+	}
+
+	for (int i = 0; i < 50; ++i)
+		UTIL_LOG(log_levels::VERBOSE_1, "a line long enough to rotate the log");
+	l.flush();
+	BOOST_CHECK(fs::exists(path));
+	BOOST_CHECK(fs::exists(path.string() + ".2"));
+	BOOST_CHECK(!fs::exists(path.string() + ".3"));
+
+	// Back to stdout for the other tests.
+	l.open({});
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(TraceSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(sampled_spans)
+{
+	auto& t = tracer::global();
+	const auto path = temp_dir / "trace.json";
+
+	// Not recorded when off.
+	{
+		trace_page p("https://abc.org/off");
+		trace_span s("parse", true);
+	}
+
+	// Every other page.
+	t.start(0.5);
+	for (int i = 0; i < 4; ++i)
+	{
+		trace_page p("https://abc.org/" + std::to_string(i) + "\"q\"");
+		trace_span s("parse");
+	}
+	{
+		trace_span s("commit", true);
+	}
+	t.stop_and_write(path);
+
+	std::ifstream ifs(path);
+	std::stringstream ss;
+	ss << ifs.rdbuf();
+	const auto j = ss.str();
+	auto count = [&j](std::string_view s) {
+		size_t n = 0;
+		for (auto p = j.find(s); p != std::string::npos; p = j.find(s, p + 1))
+			++n;
+		return n;
+	};
+	BOOST_CHECK(j.starts_with("{\"displayTimeUnit\""));
+	BOOST_CHECK_EQUAL(count("\"name\": \"page\""), 2);
+	BOOST_CHECK_EQUAL(count("\"name\": \"parse\""), 2);
+	BOOST_CHECK_EQUAL(count("\"name\": \"commit\""), 1);
+	BOOST_CHECK_EQUAL(count("https://abc.org/off"), 0);
+	BOOST_CHECK_EQUAL(count("\\\"q\\\""), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(NearDupSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(simhash_and_policies)
+{
+	std::string story;
+	for (int i = 0; i < 40; ++i)
+		story += "Markets moved as word" + std::to_string(i) + " rose. ";
+	// The same story from another outlet, with a different ending.
+	const auto copy = story + "Reporting by another outlet.";
+	std::string other;
+	for (int i = 0; i < 40; ++i)
+		other += "Quite unrelated text number " + std::to_string(i * 7) + ". ";
+
+	BOOST_REQUIRE(simhash(story) && simhash(copy) && simhash(other));
+	BOOST_CHECK(!simhash("Too short to tell."));
+	BOOST_CHECK_LE(std::popcount(*simhash(story) ^ *simhash(copy)),
+		int(near_dup_index::MAX_DISTANCE));
+	BOOST_CHECK_GT(std::popcount(*simhash(story) ^ *simhash(other)),
+		int(near_dup_index::MAX_DISTANCE));
+
+	// The oldest is forgotten.
+	near_dup_index recent(2);
+	recent.insert(*simhash(story), "a", "a");
+	BOOST_CHECK_EQUAL(recent.find(*simhash(copy), "b").value_or(""), "a");
+	BOOST_CHECK(!recent.find(*simhash(copy), "a"));
+	recent.insert(*simhash(other), "c", "c");
+	recent.insert(*simhash(other), "d", "c");
+	BOOST_CHECK(!recent.find(*simhash(copy), "b"));
+
+	const ch::year_month_day date{ch::year(2025), ch::month(7), ch::day(1)};
+	const urls::url u1("https://a.com/story"), u2("https://b.com/story"),
+		u3("https://c.com/other");
+	{
+		class index i(db_path);
+		i.add_document(u1, "Story", date, story);
+		i.add_document(u2, "Story", date, copy);
+		i.add_document(u3, "Other", date, other);
+		BOOST_CHECK_EQUAL(i.num_documents(), 3);
+
+		// Linked to the first.
+		const auto c1 = i.get_document(u1)->get_value(index::CLUSTER_SLOT);
+		BOOST_CHECK_EQUAL(c1, i.url2hashid(u1));
+		BOOST_CHECK_EQUAL(
+			i.get_document(u2)->get_value(index::CLUSTER_SLOT), c1
+		);
+		BOOST_CHECK_EQUAL(
+			i.get_document(u3)->get_value(index::CLUSTER_SLOT),
+			i.url2hashid(u3)
+		);
+		BOOST_CHECK_EQUAL(
+			i.get_document(u1)->get_value(index::SIMHASH_SLOT).size(), 16
+		);
+
+		// Updating a page does not make it a duplicate of itself.
+		i.add_document(u1, "Story", date, story);
+		BOOST_CHECK_EQUAL(
+			i.get_document(u1)->get_value(index::CLUSTER_SLOT), c1
+		);
+	}
+	fs::remove_all(db_path);
+
+	index::open_params par(db_path);
+	par.near_dups = index::near_dup_policy_from_name("skip");
+	class index i(par);
+	i.add_document(u1, "Story", date, story);
+	i.add_document(u2, "Story", date, copy);
+	BOOST_CHECK_EQUAL(i.num_documents(), 1);
+	BOOST_CHECK(!i.get_document(u2));
+}
+
+// @returns 40 numbered sentences of s, enough for a fingerprint.
+static std::string make_story(std::string_view s)
+{
+	std::string ret;
+	for (int i = 0; i < 40; ++i)
+		ret += std::string(s) + " number" + std::to_string(i) + ". ";
+	return ret;
+}
+
+BOOST_AUTO_TEST_CASE(collapse_results)
+{
+	const auto story = make_story("Markets moved as stocks rose");
+	const ch::year_month_day date{ch::year(2025), ch::month(7), ch::day(1)};
+
+	class index i(db_path);
+	i.add_document(urls::url("https://a.com/s"), "Stocks", date, story);
+	i.add_document(
+		urls::url("https://b.com/s"), "Stocks", date, story + " More."
+	);
+	i.add_document(
+		urls::url("https://c.com/s"), "Stocks", date,
+		make_story("Stocks fell on another day entirely")
+	);
+	i.synchronize();
+
+	searcher s(i);
+	BOOST_CHECK_EQUAL(s.query("stocks").mset.size(), 3);
+
+	searcher::query_params par;
+	par.collapse = true;
+	auto [mset, truncated] = s.query("stocks", par);
+	BOOST_REQUIRE_EQUAL(mset.size(), 2);
+	xp::doccount collapsed = 0;
+	for (auto it = mset.begin(); it != mset.end(); ++it)
+		collapsed += it.get_collapse_count();
+	BOOST_CHECK_EQUAL(collapsed, 1);
+}
+
+BOOST_AUTO_TEST_CASE(recent_survives_reopening)
+{
+	const auto story = make_story("Markets moved as stocks rose");
+	const ch::year_month_day date{ch::year(2025), ch::month(7), ch::day(1)};
+	const urls::url u1("https://a.com/s"), u2("https://b.com/s"),
+		u3("https://c.com/s");
+
+	index::open_params par(db_path);
+	par.near_dups = index::near_dup_policy_from_name("skip");
+	{
+		class index i(par);
+		BOOST_CHECK(i.add_document(u1, "Stocks", date, story));
+	}
+	{
+		// Found among the documents added before.
+		class index i(par);
+		BOOST_CHECK(!i.add_document(u2, "Stocks", date, story + " More."));
+		BOOST_CHECK_EQUAL(i.num_documents(), 1);
+		// But not an update of one.
+		BOOST_CHECK(i.add_document(u1, "Stocks", date, story));
+	}
+
+	par.near_dups = index::near_dup_policy_from_name("link");
+	class index i(par);
+	BOOST_CHECK(i.add_document(u3, "Stocks", date, story + " Other."));
+	BOOST_CHECK_EQUAL(
+		i.get_document(u3)->get_value(index::CLUSTER_SLOT),
+		i.url2hashid(u1)
+	);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(CanonicalSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(canonical_urls_and_variants)
+{
+	const url_canon canon;
+	auto amp = create_mock_webpage(
+		"https://amp.abc.com/news/story.amp", "Story",
+		R"(<link rel="AMPHTML Canonical" href=" /news/story ">Text)"
+	);
+	BOOST_CHECK_EQUAL(
+		amp.get_canonical_url(canon).value().buffer(),
+		"https://amp.abc.com/news/story"
+	);
+
+	// Of another site, or of itself.
+	auto other = create_mock_webpage(
+		"https://m.abc.com/a", "A",
+		R"(<link rel="canonical" href="https://xyz.com/a">Text)"
+	);
+	BOOST_CHECK(!other.get_canonical_url(canon));
+	auto self = create_mock_webpage(
+		"https://abc.com/a/", "A",
+		R"(<link rel="canonical" href="https://abc.com/a">Text)"
+	);
+	BOOST_CHECK(!self.get_canonical_url(canon));
+	BOOST_CHECK(!create_mock_webpage("https://abc.com/b", "B", "Text")
+		.get_canonical_url(canon));
+
+	// The mobile site of the same, but not another under the same suffix,
+	// nor a parent that may be one.
+	BOOST_CHECK(create_mock_webpage(
+		"https://m.abc.co.uk/a", "A",
+		R"(<link rel="canonical" href="https://www.abc.co.uk/a">Text)"
+	).get_canonical_url(canon));
+	BOOST_CHECK(!create_mock_webpage(
+		"https://news.abc.co.uk/a", "A",
+		R"(<link rel="canonical" href="https://xyz.co.uk/a">Text)"
+	).get_canonical_url(canon));
+	BOOST_CHECK(!create_mock_webpage(
+		"https://abc.blog.com/a", "A",
+		R"(<link rel="canonical" href="https://blog.com/a">Text)"
+	).get_canonical_url(canon));
+
+	const urls::url variant("https://m.abc.com/news/story?src=x");
+	const urls::url canonical("https://www.abc.com/news/story");
+	{
+		class index i(db_path);
+		BOOST_CHECK(!i.canonical_of(variant));
+		i.add_variant(variant, canonical);
+		i.synchronize();
+	}
+	class index i(db_path);
+	BOOST_CHECK_EQUAL(
+		i.canonical_of(urls::url("https://m.abc.com/news/story/"))
+			.value().buffer(),
+		canonical.buffer()
+	);
+	BOOST_CHECK(!i.canonical_of(canonical));
+}
+
+BOOST_AUTO_TEST_CASE(shrink_prunes_variants)
+{
+	const ch::year_month_day old{ch::year(2024), ch::month(1), ch::day(1)},
+		now{ch::year(2025), ch::month(1), ch::day(1)};
+	const urls::url c1("https://abc.com/1"), c2("https://abc.com/2");
+
+	class index i(db_path);
+	i.add_document(c1, "Old", old, "text");
+	i.add_document(c2, "New", now, "text");
+	i.add_variant(urls::url("https://m.abc.com/1"), c1);
+	i.add_variant(urls::url("https://m.abc.com/2"), c2);
+
+	i.shrink(1, index::shrink_policy::OLDEST);
+	BOOST_CHECK(!i.canonical_of(urls::url("https://m.abc.com/1")));
+	BOOST_CHECK_EQUAL(
+		i.canonical_of(urls::url("https://m.abc.com/2")).value().buffer(),
+		c2.buffer()
+	);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(UrlCanonSuite, DiskIndexFixture)
+
+BOOST_AUTO_TEST_CASE(keys)
+{
+	url_canon c;
+	auto key = [&c](const char* u) { return c.key(urls::url_view(u)); };
+
+	BOOST_CHECK_EQUAL(key("HTTPS://WWW.Abc.com:443/a/./b/"), "abc.com/a/b");
+	BOOST_CHECK_EQUAL(key("https://abc.com/a/b?utm_source=x#f"), "abc.com/a/b");
+	BOOST_CHECK_EQUAL(
+		key("http://abc.com:8080/x/%7e%2fb/../%7E"), "abc.com:8080/x/~"
+	);
+	BOOST_CHECK_EQUAL(key("https://abc.com/a/b/../.."), "abc.com");
+	BOOST_CHECK_EQUAL(key("https://abc.com/"), "abc.com");
+
+	c.parse_rules("# Only x.com's queries matter.\n* drop\nx.com keep sid\n");
+	BOOST_CHECK_EQUAL(
+		key("https://www.x.com/p?id=3&utm_medium=a&b=%7e1&fbclid=2&sid=4"),
+		"x.com/p?b=~1&id=3"
+	);
+	BOOST_CHECK_EQUAL(key("https://m.x.com/p?b=1&a=2"), "m.x.com/p?a=2&b=1");
+	BOOST_CHECK_EQUAL(key("https://y.com/p?b=1"), "y.com/p");
+
+	// Unchanged by invalid rules.
+	const auto text = c.rules_text();
+	BOOST_CHECK_THROW(c.parse_rules("x.com maybe"), std::runtime_error);
+	BOOST_CHECK_EQUAL(c.rules_text(), text);
+}
+
+BOOST_AUTO_TEST_CASE(rekey_legacy_db)
+{
+	const char* us[] = {
+		"https://www.abc.com/a/", "https://abc.com/a?utm_source=x",
+		"https://abc.com/c"
+	};
+	{
+		xp::WritableDatabase db(db_path.string(), xp::DB_CREATE_OR_OVERWRITE);
+		for (auto* u : us)
+		{
+			xp::Document d;
+			d.set_data(std::string(u) + "\tTitle");
+			d.add_boolean_term(index::legacy_hashid(urls::url_view(u)));
+			db.add_document(d);
+		}
+	}
+
+	{
+		class index i(db_path);
+		BOOST_CHECK(i.get_document(urls::url(us[1])));
+		BOOST_CHECK(!i.get_document(urls::url("https://abc.com/./c/")));
+
+		auto res = i.rekey_urls();
+		BOOST_CHECK_EQUAL(res.num_rekeyed, 2);
+		BOOST_CHECK_EQUAL(res.num_merged, 1);
+		BOOST_CHECK_EQUAL(i.num_documents(), 2);
+		BOOST_CHECK(i.get_document(urls::url("https://abc.com/./c/")));
+		BOOST_CHECK_EQUAL(
+			index::url_from_doc(*i.get_document(urls::url("http://abc.com/a"))),
+			us[0]
+		);
+	}
+
+	// Its rules are kept.
+	index::open_params par(db_path);
+	par.url_rules = "abc.com keep";
+	BOOST_CHECK_THROW(class index j(par), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rules_per_db)
+{
+	const urls::url u("https://abc.com/a?id=1"), v("https://abc.com/a?id=2");
+	auto make_legacy = [&u](const fs::path& p) {
+		xp::WritableDatabase db(p.string(), xp::DB_CREATE_OR_OVERWRITE);
+		xp::Document d;
+		d.set_data(std::string(u.buffer()) + "\tTitle");
+		d.add_boolean_term(index::legacy_hashid(u));
+		db.add_document(d);
+	};
+	make_legacy(db_path);
+
+	// A legacy db opened with rules stays legacy, and takes them when
+	// rekeyed.
+	index::open_params par(db_path);
+	par.url_rules = "abc.com keep";
+	class index i(par);
+	BOOST_CHECK(i.get_document(u));
+	BOOST_CHECK(i.get_metadata(index::URL_RULES_KEY).empty());
+
+	// Another db, of other rules, does not change those of the first.
+	class index j(temp_dir / "other_db");
+	BOOST_CHECK_NE(i.url2hashid(u), i.url2hashid(v));
+	BOOST_CHECK_EQUAL(j.url2hashid(u), j.url2hashid(v));
+
+	i.rekey_urls();
+	BOOST_CHECK(i.get_document(u));
+	BOOST_CHECK(!i.get_document(v));
+	BOOST_CHECK_EQUAL(
+		i.get_metadata(index::URL_RULES_KEY),
+		i.get_url_canon().rules_text()
+	);
+	BOOST_CHECK_NE(i.url2hashid(u), i.url2hashid(v));
+
+	// Even with the default ones, which it has none of.
+	index::open_params legacy(temp_dir / "legacy_db");
+	make_legacy(legacy.dbpath);
+	legacy.url_rules = url_canon().rules_text();
+	BOOST_CHECK_NO_THROW(class index k(legacy));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(UrlRulesSuite)
+
+BOOST_AUTO_TEST_CASE(predicates)
+{
+	for (auto p : {
+		"/2025-02-01", "/2025-29-07/a", "08-12-2025", "/x/12-09-2025/",
+		"/2025/11/03/a-b", "2025/3/15", "/11/20/2025", "/30/01/2025"
+	})
+		BOOST_CHECK_MESSAGE(has_dates(p), p);
+	for (auto p : {
+		"-1/-2/2025", "1/1/1", "2021/2022/2023", "/a2025/01/01",
+		"/2025/01/011", "/2025--01-01"
+	})
+		BOOST_CHECK_MESSAGE(!has_dates(p), p);
+
+	for (auto p : {"a-b-c", "/x/some-dashed-words", "/1a-bc-d2"})
+		BOOST_CHECK_MESSAGE(has_words_separated_by_dash(p), p);
+	for (auto p : {"", "a-b", "/a-b/c-d", "a--b-c", "a-1-b-c", "-a-b"})
+		BOOST_CHECK_MESSAGE(!has_words_separated_by_dash(p), p);
+}
+
+BOOST_AUTO_TEST_CASE(match)
+{
+	const url_rules r(R"(
+# A comment.
+[a.com]
+recurse empty
+recurse prefix=/topic
+recurse prefix=/topics/old
+both date slug !prefix=/topics
+index prefix=/content minlen=10 digit@9
+
+[b.com]
+recurse
+	)");
+	BOOST_CHECK_EQUAL(r.num_hosts(), 2);
+
+	auto check = [&r](
+		std::string_view host, std::string_view path, bool rec, bool idx
+	) {
+		const auto v = r.match(host, path);
+		BOOST_CHECK_MESSAGE(
+			v.recurse == rec && v.index == idx,
+			std::string(host) + std::string(path)
+		);
+	};
+	check("a.com", "", true, false);
+	check("a.com", "/topic", true, false);
+	check("a.com", "/topics/x", true, false);
+	check("a.com", "/topics/2025/01/01/a-b-c", true, false);
+	check("a.com", "/news/2025/01/01/a-b-c", true, true);
+	check("a.com", "/news/2025/01/01/a-b", false, false);
+	check("a.com", "/content/1", false, true);
+	check("a.com", "/content/x", false, false);
+	check("a.com", "/conten", false, false);
+	check("b.com", "/anything", true, false);
+	check("c.com", "", false, false);
+	check("A.com", "", false, false);
+
+	BOOST_CHECK(r.match(urls::url_view("https://a.com/n/1-1-2025/x-y-z")).index);
+	BOOST_CHECK(!url_rules().match("a.com", "").recurse);
+}
+
+BOOST_AUTO_TEST_CASE(invalid)
+{
+	for (auto text : {
+		"recurse", "[a.com]\nrecurse prefix=", "[a.com]\nfollow",
+		"[a.com]\nindex digit@x", "[a.com]\nindex minlen=-1", "[]",
+		"[a.com] recurse", "[a.com]\nindex sluggish"
+	})
+		BOOST_CHECK_THROW(url_rules{text}, std::runtime_error);
+
+	std::string text = "[a.com]\n";
+	for (unsigned i = 0; i <= url_rules::MAX_PREDICATES; ++i)
+		text += "index contains=" + std::to_string(i) + '\n';
+	BOOST_CHECK_THROW(url_rules{text}, std::runtime_error);
+	// The same predicate is only counted once.
+	text = "[a.com]\n";
+	for (unsigned i = 0; i <= url_rules::MAX_PREDICATES; ++i)
+		text += "index contains=x\n";
+	BOOST_CHECK_NO_THROW(url_rules{text});
+}
+
+BOOST_AUTO_TEST_SUITE_END()